@@ -0,0 +1,236 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_BASE64_H
+#define __X_PACK_BASE64_H
+
+#include <string>
+#include <stdint.h>
+
+#if defined(__SSSE3__) || defined(__AVX__)
+#define X_PACK_BASE64_SSSE3
+#include <tmmintrin.h>
+#endif
+
+namespace xpack {
+
+/*
+  Standard base64(RFC 4648, with '=' padding). With SSSE3(-mssse3, -march=native...)
+  12 bytes are encoded/16 chars decoded per step, otherwise a table driven codec is used.
+  Decode accepts input without padding.
+*/
+class Base64 {
+public:
+    static size_t EncodedLength(size_t len) {
+        return (len+2)/3*4;
+    }
+
+    // out must have EncodedLength(len) bytes, return the number of chars written
+    static size_t Encode(const void *data, size_t len, char *out) {
+        const unsigned char *in = (const unsigned char*)data;
+        static const char tab[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        char *o = out;
+        size_t i = 0;
+        #ifdef X_PACK_BASE64_SSSE3
+        i = encode_ssse3(in, len, o);
+        o += i/3*4;
+        #endif
+        for (; i+3<=len; i+=3, o+=4) {
+            uint32_t v = ((uint32_t)in[i]<<16)|((uint32_t)in[i+1]<<8)|in[i+2];
+            o[0] = tab[v>>18];
+            o[1] = tab[(v>>12)&0x3f];
+            o[2] = tab[(v>>6)&0x3f];
+            o[3] = tab[v&0x3f];
+        }
+        if (i+1 == len) {
+            uint32_t v = (uint32_t)in[i]<<16;
+            o[0] = tab[v>>18];
+            o[1] = tab[(v>>12)&0x3f];
+            o[2] = '=';
+            o[3] = '=';
+            o += 4;
+        } else if (i+2 == len) {
+            uint32_t v = ((uint32_t)in[i]<<16)|((uint32_t)in[i+1]<<8);
+            o[0] = tab[v>>18];
+            o[1] = tab[(v>>12)&0x3f];
+            o[2] = tab[(v>>6)&0x3f];
+            o[3] = '=';
+            o += 4;
+        }
+        return (size_t)(o-out);
+    }
+    static std::string Encode(const void *data, size_t len) {
+        std::string str(EncodedLength(len), '\0');
+        if (len > 0) {
+            Encode(data, len, &str[0]);
+        }
+        return str;
+    }
+
+    // number of decoded bytes, (size_t)-1 if the length or padding is invalid
+    static size_t DecodedLength(const char *str, size_t len) {
+        size_t pad = 0;
+        if (len>0 && str[len-1]=='=') {
+            if (len%4 != 0) {
+                return (size_t)-1;
+            }
+            pad = (len>1 && str[len-2]=='=')?2:1;
+        }
+        size_t n = len-pad;
+        if (n%4 == 1) {
+            return (size_t)-1;
+        }
+        return n/4*3+(n%4==0?0:n%4-1);
+    }
+
+    // out must have DecodedLength(str, len) bytes, return false if str is not valid base64
+    static bool Decode(const char *str, size_t len, void *out) {
+        if (DecodedLength(str, len) == (size_t)-1) {
+            return false;
+        }
+        while (len>0 && str[len-1]=='=') {
+            --len;
+        }
+
+        const signed char *tab = table();
+        const unsigned char *in = (const unsigned char*)str;
+        unsigned char *o = (unsigned char*)out;
+        size_t i = 0;
+        #ifdef X_PACK_BASE64_SSSE3
+        i = decode_ssse3(in, len, o);
+        o += i/4*3;
+        #endif
+        for (; i+4<=len; i+=4, o+=3) {
+            int a = tab[in[i]], b = tab[in[i+1]], c = tab[in[i+2]], d = tab[in[i+3]];
+            if ((a|b|c|d) < 0) {
+                return false;
+            }
+            uint32_t v = ((uint32_t)a<<18)|((uint32_t)b<<12)|((uint32_t)c<<6)|(uint32_t)d;
+            o[0] = (unsigned char)(v>>16);
+            o[1] = (unsigned char)(v>>8);
+            o[2] = (unsigned char)v;
+        }
+        if (i < len) { // 2 or 3 chars left
+            int a = tab[in[i]], b = tab[in[i+1]], c = (i+3==len)?tab[in[i+2]]:0;
+            if ((a|b|c) < 0) {
+                return false;
+            }
+            uint32_t v = ((uint32_t)a<<18)|((uint32_t)b<<12)|((uint32_t)c<<6);
+            o[0] = (unsigned char)(v>>16);
+            if (i+3 == len) {
+                o[1] = (unsigned char)(v>>8);
+            }
+        }
+        return true;
+    }
+
+    static bool LittleEndian() {
+        const uint16_t v = 1;
+        return 1 == *(const unsigned char*)&v;
+    }
+    // reverse the bytes of each element, to convert between host and little-endian on big-endian host
+    static void SwapBytes(void *data, size_t size, size_t count) {
+        unsigned char *p = (unsigned char*)data;
+        for (size_t i=0; i<count; ++i, p+=size) {
+            for (size_t l=0, r=size-1; l<r; ++l, --r) {
+                unsigned char t = p[l];
+                p[l] = p[r];
+                p[r] = t;
+            }
+        }
+    }
+
+private:
+    static const signed char* table() {
+        static const signed char tab[256] = {
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+            52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+            -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+            15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+            -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+            41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        };
+        return tab;
+    }
+
+    #ifdef X_PACK_BASE64_SSSE3
+    // 12 bytes -> 16 chars per step, loads 16 bytes. return the number of bytes consumed
+    static size_t encode_ssse3(const unsigned char *in, size_t len, char *out) {
+        const __m128i shuf = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+        size_t i = 0;
+        for (; i+16<=len; i+=12, out+=16) {
+            __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in+i)), shuf);
+            // split every 3 bytes into 4 6-bit indexes, one per byte
+            __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+            __m128i t1 = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+            __m128i idx = _mm_or_si128(t0, t1);
+            // 0..25 +'A', 26..51 +'a'-26, 52..61 +'0'-52, 62 '+', 63 '/'
+            __m128i shift = _mm_set1_epi8('A');
+            shift = _mm_add_epi8(shift, _mm_and_si128(_mm_cmpgt_epi8(idx, _mm_set1_epi8(25)), _mm_set1_epi8(6)));
+            shift = _mm_add_epi8(shift, _mm_and_si128(_mm_cmpgt_epi8(idx, _mm_set1_epi8(51)), _mm_set1_epi8(-75)));
+            shift = _mm_add_epi8(shift, _mm_and_si128(_mm_cmpgt_epi8(idx, _mm_set1_epi8(61)), _mm_set1_epi8(-15)));
+            shift = _mm_add_epi8(shift, _mm_and_si128(_mm_cmpgt_epi8(idx, _mm_set1_epi8(62)), _mm_set1_epi8(3)));
+            _mm_storeu_si128((__m128i*)out, _mm_add_epi8(idx, shift));
+        }
+        return i;
+    }
+
+    // 16 chars -> 12 bytes per step, stores 16 bytes. stop at an invalid char, the scalar loop reports it.
+    // return the number of chars consumed
+    static size_t decode_ssse3(const unsigned char *in, size_t len, unsigned char *out) {
+        const __m128i shuf = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        size_t i = 0;
+        for (; i+24<=len; i+=16, out+=12) { // at least 18 bytes left in out
+            __m128i c = _mm_loadu_si128((const __m128i*)(in+i));
+            // signed compare, chars >= 0x80 match no range
+            __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A'-1)), _mm_cmpgt_epi8(_mm_set1_epi8('Z'+1), c));
+            __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a'-1)), _mm_cmpgt_epi8(_mm_set1_epi8('z'+1), c));
+            __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0'-1)), _mm_cmpgt_epi8(_mm_set1_epi8('9'+1), c));
+            __m128i plus = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+            __m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+            __m128i valid = _mm_or_si128(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, plus)), slash);
+            if (_mm_movemask_epi8(valid) != 0xffff) {
+                break;
+            }
+            __m128i shift = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+            shift = _mm_or_si128(shift, _mm_and_si128(lower, _mm_set1_epi8(26-'a')));
+            shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(52-'0')));
+            shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(62-'+')));
+            shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(63-'/')));
+            __m128i v = _mm_add_epi8(c, shift);
+            // pack 4 6-bit values into 3 bytes
+            v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+            v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+            _mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(v, shuf));
+        }
+        return i;
+    }
+    #endif
+};
+
+}
+
+#endif
@@ -21,5 +21,8 @@
 // support qt
 //#define XPACK_SUPPORT_QT
 
+// support gzip by zlib(json::encode_gz, .gz in json::decode_file/encode_file), link with -lz
+//#define XPACK_SUPPORT_ZLIB
+
 
 #endif
@@ -0,0 +1,170 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_DECODE_CACHE_H
+#define __X_PACK_DECODE_CACHE_H
+
+#include <string>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "traits.h"
+#include "util.h"
+
+namespace xpack {
+
+/*
+  Bounded LRU cache of decode result, key is the hash of the input bytes.
+  One cache per (T, FORMAT), shared by all threads. It's split into shards by hash,
+  each shard has its own lock, and decode of a miss runs outside the lock.
+  The input is kept in the entry and compared on hit, so a hash collision is just a miss.
+*/
+template <class T, class FORMAT>
+class DecodeCache:private noncopyable {
+public:
+    static DecodeCache& Instance() {
+        static DecodeCache inst;
+        return inst;
+    }
+
+    /*
+      total budget of the cache, default is 128 documents and no byte limit.
+      capacity: max number of cached documents
+      maxBytes: max total length of the cached input, 0 means no limit. it's a rough measure of memory
+      the budget is split evenly into the shards, a small capacity uses less shards so it's still exact.
+    */
+    void SetCapacity(size_t capacity, size_t maxBytes = 0) {
+        if (capacity == 0) {
+            capacity = 1;
+        }
+        size_t used = capacity<SHARDS?capacity:SHARDS;
+        for (size_t i=0; i<SHARDS; ++i) {
+            std::lock_guard<std::mutex> lock(_shards[i].mu);
+            if (i < used) {
+                _shards[i].capacity = capacity/used + (i<capacity%used?1:0);
+                _shards[i].max_bytes = (maxBytes+used-1)/used;
+            } else { // unused, inserts of the threads still using the old shard count are dropped at once
+                _shards[i].capacity = 0;
+                _shards[i].max_bytes = 0;
+            }
+            _shards[i].evict();
+        }
+        _used = used;
+    }
+
+    void Clear() {
+        for (size_t i=0; i<SHARDS; ++i) {
+            std::lock_guard<std::mutex> lock(_shards[i].mu);
+            _shards[i].index.clear();
+            _shards[i].lru.clear();
+            _shards[i].bytes = 0;
+        }
+    }
+
+    // decode is a functor void(const std::string&, T&), only called on miss
+    template <class DECODE>
+    std::shared_ptr<const T> Get(const std::string &data, DECODE decode) {
+        uint64_t h = Util::hash(data.data(), data.length());
+        Shard &s = _shards[h%_used];
+
+        {
+            std::lock_guard<std::mutex> lock(s.mu);
+            std::shared_ptr<const T> v = s.find(h, data);
+            if (v) {
+                return v;
+            }
+        }
+
+        std::shared_ptr<T> v(new T);
+        decode(data, *v);
+
+        std::lock_guard<std::mutex> lock(s.mu);
+        std::shared_ptr<const T> exists = s.find(h, data); // decoded by other thread at the same time
+        if (exists) {
+            return exists;
+        }
+        s.insert(h, data, v);
+        return v;
+    }
+
+private:
+    static const size_t SHARDS = 16;
+    static const size_t DEFAULT_CAPACITY = 128;
+
+    struct Entry {
+        uint64_t hash;
+        std::string data;
+        std::shared_ptr<const T> val;
+    };
+    typedef std::list<Entry> entry_list;
+
+    struct Shard {
+        std::mutex mu;
+        entry_list lru; // most recently used at front
+        std::unordered_map<uint64_t, typename entry_list::iterator> index;
+        size_t capacity;
+        size_t max_bytes;
+        size_t bytes;
+
+        Shard():capacity(0), max_bytes(0), bytes(0) {}
+
+        std::shared_ptr<const T> find(uint64_t h, const std::string &data) {
+            typename std::unordered_map<uint64_t, typename entry_list::iterator>::iterator it = index.find(h);
+            if (it == index.end() || it->second->data != data) {
+                return std::shared_ptr<const T>();
+            }
+            lru.splice(lru.begin(), lru, it->second);
+            return it->second->val;
+        }
+        void insert(uint64_t h, const std::string &data, const std::shared_ptr<const T> &val) {
+            typename std::unordered_map<uint64_t, typename entry_list::iterator>::iterator it = index.find(h);
+            if (it != index.end()) { // collision, replace it
+                bytes -= it->second->data.length();
+                lru.erase(it->second);
+                index.erase(it);
+            }
+            Entry e;
+            e.hash = h;
+            e.data = data;
+            e.val = val;
+            lru.push_front(e);
+            index[h] = lru.begin();
+            bytes += data.length();
+            evict();
+        }
+        void evict() {
+            while (!lru.empty() && (lru.size()>capacity || (max_bytes>0 && bytes>max_bytes))) {
+                bytes -= lru.back().data.length();
+                index.erase(lru.back().hash);
+                lru.pop_back();
+            }
+        }
+    };
+
+    DecodeCache():_used(SHARDS) {
+        SetCapacity(DEFAULT_CAPACITY);
+    }
+
+    Shard _shards[SHARDS];
+    std::atomic<size_t> _used; // number of shards in use
+};
+
+}
+
+#endif
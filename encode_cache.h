@@ -0,0 +1,304 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_ENCODE_CACHE_H
+#define __X_PACK_ENCODE_CACHE_H
+
+#include <string>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "extend.h"
+#include "traits.h"
+#include "json_encoder.h"
+
+#ifndef X_PACK_SUPPORT_CXX0X
+#error EncodeCache need c++11
+#endif
+
+namespace xpack {
+
+class json;
+
+// options a fragment is encoded with, it's only reused by an encoder with the same options
+struct EncodeOptions {
+    int flag;       // Extend flag of the member
+    int doc_flag;   // X_PACK_DOC_FLAG_xxx
+    int decimals;   // max decimal places
+
+    bool operator == (const EncodeOptions &that) const {
+        return flag==that.flag && doc_flag==that.doc_flag && decimals==that.decimals;
+    }
+};
+
+/*
+  Bounded LRU cache of encoded fragments of immutable shared objects, key is the identity of
+  the object(shared_ptr owner) plus a version and the encode options. One cache per (T, FORMAT),
+  shared by all threads. An entry is a miss if the object is released(even if the address is reused),
+  the version changed or the options differ.
+  Entries of released objects are swept a few per lookup, so they don't keep the memory of
+  make_shared alive. Memory is bounded by the total bytes of fragments, default is 16MB.
+*/
+template <class T, class FORMAT>
+class EncodeCache:private noncopyable {
+public:
+    typedef std::shared_ptr<const std::string> fragment_type;
+
+    static EncodeCache& Instance() {
+        static EncodeCache inst;
+        return inst;
+    }
+
+    void SetCapacity(size_t bytes) {
+        size_t per = (bytes+SHARDS-1)/SHARDS;
+        for (size_t i=0; i<SHARDS; ++i) {
+            std::lock_guard<std::mutex> lock(_shards[i].mu);
+            _shards[i].capacity = per;
+            _shards[i].evict();
+        }
+    }
+
+    // drop the fragment of obj, e.g. when it's changed without a new version
+    void Invalidate(const T *obj) {
+        Shard &s = _shards[hash(obj)%SHARDS];
+        std::lock_guard<std::mutex> lock(s.mu);
+        s.erase(obj);
+    }
+
+    void Clear() {
+        for (size_t i=0; i<SHARDS; ++i) {
+            std::lock_guard<std::mutex> lock(_shards[i].mu);
+            _shards[i].index.clear();
+            _shards[i].lru.clear();
+            _shards[i].cursor = _shards[i].lru.end();
+            _shards[i].bytes = 0;
+        }
+    }
+
+    // encode is a functor void(const T&, const EncodeOptions&, std::string&), only called on miss
+    template <class ENCODE>
+    fragment_type Get(const std::shared_ptr<const T> &obj, uint64_t version, const EncodeOptions &opt, ENCODE encode) {
+        sweep();
+        Shard &s = _shards[hash(obj.get())%SHARDS];
+        {
+            std::lock_guard<std::mutex> lock(s.mu);
+            s.sweep();
+            fragment_type f = s.find(obj, version, opt);
+            if (f) {
+                return f;
+            }
+        }
+
+        std::shared_ptr<std::string> f(new std::string);
+        encode(*obj, opt, *f);
+
+        std::lock_guard<std::mutex> lock(s.mu);
+        s.insert(obj, version, opt, f);
+        return f;
+    }
+
+private:
+    static const size_t SHARDS = 16;
+
+    struct Entry {
+        const T *obj;
+        std::weak_ptr<const T> owner;
+        uint64_t version;
+        EncodeOptions opt;
+        fragment_type json;
+    };
+    typedef std::list<Entry> entry_list;
+
+    struct Shard {
+        std::mutex mu;
+        entry_list lru; // most recently used at front
+        std::unordered_map<const T*, typename entry_list::iterator> index;
+        typename entry_list::iterator cursor; // next entry to sweep
+        size_t bytes;
+        size_t capacity;
+
+        Shard():cursor(lru.end()), bytes(0), capacity((16<<20)/SHARDS) {}
+
+        fragment_type find(const std::shared_ptr<const T> &obj, uint64_t version, const EncodeOptions &opt) {
+            typename std::unordered_map<const T*, typename entry_list::iterator>::iterator it = index.find(obj.get());
+            if (it == index.end()) {
+                return fragment_type();
+            }
+            const Entry &e = *it->second;
+            if (e.version != version || !(e.opt == opt) || e.owner.owner_before(obj) || obj.owner_before(e.owner)) {
+                return fragment_type();
+            }
+            lru.splice(lru.begin(), lru, it->second);
+            return e.json;
+        }
+        void insert(const std::shared_ptr<const T> &obj, uint64_t version, const EncodeOptions &opt, const fragment_type &json) {
+            erase(obj.get());
+            if (json->length() > capacity) {
+                return;
+            }
+            Entry e;
+            e.obj = obj.get();
+            e.owner = obj;
+            e.version = version;
+            e.opt = opt;
+            e.json = json;
+            lru.push_front(e);
+            index[e.obj] = lru.begin();
+            bytes += json->length();
+            evict();
+        }
+        void erase(const T *obj) {
+            typename std::unordered_map<const T*, typename entry_list::iterator>::iterator it = index.find(obj);
+            if (it != index.end()) {
+                bytes -= it->second->json->length();
+                if (cursor == it->second) {
+                    ++cursor;
+                }
+                lru.erase(it->second);
+                index.erase(it);
+            }
+        }
+        void evict() {
+            while (bytes > capacity) {
+                erase(lru.back().obj);
+            }
+        }
+        // a released object is never looked up again, so check 2 entries per lookup round robin
+        void sweep() {
+            for (int i=0; i<2 && !lru.empty(); ++i) {
+                if (cursor == lru.end()) {
+                    cursor = lru.begin();
+                }
+                const Entry &e = *cursor++;
+                if (e.owner.expired()) {
+                    erase(e.obj);
+                }
+            }
+        }
+    };
+
+    static size_t hash(const T *obj) {
+        return (size_t)obj>>4;
+    }
+
+    // the shard of the object is swept on lookup, other shards take turns, so a shard that is no longer used is swept too
+    void sweep() {
+        Shard &s = _shards[(_tick++)%SHARDS];
+        std::unique_lock<std::mutex> lock(s.mu, std::try_to_lock);
+        if (lock.owns_lock()) {
+            s.sweep();
+        }
+    }
+
+    EncodeCache():_tick(0) {}
+
+    Shard _shards[SHARDS];
+    std::atomic<size_t> _tick;
+};
+
+/*
+  shared_ptr<const T> whose json is cached by EncodeCache<T, json>. Opt in by using it
+  instead of shared_ptr for the shared sub-objects:
+
+    struct Resp {
+        std::vector<xpack::Memo<Card> > cards;
+        XPACK(O(cards));
+    };
+
+  The object must not be changed while it's cached. Give it a new version or call
+  EncodeCache<T, json>::Instance().Invalidate if it is.
+  Only compact json encoding uses the cache(pretty fragments depend on the indent level), the fragment
+  is encoded with the flag of the member, doc flag and decimal places of the encoder. With
+  X_PACK_DOC_FLAG_REF the cache is bypassed, ids of shared objects are numbered in the whole document.
+*/
+template <class T>
+class Memo {
+public:
+    Memo():_version(0) {}
+    Memo(const std::shared_ptr<const T> &ptr, uint64_t version=0):_ptr(ptr), _version(version) {}
+
+    const std::shared_ptr<const T>& ptr() const {
+        return _ptr;
+    }
+    uint64_t version() const {
+        return _version;
+    }
+    const T* get() const {
+        return _ptr.get();
+    }
+    const T& operator *() const {
+        return *_ptr;
+    }
+    const T* operator ->() const {
+        return _ptr.get();
+    }
+    explicit operator bool() const {
+        return (bool)_ptr;
+    }
+private:
+    std::shared_ptr<const T> _ptr;
+    uint64_t _version;
+};
+
+template<class T>
+struct is_xpack_xtype<Memo<T> > {static bool const value = true;};
+
+template <class OBJ, class T>
+bool xpack_xtype_decode(OBJ &obj, const char*key, Memo<T> &val, const Extend *ext) {
+    std::shared_ptr<T> p(new T);
+    bool ret = obj.decode(key, *p, ext);
+    if (ret) {
+        val = Memo<T>(p);
+    }
+    return ret;
+}
+
+template <class OBJ, class T>
+bool xpack_xtype_encode(OBJ &obj, const char*key, const Memo<T> &val, const Extend *ext) {
+    return obj.encode(key, val.ptr(), ext);
+}
+
+template <class T>
+void xpack_memo_encode(const T &val, const EncodeOptions &opt, std::string &out) {
+    JsonCompactEncoder e;
+    Extend ext(opt.flag, NULL);
+    e.SetDocFlag(opt.doc_flag);
+    e.SetMaxDecimalPlaces(opt.decimals);
+    e.encode(NULL, val, &ext);
+    out = e.String();
+}
+
+template <class T>
+bool xpack_xtype_encode(JsonCompactEncoder &obj, const char*key, const Memo<T> &val, const Extend *ext) {
+    if (!val) {
+        return obj.writeNull(key, ext);
+    } else if (0 != (obj.DocFlag()&X_PACK_DOC_FLAG_REF)) {
+        return obj.encode(key, val.ptr(), ext);
+    }
+    EncodeOptions opt = {Extend::Flag(ext), obj.DocFlag(), obj.MaxDecimalPlaces()};
+    typename EncodeCache<T, json>::fragment_type f = EncodeCache<T, json>::Instance().Get(val.ptr(), val.version(), opt, xpack_memo_encode<T>);
+    if (f->empty()) { // omitted by X_PACK_FLAG_OE
+        return obj.writeNull(key, ext);
+    }
+    return obj.writeRaw(key, f->data(), f->length(), ext);
+}
+
+}
+
+#endif
@@ -33,6 +33,9 @@ namespace xpack {
 #define X_PACK_FLAG_M  (1<<1) // mandatory, in decode
 #define X_PACK_FLAG_EN (1<<2) // empty as null, in json encode
 #define X_PACK_FLAG_SL (1<<3) // encode as one line, currently only supports json vector
+#define X_PACK_FLAG_B64 (1<<4) // vector of numbers as base64 of the little-endian bytes, json and xml
+#define X_PACK_FLAG_COL (1<<5) // vector of struct in columns {"cols":[...],"rows":[[...],...]}, in json encode
+#define X_PACK_FLAG_REF (1<<6) // std::string/char array member is referenced in place instead of copied, in json encode_iov
 
 #define X_PACK_FLAG_ATTR (1<<15) // for xml encode, encode in attribute
 
@@ -40,6 +43,12 @@ namespace xpack {
 #define X_PACK_CTRL_FLAG_INHERIT     (1<<0)
 #define X_PACK_CTRL_FLAG_IGNORE_NULL (1<<1)
 
+// document flag, work for the whole document, pass to xpack::json/xml decode/encode
+#define X_PACK_DOC_FLAG_0    0
+#define X_PACK_DOC_FLAG_UTF8 (1<<0) // validate utf-8. decode: reject invalid input, encode: reject invalid string
+#define X_PACK_DOC_FLAG_STOP (1<<1) // json decode: stop parsing once every member of the top level struct is found
+#define X_PACK_DOC_FLAG_REF  (1<<2) // json: object shared by shared_ptr is written once with "$id", later as {"$ref":id}, and shared again on decode
+
 // Alias name. [def ][type:name[,flag,key@value,flag]]  def not support flag
 struct Alias {
     const char *raw;        // raw name
@@ -122,8 +131,10 @@ struct Extend {
     int flag;
     int ctrl_flag;
     const Alias *alias;
+    const char *key; // set by XPACK encode to the key literal(or alias name) of the member, it's static
+    const void *member; // set by XPACK encode to the address of the member
 
-    Extend(int _flag, const Alias *_alias):flag(_flag), ctrl_flag(0), alias(_alias) {
+    Extend(int _flag, const Alias *_alias):flag(_flag), ctrl_flag(0), alias(_alias), key(NULL), member(NULL) {
     }
 
     Extend(const Extend *ext) {
@@ -131,10 +142,14 @@ struct Extend {
             flag = ext->flag;
             ctrl_flag = ext->ctrl_flag;
             alias = ext->alias;
+            key = ext->key;
+            member = ext->member;
         } else {
             flag = 0;
             ctrl_flag = 0;
             alias = NULL;
+            key = NULL;
+            member = NULL;
         }
     }
 
@@ -170,9 +185,19 @@ struct Extend {
     static bool Mandatory(const Extend *ext) {
         return NULL!=ext && (ext->flag&X_PACK_FLAG_M);
     }
+    static bool Blob(const Extend *ext) {
+        return NULL!=ext && (ext->flag&X_PACK_FLAG_B64);
+    }
+    static bool Columns(const Extend *ext) {
+        return NULL!=ext && (ext->flag&X_PACK_FLAG_COL);
+    }
     static bool Attribute(const Extend *ext) {
         return NULL!=ext && (ext->flag&X_PACK_FLAG_ATTR);
     }
+    // obj is the member itself(not a copy made by xtype or custom encode) and it's flagged with F(REF)
+    static bool Ref(const Extend *ext, const void *obj) {
+        return NULL!=ext && (ext->flag&X_PACK_FLAG_REF) && ext->member==obj;
+    }
 };
 
 }
@@ -0,0 +1,479 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_FIELD_MASK_H
+#define __X_PACK_FIELD_MASK_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <set>
+#include <map>
+#include <deque>
+#include <cstring>
+#include <stdexcept>
+
+#include "extend.h"
+#include "traits.h"
+#include "members.h"
+
+#ifdef X_PACK_SUPPORT_CXX0X
+#include <memory>
+#include <unordered_map>
+#endif
+
+namespace xpack {
+
+/*
+  Compiled field mask of one struct level. Members are numbered in XPACK order,
+  selected members are bits, a member with a sub mask has a child node.
+*/
+class FieldMaskNode {
+    friend class FieldMaskCompiler;
+public:
+    /*
+      called for the index-th member encoded at this level. return false if it's not selected,
+      child is the sub mask, NULL means the whole member.
+    */
+    bool Select(size_t index, const char *key, const FieldMaskNode *&child) const {
+        if (index>=_names.size() || (_names[index]!=key && 0!=strcmp(_names[index], key))) {
+            index = find(key); // encode order differs from decode order(custom act)
+            if (index >= _names.size()) {
+                return false;
+            }
+        }
+        if (0 == (_bits[index>>5]&(1U<<(index&31)))) {
+            return false;
+        }
+        child = _children[index];
+        return true;
+    }
+
+    // number of members at this level, the index-th is selected if Key(index) is not NULL
+    size_t Size() const {
+        return _names.size();
+    }
+    const char *Key(size_t index) const {
+        return 0!=(_bits[index>>5]&(1U<<(index&31)))?_names[index]:NULL;
+    }
+
+private:
+    size_t find(const char *key) const {
+        for (size_t i=0; i<_names.size(); ++i) {
+            if (0 == strcmp(_names[i], key)) {
+                return i;
+            }
+        }
+        return _names.size();
+    }
+
+    std::vector<const char*> _names;  // keys of XPACK, static strings
+    std::vector<unsigned int> _bits;
+    std::vector<const FieldMaskNode*> _children;
+};
+
+// paths of one level: name -> sub paths(empty means the whole member)
+typedef std::map<std::string, std::vector<std::string> > x_field_paths;
+
+/*
+  Visitor of MemberWalker, marks the selected members of a struct and
+  compiles the sub paths with the type of the member.
+*/
+class FieldMaskCompiler:private noncopyable {
+public:
+    FieldMaskCompiler(std::deque<FieldMaskNode> &nodes, FieldMaskNode &node, const x_field_paths &paths):_nodes(nodes), _node(node), _paths(paths), _found(0) {}
+
+    inline const char *Type() const {
+        return "json";
+    }
+
+    template <class T>
+    static void Compile(std::deque<FieldMaskNode> &nodes, FieldMaskNode &node, const std::vector<std::string> &paths, T &val, const std::string &path) {
+        x_field_paths level;
+        for (size_t i=0; i<paths.size(); ++i) {
+            std::string::size_type dot = paths[i].find('.');
+            std::string name = paths[i].substr(0, dot);
+            if (name.empty()) {
+                throw std::runtime_error("field mask: empty field name. path="+path+paths[i]);
+            }
+            std::vector<std::string> &sub = level[name];
+            if (dot == std::string::npos) {
+                sub.clear();
+                sub.push_back(std::string()); // whole member
+            } else if (sub.empty() || !sub[0].empty()) {
+                sub.push_back(paths[i].substr(dot+1));
+            }
+        }
+
+        FieldMaskCompiler c(nodes, node, level);
+        c._path = path;
+        if (!MemberWalker<FieldMaskCompiler>::Walk(c, val)) {
+            throw std::runtime_error("field mask: not a struct. path="+path);
+        }
+        if (c._found != level.size()) {
+            for (x_field_paths::const_iterator it=level.begin(); it!=level.end(); ++it) {
+                if (c._node.find(it->first.c_str()) == c._node._names.size()) {
+                    throw std::runtime_error("field mask: unknown field. path="+path+it->first);
+                }
+            }
+        }
+        node._bits.resize((node._names.size()+31)/32, 0);
+        node._children.resize(node._names.size(), NULL);
+        for (size_t i=0; i<c._selected.size(); ++i) {
+            node._bits[c._selected[i].first>>5] |= 1U<<(c._selected[i].first&31);
+            node._children[c._selected[i].first] = c._selected[i].second;
+        }
+    }
+
+    template <class T>
+    void member(const char *key, T &val, const Extend *ext) {
+        (void)ext;
+        size_t index = _node._names.size();
+        _node._names.push_back(key);
+
+        x_field_paths::const_iterator it = _paths.find(key);
+        if (it != _paths.end()) {
+            ++_found;
+            const FieldMaskNode *child = NULL;
+            if (!it->second[0].empty()) {
+                _nodes.push_back(FieldMaskNode());
+                FieldMaskNode &n = _nodes.back();
+                sub(n, it->second, val, _path+key+".");
+                child = &n;
+            }
+            _selected.push_back(std::make_pair(index, child));
+        }
+    }
+
+private:
+    // containers are transparent, the sub paths are applied to every element
+    template <class T>
+    void sub(FieldMaskNode &n, const std::vector<std::string> &paths, std::vector<T> &val, const std::string &path) {
+        (void)val;
+        T t;
+        sub(n, paths, t, path);
+    }
+    template <class T>
+    void sub(FieldMaskNode &n, const std::vector<std::string> &paths, std::list<T> &val, const std::string &path) {
+        (void)val;
+        T t;
+        sub(n, paths, t, path);
+    }
+    template <class T>
+    void sub(FieldMaskNode &n, const std::vector<std::string> &paths, std::set<T> &val, const std::string &path) {
+        (void)val;
+        T t;
+        sub(n, paths, t, path);
+    }
+    template <class T>
+    void sub(FieldMaskNode &n, const std::vector<std::string> &paths, std::map<std::string, T> &val, const std::string &path) {
+        (void)val;
+        T t;
+        sub(n, paths, t, path);
+    }
+    #ifdef X_PACK_SUPPORT_CXX0X
+    template <class T>
+    void sub(FieldMaskNode &n, const std::vector<std::string> &paths, std::unordered_map<std::string, T> &val, const std::string &path) {
+        (void)val;
+        T t;
+        sub(n, paths, t, path);
+    }
+    template <class T>
+    void sub(FieldMaskNode &n, const std::vector<std::string> &paths, std::shared_ptr<T> &val, const std::string &path) {
+        (void)val;
+        T t;
+        sub(n, paths, t, path);
+    }
+    #endif
+    template <class T>
+    void sub(FieldMaskNode &n, const std::vector<std::string> &paths, T &val, const std::string &path) {
+        Compile(_nodes, n, paths, val, path);
+    }
+
+    std::deque<FieldMaskNode> &_nodes;
+    FieldMaskNode &_node;
+    const x_field_paths &_paths;
+    size_t _found;
+    std::string _path;
+    std::vector<std::pair<size_t, const FieldMaskNode*> > _selected;
+};
+
+/*
+  Runtime field mask of T, like protobuf FieldMask or GraphQL selection. Paths are dotted
+  member names separated by comma, containers(vector, map, shared_ptr...) are transparent:
+
+    xpack::FieldMask<User> mask("id,name,orders.price");
+    std::string s = xpack::json::encode(user, mask);
+
+  "a" selects the whole member a, "a.b" selects b of a. Names are json names(alias resolved).
+  An empty mask selects all members. Unknown names throw std::runtime_error.
+  It's compiled once in the constructor, reuse it for the same fields. Encoding with
+  a mask is thread safe.
+*/
+template <class T>
+class FieldMask:private noncopyable {
+public:
+    FieldMask(const std::string &fields) {
+        std::vector<std::string> paths;
+        std::string::size_type start = 0;
+        while (start <= fields.length()) {
+            std::string::size_type end = fields.find(',', start);
+            if (end == std::string::npos) {
+                end = fields.length();
+            }
+            std::string p = fields.substr(start, end-start);
+            std::string::size_type b = p.find_first_not_of(" \t");
+            if (b != std::string::npos) {
+                paths.push_back(p.substr(b, p.find_last_not_of(" \t")-b+1));
+            }
+            start = end+1;
+        }
+        compile(paths);
+    }
+    FieldMask(const std::vector<std::string> &paths) {
+        compile(paths);
+    }
+
+    // NULL means all members
+    const FieldMaskNode* Root() const {
+        return _nodes.empty()?NULL:&_nodes.front();
+    }
+
+private:
+    void compile(const std::vector<std::string> &paths) {
+        if (paths.empty()) {
+            return;
+        }
+        _nodes.push_back(FieldMaskNode());
+        T val;
+        compile_root(paths, val);
+    }
+    // vector<T> and list<T> at top level
+    template <class V>
+    void compile_root(const std::vector<std::string> &paths, std::vector<V> &val) {
+        (void)val;
+        V v;
+        compile_root(paths, v);
+    }
+    template <class V>
+    void compile_root(const std::vector<std::string> &paths, std::list<V> &val) {
+        (void)val;
+        V v;
+        compile_root(paths, v);
+    }
+    template <class V>
+    void compile_root(const std::vector<std::string> &paths, V &val) {
+        FieldMaskCompiler::Compile(_nodes, _nodes.front(), paths, val, "");
+    }
+
+    std::deque<FieldMaskNode> _nodes; // front is the root, deque keeps the address of nodes
+};
+
+/*
+  Proxy document passed to __x_pack_encode instead of the encoder, it skips the members
+  not selected by the mask and forwards the others to the encoder.
+*/
+template <class DOC>
+class FieldMaskEncoder:private noncopyable {
+public:
+    // encode val with mask(NULL means all)
+    template <class T>
+    static bool Encode(DOC &doc, const char *key, const T &val, const FieldMaskNode *mask, const Extend *ext) {
+        if (NULL == mask) {
+            return doc.encode(key, val, ext);
+        }
+        FieldMaskEncoder m(doc, mask);
+        return m.masked(key, val, ext, 0);
+    }
+
+    inline const char *Type() const {
+        return _doc.Type();
+    }
+
+    template <class T>
+    bool encode(const char *key, const T &val, const Extend *ext) {
+        if (NULL == key) { // inherit
+            return masked(key, val, ext, 0);
+        }
+        const FieldMaskNode *child = NULL;
+        if (!_node->Select(_index++, key, child)) {
+            return false;
+        }
+        if (_cells) { // a row of F(COL), empty members are written too so the cells match the columns
+            Extend cell(ext);
+            cell.flag &= ~X_PACK_FLAG_OE;
+            cell.key = NULL;
+            if (!Encode(_doc, NULL, val, child, &cell)) {
+                _doc.writeNull(NULL, &cell);
+            }
+            return true;
+        }
+        return Encode(_doc, key, val, child, ext);
+    }
+
+private:
+    FieldMaskEncoder(DOC &doc, const FieldMaskNode *node, bool cells=false):_doc(doc), _node(node), _index(0), _cells(cells) {}
+
+    template <class T>
+    XPACK_IS_XPACK(T) masked(const char *key, const T &val, const Extend *ext, int) {
+        return object(key, val, ext);
+    }
+    template <class T>
+    XPACK_IS_XOUT(T) masked(const char *key, const T &val, const Extend *ext, int) {
+        return object(key, val, ext);
+    }
+    template <class T>
+    bool masked(const char *key, const std::vector<T> &val, const Extend *ext, int) {
+        if (numeric<T>::value && Extend::Blob(ext)) {
+            return _doc.encode(key, val, ext);
+        } else if (Extend::Columns(ext)) {
+            return columns(key, val, ext, 0);
+        }
+        return list(key, val, ext);
+    }
+    template <class T>
+    bool masked(const char *key, const std::list<T> &val, const Extend *ext, int) {
+        return list(key, val, ext);
+    }
+    template <class T>
+    bool masked(const char *key, const std::set<T> &val, const Extend *ext, int) {
+        return list(key, val, ext);
+    }
+    template <class T>
+    bool masked(const char *key, const std::map<std::string, T> &val, const Extend *ext, int) {
+        return map(key, val, ext);
+    }
+    #ifdef X_PACK_SUPPORT_CXX0X
+    template <class T>
+    bool masked(const char *key, const std::unordered_map<std::string, T> &val, const Extend *ext, int) {
+        return map(key, val, ext);
+    }
+    template <class T>
+    bool masked(const char *key, const std::shared_ptr<T> &val, const Extend *ext, int) {
+        if (val.get() == NULL) {
+            return _doc.writeNull(key, ext);
+        }
+        return masked(key, *val, ext, 0);
+    }
+    #endif
+    // not a struct, the mask is ignored
+    template <class T>
+    bool masked(const char *key, const T &val, const Extend *ext, long) {
+        return _doc.encode(key, val, ext);
+    }
+
+    template <class T>
+    bool object(const char *key, const T &val, const Extend *ext) {
+        if (0 != (X_PACK_CTRL_FLAG_INHERIT&Extend::CtrlFlag(ext))) { // members of parent are in the same level
+            return fields(val, ext, 0);
+        }
+        _doc.ObjectBegin(key, ext);
+        FieldMaskEncoder m(_doc, _node);
+        m.fields(val, ext, 0);
+        _doc.ObjectEnd(key, ext);
+        return true;
+    }
+    template <class T>
+    XPACK_IS_XPACK(T) fields(const T &val, const Extend *ext, int) {
+        val.__x_pack_encode(*this, val, ext);
+        return true;
+    }
+    template <class T>
+    XPACK_IS_XOUT(T) fields(const T &val, const Extend *ext, int) {
+        __x_pack_encode_out(*this, val, ext);
+        return true;
+    }
+
+    // F(COL), the columns are the selected members
+    template <class T>
+    XPACK_IS_XPACK(T) columns(const char *key, const std::vector<T> &val, const Extend *ext, int) {
+        return rows(key, val, ext);
+    }
+    template <class T>
+    XPACK_IS_XOUT(T) columns(const char *key, const std::vector<T> &val, const Extend *ext, int) {
+        return rows(key, val, ext);
+    }
+    template <class T>
+    bool columns(const char *key, const std::vector<T> &val, const Extend *ext, long) { // not a struct
+        return list(key, val, ext);
+    }
+    template <class T>
+    bool rows(const char *key, const std::vector<T> &val, const Extend *ext) {
+        if (val.empty()) {
+            if (Extend::OmitEmpty(ext)) {
+                return false;
+            } else if (Extend::EmptyNull(ext)) {
+                return _doc.writeNull(key, ext);
+            }
+        }
+        Extend line(X_PACK_FLAG_SL, NULL); // one row per line in pretty mode
+
+        _doc.ObjectBegin(key, ext);
+        _doc.ArrayBegin("cols", &line);
+        for (size_t i=0; i<_node->Size(); ++i) {
+            const char *col = _node->Key(i);
+            if (NULL != col) {
+                _doc.encode(NULL, col, strlen(col), NULL);
+            }
+        }
+        _doc.ArrayEnd("cols", &line);
+        _doc.ArrayBegin("rows", NULL);
+        for (size_t i=0; i<val.size(); ++i) {
+            _doc.ArrayBegin(NULL, &line);
+            FieldMaskEncoder row(_doc, _node, true);
+            row.fields(val[i], NULL, 0);
+            _doc.ArrayEnd(NULL, &line);
+        }
+        _doc.ArrayEnd("rows", NULL);
+        _doc.ObjectEnd(key, ext);
+        return true;
+    }
+
+    template <class LIST>
+    bool list(const char *key, const LIST &val, const Extend *ext) {
+        if (val.empty()) { // empty flags are handled by encoder
+            return _doc.encode(key, val, ext);
+        }
+        _doc.ArrayBegin(key, ext);
+        size_t i = 0;
+        for (typename LIST::const_iterator it=val.begin(); it!=val.end(); ++it, ++i) {
+            masked(_doc.IndexKey(i), *it, NULL, 0);
+        }
+        _doc.ArrayEnd(key, ext);
+        return true;
+    }
+    template <class MAP>
+    bool map(const char *key, const MAP &val, const Extend *ext) {
+        if (val.empty()) {
+            return _doc.encode(key, val, ext);
+        }
+        _doc.ObjectBegin(key, ext);
+        for (typename MAP::const_iterator it=val.begin(); it!=val.end(); ++it) {
+            masked(it->first.c_str(), it->second, NULL, 0);
+        }
+        _doc.ObjectEnd(key, ext);
+        return true;
+    }
+
+    DOC &_doc;
+    const FieldMaskNode *_node;
+    size_t _index;
+    bool _cells;
+};
+
+}
+
+#endif
@@ -0,0 +1,108 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_FTOA_H
+#define __X_PACK_FTOA_H
+
+#include <cstring>
+#include <stdint.h>
+
+#include "rapidjson_custom.h"
+#include "xrapidjson/internal/dtoa.h"
+#include "xrapidjson/internal/strtod.h"
+
+namespace xpack {
+
+// Grisu2 on the float boundaries: the shortest digits of a positive finite value, value is buffer[0, length)*10^K
+inline void ftoa_digits(float value, char *buffer, int *length, int *K) {
+    using namespace rapidjson::internal;
+
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int biased_e = (int)((bits>>23)&0xff);
+    uint64_t f = bits&0x7fffff;
+    int e;
+    if (biased_e != 0) {
+        f += 0x800000;
+        e = biased_e-150;
+    } else { // subnormal
+        e = -149;
+    }
+
+    // boundaries are the middle points to the neighbors, the lower gap is half at the power of 2
+    DiyFp pl = DiyFp((f<<1)+1, e-1).Normalize();
+    DiyFp mi = (f==0x800000 && biased_e>1)?DiyFp((f<<2)-1, e-2):DiyFp((f<<1)-1, e-1);
+    mi.f <<= mi.e-pl.e;
+    mi.e = pl.e;
+
+    const DiyFp c_mk = GetCachedPower(pl.e, K);
+    const DiyFp W = DiyFp(f, e).Normalize()*c_mk;
+    DiyFp Wp = pl*c_mk;
+    DiyFp Wm = mi*c_mk;
+    Wm.f++;
+    Wp.f--;
+    DigitGen(W, Wp, Wp.f-Wm.f, buffer, length, K);
+}
+
+/*
+  Shortest decimal that reads back as the same float. rapidjson dtoa works on the double
+  boundaries, so 0.1f is written as 0.10000000149011612, here Grisu2 runs on the float
+  boundaries instead and the digits are formatted the same way as dtoa: 0.1f -> 0.1,
+  1.0f -> 1.0, 1e30f -> 1e30. value must be finite, buffer needs 32 bytes.
+*/
+inline char* ftoa(float value, char *buffer, int maxDecimalPlaces = 324) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if (bits & 0x80000000u) { // -0.0 too
+        *buffer++ = '-';
+        value = -value;
+    }
+    if (value == 0) {
+        buffer[0] = '0';
+        buffer[1] = '.';
+        buffer[2] = '0';
+        return &buffer[3];
+    }
+    int K;
+    int length;
+    ftoa_digits(value, buffer, &length, &K);
+    return rapidjson::internal::Prettify(buffer, length, K, maxDecimalPlaces);
+}
+
+/*
+  The double nearest to the shortest decimal of value, dtoa writes it with the same digits as ftoa(0.1f -> 0.1).
+  For rapidjson::Value, which keeps every number as double. value must be finite.
+*/
+inline double ftod(float value) {
+    if (value == 0) {
+        return value;
+    } else if (value < 0) {
+        return -ftod(-value);
+    }
+    char buffer[32];
+    int K;
+    int length;
+    ftoa_digits(value, buffer, &length, &K);
+    double d = 0; // at most 9 digits, exact
+    for (int i=0; i<length; ++i) {
+        d = d*10+(buffer[i]-'0');
+    }
+    return rapidjson::internal::StrtodFullPrecision(d, K, buffer, (size_t)length, (size_t)length, K);
+}
+
+}
+
+#endif
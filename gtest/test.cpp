@@ -15,6 +15,7 @@
 */
 
 #include <iostream>
+#include <sstream>
 
 #ifdef XGTEST
 #include<gtest/gtest.h>
@@ -24,7 +25,12 @@
 
 #include "xpack/json.h"
 #include "xpack/xml.h"
+#include "xpack/msgpack.h"
 #include "string.h"
+#ifdef X_PACK_SUPPORT_CXX0X
+#include <thread>
+#include "xpack/istr.h"
+#endif
 
 using namespace std;
 
@@ -812,6 +818,1492 @@ TEST(jsondata, memory) {
     EXPECT_EQ(s[1].GetInt64(), 1);    
 }
 
+// ++++++++++++++++++ utf8 +++++++++++++++++++++++
+TEST(utf8, validate) {
+    EXPECT_TRUE(xpack::Utf8::Valid(string("hello \xe4\xbd\xa0\xe5\xa5\xbd \xf0\x9f\x98\x80")));
+    EXPECT_FALSE(xpack::Utf8::Valid(string("\xc0\xaf")));         // overlong
+    EXPECT_FALSE(xpack::Utf8::Valid(string("\xed\xa0\x80")));     // surrogate
+    EXPECT_FALSE(xpack::Utf8::Valid(string("\xf4\x90\x80\x80"))); // > U+10FFFF
+    EXPECT_FALSE(xpack::Utf8::Valid(string("ab\xe4\xbd")));       // truncated
+
+    string longstr(100, 'a');
+    longstr[70] = '\xff';
+    size_t offset = 0;
+    EXPECT_FALSE(xpack::Utf8::Valid(longstr, &offset));
+    EXPECT_EQ(offset, 70U);
+
+    Base b;
+    string bad = "{\"a\":1,\"b\":\"\xff\xfe\"}";
+    bool except = false;
+    try {
+        xpack::json::decode(bad, b, X_PACK_DOC_FLAG_UTF8);
+    } catch(...) {
+        except = true;
+    }
+    EXPECT_TRUE(except);
+    xpack::json::decode(bad, b); // no flag, no check
+
+    except = false;
+    try {
+        xpack::xml::decode("<root><b>\xff</b></root>", b, X_PACK_DOC_FLAG_UTF8);
+    } catch(...) {
+        except = true;
+    }
+    EXPECT_TRUE(except);
+
+    b.b = "\xe4\xbd\xa0";
+    EXPECT_EQ(xpack::json::encode(b, 0, -1, ' ', X_PACK_DOC_FLAG_UTF8), "{\"a\":1,\"b\":\"\xe4\xbd\xa0\"}");
+    b.b = "\xe4\xbd";
+    except = false;
+    try {
+        xpack::json::encode(b, 0, -1, ' ', X_PACK_DOC_FLAG_UTF8);
+    } catch(...) {
+        except = true;
+    }
+    EXPECT_TRUE(except);
+}
+
+// ++++++++++++++++++ json document +++++++++++++++++++++++
+TEST(jsondocument, concurrent) {
+    string s = "{\"base\":{\"a\":1,\"b\":\"one\"}, \"list\":[{\"a\":2,\"b\":\"two\"},{\"a\":3,\"b\":\"three\"}], \"ints\":[4,5,6]}";
+    const xpack::JsonDocument doc(s);
+
+    EXPECT_TRUE(doc["base"]);
+    EXPECT_FALSE(doc["none"]);
+    EXPECT_FALSE(doc["ints"][(size_t)3]);
+    EXPECT_EQ(doc["list"].Size(), 2U);
+
+#ifdef X_PACK_SUPPORT_CXX0X
+    const int N = 8;
+    vector<Base> bases(N);
+    vector<vector<int> > ints(N);
+    vector<thread> ths;
+    for (int i=0; i<N; ++i) {
+        ths.push_back(thread([&doc, &bases, &ints, i]() {
+            for (int j=0; j<200; ++j) {
+                if (i%2 == 0) {
+                    doc["list"][(size_t)1].decode(bases[i]);
+                } else {
+                    doc["base"].decode(bases[i]);
+                }
+                ints[i].clear();
+                doc["ints"].decode(ints[i]);
+            }
+        }));
+    }
+    for (size_t i=0; i<ths.size(); ++i) {
+        ths[i].join();
+    }
+    for (int i=0; i<N; ++i) {
+        if (i%2 == 0) {
+            EXPECT_EQ(bases[i].a, 3);
+            EXPECT_EQ(bases[i].b, "three");
+        } else {
+            EXPECT_EQ(bases[i].a, 1);
+            EXPECT_EQ(bases[i].b, "one");
+        }
+        EXPECT_EQ(ints[i].size(), 3U);
+    }
+#else
+    Base b;
+    doc["base"].decode(b);
+    EXPECT_EQ(b.b, "one");
+#endif
+
+    bool except = false;
+    try {
+        xpack::JsonDocument bad("{\"a\":");
+    } catch(...) {
+        except = true;
+    }
+    EXPECT_TRUE(except);
+}
+
+// ++++++++++++++++++ stop when done +++++++++++++++++++++++
+struct StopHeader {
+    string route;
+    int seq;
+    XPACK(A(route, "json:r"), O(seq));
+};
+struct StopChild:public StopHeader {
+    string ver;
+    XPACK(I(StopHeader), O(ver));
+};
+static bool stopAtA(const char *key) {
+    return 0 == strcmp(key, "a");
+}
+TEST(stop, whendone) {
+    // the body after the header is broken, so it only works if the parse stops early
+    string s = "{\"seq\":1, \"ver\":\"v2\", \"r\":\"user\", \"body\":[1,2,";
+
+    StopHeader h;
+    xpack::json::decode(s, h, X_PACK_DOC_FLAG_STOP);
+    EXPECT_EQ(h.route, "user");
+    EXPECT_EQ(h.seq, 1);
+
+    StopChild c;
+    xpack::json::decode(s, c, X_PACK_DOC_FLAG_STOP);
+    EXPECT_EQ(c.route, "user");
+    EXPECT_EQ(c.ver, "v2");
+
+    bool except = false;
+    try {
+        StopHeader h1;
+        xpack::json::decode(s, h1);
+    } catch(...) {
+        except = true;
+    }
+    EXPECT_TRUE(except);
+
+    // only the parsed bytes are validated
+    StopHeader h2;
+    xpack::json::decode(s+"\"\xff\"]}", h2, X_PACK_DOC_FLAG_STOP|X_PACK_DOC_FLAG_UTF8);
+    EXPECT_EQ(h2.route, "user");
+    except = false;
+    try {
+        StopHeader h3;
+        xpack::json::decode("{\"seq\":1, \"x\":\"\xff\", \"ver\":\"v2\", \"r\":\"user\"}", h3, X_PACK_DOC_FLAG_STOP|X_PACK_DOC_FLAG_UTF8);
+    } catch(...) {
+        except = true;
+    }
+    EXPECT_TRUE(except);
+
+    Base b;
+    xpack::json::decode_until("{\"b\":\"x\", \"a\":2, \"bad\"", b, stopAtA);
+    EXPECT_EQ(b.a, 2);
+    EXPECT_EQ(b.b, "x");
+
+    vector<string> keys;
+    xpack::Members::Names<StopChild>("json", keys);
+    EXPECT_EQ(keys.size(), 3U);
+    EXPECT_EQ(keys[0], "r");
+    keys.clear();
+    xpack::Members::Names<StopChild>("xml", keys);
+    EXPECT_EQ(keys[0], "route");
+}
+
+// ++++++++++++++++++ decode cache +++++++++++++++++++++++
+#ifdef X_PACK_SUPPORT_CXX0X
+struct CachedConfig {
+    string name;
+    vector<int> flags;
+    XPACK(O(name, flags));
+};
+TEST(decodecache, base) {
+    xpack::DecodeCache<CachedConfig, xpack::json>::Instance().Clear();
+    string s1 = "{\"name\":\"one\", \"flags\":[1,2,3]}";
+    string s2 = "{\"name\":\"two\", \"flags\":[4]}";
+
+    shared_ptr<const CachedConfig> c1 = xpack::json::decode_cached<CachedConfig>(s1);
+    shared_ptr<const CachedConfig> c2 = xpack::json::decode_cached<CachedConfig>(s2);
+    EXPECT_EQ(c1->name, "one");
+    EXPECT_EQ(c1->flags.size(), 3U);
+    EXPECT_EQ(c2->name, "two");
+    EXPECT_TRUE(c1 == xpack::json::decode_cached<CachedConfig>(string(s1)));
+    EXPECT_TRUE(c1 != c2);
+
+    // evict
+    xpack::DecodeCache<CachedConfig, xpack::json>::Instance().SetCapacity(1);
+    for (int i=0; i<64; ++i) {
+        xpack::json::decode_cached<CachedConfig>("{\"name\":\"n"+to_string(i)+"\"}");
+    }
+    shared_ptr<const CachedConfig> c3 = xpack::json::decode_cached<CachedConfig>(s1);
+    EXPECT_EQ(c3->name, "one");
+    EXPECT_TRUE(c1 != c3);
+
+    // concurrent
+    vector<thread> ths;
+    vector<shared_ptr<const CachedConfig> > res(8);
+    for (size_t i=0; i<res.size(); ++i) {
+        ths.push_back(thread([&res, &s2, i]() {
+            for (int j=0; j<100; ++j) {
+                res[i] = xpack::json::decode_cached<CachedConfig>(s2);
+            }
+        }));
+    }
+    for (size_t i=0; i<ths.size(); ++i) {
+        ths[i].join();
+    }
+    for (size_t i=0; i<res.size(); ++i) {
+        EXPECT_EQ(res[i]->name, "two");
+    }
+    xpack::DecodeCache<CachedConfig, xpack::json>::Instance().SetCapacity(128);
+
+    EXPECT_EQ(xpack::Util::hash("hello", 5), xpack::Util::hash(string("hello").data(), 5));
+    EXPECT_TRUE(xpack::Util::hash("hello", 5) != xpack::Util::hash("hellp", 5));
+}
+#endif
+
+// ++++++++++++++++++ intern string +++++++++++++++++++++++
+#ifdef X_PACK_SUPPORT_CXX0X
+struct InternRow {
+    int id;
+    xpack::IStr country;
+    vector<xpack::IStr> tags;
+    XPACK(O(id, country, tags));
+};
+TEST(istr, base) {
+    vector<InternRow> rows;
+    xpack::json::decode("[{\"id\":1,\"country\":\"CN\",\"tags\":[\"a\",\"b\"]},{\"id\":2,\"country\":\"CN\",\"tags\":[\"b\"]},{\"id\":3}]", rows);
+    EXPECT_EQ(rows.size(), 3U);
+    EXPECT_EQ(rows[0].country.str(), "CN");
+    EXPECT_TRUE(rows[0].country == rows[1].country);
+    EXPECT_TRUE(&rows[0].country.str() == &rows[1].country.str());
+    EXPECT_TRUE(&rows[0].tags[1].str() == &rows[1].tags[0].str());
+    EXPECT_TRUE(rows[2].country.empty());
+    EXPECT_TRUE(rows[0].country == xpack::IStr("CN"));
+
+    string s = xpack::json::encode(rows[0]);
+    EXPECT_EQ(s, "{\"id\":1,\"country\":\"CN\",\"tags\":[\"a\",\"b\"]}");
+
+    InternRow x;
+    xpack::xml::decode(xpack::xml::encode(rows[1], "root"), x);
+    EXPECT_TRUE(x.country == rows[0].country);
+}
+#endif
+
+struct CountSink:public xpack::Sink {
+    size_t blocks;
+    size_t max_block;
+    string data;
+    CountSink():blocks(0), max_block(0) {}
+    void Write(const char *d, size_t len) {
+        ++blocks;
+        if (len > max_block) {
+            max_block = len;
+        }
+        data.append(d, len);
+    }
+};
+TEST(sink, block) {
+    vector<Base> vb;
+    for (int i=0; i<2000; ++i) {
+        vb.push_back(Base(i, "hello world"));
+    }
+
+    CountSink cs;
+    xpack::json::encode(vb, cs);
+    EXPECT_EQ(cs.data, xpack::json::encode(vb));
+    EXPECT_TRUE(cs.blocks > 1);
+    EXPECT_TRUE(cs.max_block <= 4096);
+
+    // a long string doesn't grow the staging buffer
+    Base big(1, string(1<<20, 'x')+"\"\n");
+    CountSink bs;
+    xpack::json::encode(big, bs);
+    EXPECT_EQ(bs.data, xpack::json::encode(big));
+    EXPECT_TRUE(bs.max_block <= 4096);
+
+    string s("x");
+    xpack::json::encode(vb[1], s);
+    EXPECT_EQ(s, "x{\"a\":1,\"b\":\"hello world\"}");
+
+    vector<char> v;
+    xpack::json::encode(vb[1], v);
+    EXPECT_EQ(string(v.begin(), v.end()), "{\"a\":1,\"b\":\"hello world\"}");
+
+    stringstream ss;
+    xpack::json::encode(vb[1], ss);
+    EXPECT_EQ(ss.str(), "{\"a\":1,\"b\":\"hello world\"}");
+
+    CountSink xs;
+    xpack::xml::encode(vb, "root", xs);
+    EXPECT_EQ(xs.data, xpack::xml::encode(vb, "root"));
+    EXPECT_TRUE(xs.blocks > 1);
+}
+
+struct DynKeys {
+    int n;
+};
+namespace xpack {
+template<>
+struct is_xpack_xtype<DynKeys> {static bool const value = true;};
+template <class OBJ>
+bool xpack_xtype_decode(OBJ &obj, const char*key, DynKeys &val, const Extend *ext) {
+    return obj.decode(key, val.n, ext);
+}
+template <class OBJ>
+bool xpack_xtype_encode(OBJ &obj, const char*key, const DynKeys &val, const Extend *ext) {
+    obj.ObjectBegin(key, ext);
+    char buf[16]; // same address, different key
+    for (int i=0; i<val.n; ++i) {
+        buf[0] = 'k';
+        buf[1] = 'a'+i;
+        buf[2] = (i%2==0)?'\0':'x';
+        buf[3] = '\0';
+        obj.encode(buf, i, ext);
+    }
+    obj.ObjectEnd(key, ext);
+    return true;
+}
+}
+
+struct RawKeys {
+    int a;
+    int b;
+    map<string, int> m;
+    DynKeys d;
+    XPACK(O(a), A(b, "json:b\"q"), O(m, d));
+};
+TEST(rawkey, escape) {
+    vector<RawKeys> v(2);
+    v[0].a = 1;
+    v[0].b = 2;
+    v[0].m["x\ty"] = 3;
+    v[0].d.n = 2;
+    v[1] = v[0];
+    string s = xpack::json::encode(v);
+    EXPECT_EQ(s, "[{\"a\":1,\"b\\\"q\":2,\"m\":{\"x\\ty\":3},\"d\":{\"ka\":0,\"kbx\":1}},{\"a\":1,\"b\\\"q\":2,\"m\":{\"x\\ty\":3},\"d\":{\"ka\":0,\"kbx\":1}}]");
+
+    v[0].d.n = 0;
+    s = xpack::json::encode(v[0], 0, 1, ' ');
+    EXPECT_EQ(s, "{\n \"a\": 1,\n \"b\\\"q\": 2,\n \"m\": {\n  \"x\\ty\": 3\n },\n \"d\": {}\n}");
+}
+
+// user writer policy
+class TwoDecimalWriter:public xpack::JsonCompactWriter {
+public:
+    TwoDecimalWriter(xpack::JsonBuffer &os, int indentCount, char indentChar):xpack::JsonCompactWriter(os, indentCount, indentChar) {
+        SetMaxDecimalPlaces(2);
+    }
+};
+TEST(writer, policy) {
+    Base b(1, "x");
+    xpack::JsonEncoder any(2);
+    any.encode(NULL, b, NULL);
+    EXPECT_EQ(any.String(), xpack::json::encode(b, 0, 2, ' '));
+
+    xpack::JsonPrettyEncoder pretty(2);
+    pretty.encode(NULL, b, NULL);
+    EXPECT_EQ(pretty.String(), any.String());
+
+    vector<double> vd;
+    vd.push_back(1.23456);
+    EXPECT_EQ(xpack::json::encode_writer<TwoDecimalWriter>(vd), "[1.23]");
+}
+
+struct HintOnly {
+    string s;
+    XPACK(O(s));
+};
+TEST(sizehint, base) {
+    HintOnly h;
+    h.s = string(1000, 'a');
+    EXPECT_EQ((xpack::SizeHint<HintOnly, xpack::JsonCompactEncoder>::Get()), 0U);
+    string s = xpack::json::encode(h);
+    EXPECT_EQ(s.length(), 1008U);
+    EXPECT_TRUE((xpack::SizeHint<HintOnly, xpack::JsonCompactEncoder>::Get()) >= 1008U);
+    EXPECT_EQ((xpack::SizeHint<HintOnly, xpack::JsonPrettyEncoder>::Get()), 0U); // counted apart
+
+    h.s = "a";
+    EXPECT_EQ(xpack::json::encode(h), "{\"s\":\"a\"}");
+    EXPECT_EQ(xpack::json::encode_hint(h, 4), "{\"s\":\"a\"}");
+    EXPECT_EQ(xpack::json::encode_hint(h, 4096, 0, 0, ' '), "{\n\"s\": \"a\"\n}");
+    EXPECT_TRUE((xpack::SizeHint<HintOnly, xpack::JsonCompactEncoder>::Get()) < 1008U);
+    EXPECT_TRUE((xpack::SizeHint<HintOnly, xpack::JsonPrettyEncoder>::Get()) < 32U);
+
+    // decay toward the recent sizes
+    for (int i=0; i<32; ++i) {
+        xpack::json::encode(h);
+    }
+    EXPECT_TRUE((xpack::SizeHint<HintOnly, xpack::JsonCompactEncoder>::Get()) < 16U);
+
+    // capped
+    h.s = string(XPACK_SIZE_HINT_MAX*2, 'a');
+    xpack::json::encode(h);
+    EXPECT_TRUE((xpack::SizeHint<HintOnly, xpack::JsonCompactEncoder>::Get()) <= (size_t)XPACK_SIZE_HINT_MAX);
+}
+
+#ifdef X_PACK_SUPPORT_CXX0X
+TEST(parallel, encode) {
+    vector<Base> vb;
+    for (int i=0; i<3000; ++i) {
+        vb.push_back(Base(i, "p"));
+    }
+    EXPECT_EQ(xpack::json::encode_parallel(vb, 4), xpack::json::encode(vb));
+    EXPECT_EQ(xpack::json::encode_parallel(vb, 3, 0, 2, ' '), xpack::json::encode(vb, 0, 2, ' '));
+    EXPECT_EQ(xpack::json::encode_parallel(vb, 5, 0, 0, ' '), xpack::json::encode(vb, 0, 0, ' '));
+
+    // many threads, the ranges are balanced and none is empty
+    vector<int> vi(102401, 7);
+    EXPECT_EQ(xpack::json::encode_parallel(vi, 400), xpack::json::encode(vi));
+    EXPECT_EQ(xpack::json::encode_parallel(vi, 399, 0, 2, ' '), xpack::json::encode(vi, 0, 2, ' '));
+
+    vb.resize(10); // too small to split
+    EXPECT_EQ(xpack::json::encode_parallel(vb), xpack::json::encode(vb));
+    vb.clear();
+    EXPECT_EQ(xpack::json::encode_parallel(vb), xpack::json::encode(vb));
+}
+#endif
+
+struct StreamXml {
+    FlagATTR attr;
+    FlagVectorLabel vl;
+    vector<vector<int> > vv;
+    vector<Base> empty;
+    map<string, Base> m;
+    XPACK(O(attr, vl, vv, empty, m));
+};
+struct StreamAttrLast {
+    vector<Base> a;
+    int b;
+    XPACK(O(a), X(F(ATTR), b));
+};
+TEST(stream, xml) {
+    StreamXml x;
+    x.attr.a = 1;
+    x.attr.b = "h<";
+    x.vl.a.push_back(1);
+    x.vl.b.push_back(2);
+    x.vl.b.push_back(3);
+    x.vl.c.push_back(4);
+    x.vv.resize(2);
+    x.vv[1].push_back(5);
+    x.m["k"] = Base(6, "");
+
+    for (int indent=-1; indent<3; ++indent) {
+        string s;
+        xpack::StringSink ss(s);
+        xpack::xml::encode_stream(x, "root", ss, 0, indent, ' ');
+        EXPECT_EQ(s, xpack::xml::encode(x, "root", 0, indent, ' '));
+    }
+
+    vector<Base> vb(5000, Base(1, "stream"));
+    CountSink cs;
+    xpack::xml::encode_stream(vb, "root", cs);
+    EXPECT_EQ(cs.data, xpack::xml::encode(vb, "root"));
+    EXPECT_TRUE(cs.blocks > 1);
+
+    StreamAttrLast al; // attribute after big child elements
+    al.a.resize(10);
+    al.b = 2;
+    string as;
+    xpack::StringSink ass(as);
+    xpack::xml::encode_stream(al, "root", ass);
+    EXPECT_EQ(as, xpack::xml::encode(al, "root"));
+
+    al.a = vb;
+    bool except = false;
+    try {
+        string s;
+        xpack::StringSink ss(s);
+        xpack::xml::encode_stream(al, "root", ss);
+    } catch(...) {
+        except = true;
+    }
+    EXPECT_TRUE(except);
+}
+TEST(stream, file) {
+    vector<Base> vb(100, Base(1, "file"));
+    xpack::json::encode_file(vb, "./stream_test.json");
+    vector<Base> jb;
+    xpack::json::decode_file("./stream_test.json", jb);
+    EXPECT_EQ(jb.size(), 100U);
+    EXPECT_EQ(jb[99].b, "file");
+
+    xpack::xml::encode_file(vb, "root", "./stream_test.xml");
+    vector<Base> xb;
+    xpack::xml::decode_file("./stream_test.xml", xb);
+    EXPECT_EQ(xb.size(), 100U);
+    remove("./stream_test.json");
+    remove("./stream_test.xml");
+}
+
+struct IovTemp {
+    string s;
+};
+namespace xpack {
+template<>
+struct is_xpack_xtype<IovTemp> {static bool const value = true;};
+template <class OBJ>
+bool xpack_xtype_decode(OBJ &obj, const char*key, IovTemp &val, const Extend *ext) {
+    return obj.decode(key, val.s, ext);
+}
+template <class OBJ>
+bool xpack_xtype_encode(OBJ &obj, const char*key, const IovTemp &val, const Extend *ext) {
+    return obj.encode(key, val.s+"!", ext); // temporary string
+}
+}
+struct IovMsg {
+    int id;
+    string big;
+    string esc;
+    IovTemp tmp;
+    vector<string> vs;
+    XPACK(O(id), X(F(REF), big, esc, tmp, vs));
+};
+TEST(iov, encode) {
+    IovMsg m;
+    m.id = 1;
+    m.big = string(2000, 'b');
+    m.esc = string(2000, '"');
+    m.tmp.s = string(2000, 't');
+    m.vs.push_back(string(3000, 'v'));
+    m.vs.push_back("small");
+
+    xpack::JsonIov iov;
+    xpack::json::encode_iov(m, iov);
+    EXPECT_EQ(iov.String(), xpack::json::encode(m));
+    EXPECT_EQ(iov.Size(), xpack::json::encode(m).length());
+    bool bigRef = false;
+    bool vsRef = false;
+    for (size_t i=0; i<iov.Count(); ++i) {
+        const char *p = (const char*)iov.Data()[i].iov_base;
+        EXPECT_TRUE(p != m.esc.data());
+        EXPECT_TRUE(*p != 't' || iov.Data()[i].iov_len < 2000);
+        bigRef = bigRef || p == m.big.data();
+        vsRef = vsRef || p == m.vs[0].data();
+    }
+    EXPECT_TRUE(bigRef);
+    EXPECT_FALSE(vsRef); // only the member itself
+
+    xpack::json::encode_iov(m, iov, 100, 0, 2, ' ');
+    EXPECT_EQ(iov.String(), xpack::json::encode(m, 0, 2, ' '));
+}
+
+struct PatchPos {
+    int x;
+    int y;
+    XPACK(O(x, y));
+};
+struct PatchState {
+    int id;
+    string name;
+    PatchPos pos;
+    map<string, int> score;
+    vector<int> tags;
+    XPACK(O(id, name, pos, score, tags));
+};
+TEST(patch, diff) {
+    PatchState a;
+    a.id = 1;
+    a.name = "a";
+    a.pos.x = 1;
+    a.pos.y = 2;
+    a.score["k1"] = 1;
+    a.score["k2"] = 2;
+    a.tags.push_back(1);
+
+    PatchState b = a;
+    EXPECT_EQ(xpack::json::encode_diff(a, b), "{}");
+
+    b.pos.y = 3;
+    b.score.erase("k1");
+    b.score["k3"] = 3;
+    b.tags.push_back(2);
+    EXPECT_EQ(xpack::json::encode_diff(a, b), "{\"pos\":{\"y\":3},\"score\":{\"k3\":3,\"k1\":null},\"tags\":[1,2]}");
+
+    PatchState c = a;
+    xpack::json::decode_patch(xpack::json::encode_diff(a, b), c);
+    EXPECT_EQ(xpack::json::encode(c), xpack::json::encode(b));
+    EXPECT_EQ(c.score.count("k1"), 0U);
+
+    xpack::json::decode_patch("{\"name\":null,\"id\":5}", c);
+    EXPECT_EQ(c.name, "");
+    EXPECT_EQ(c.id, 5);
+    bool except = false;
+    try {
+        xpack::json::decode_patch("{", c);
+    } catch(...) {
+        except = true;
+    }
+    EXPECT_TRUE(except);
+}
+
+#ifdef X_PACK_SUPPORT_CXX0X
+struct MemoCard {
+    int id;
+    string name;
+    XPACK(O(id, name));
+};
+struct MemoResp {
+    vector<xpack::Memo<MemoCard> > cards;
+    xpack::Memo<MemoCard> none;
+    XPACK(O(cards, none));
+};
+TEST(memo, encode) {
+    std::shared_ptr<MemoCard> c(new MemoCard);
+    c->id = 1;
+    c->name = "card";
+    MemoResp r;
+    r.cards.push_back(xpack::Memo<MemoCard>(c));
+    r.cards.push_back(xpack::Memo<MemoCard>(c));
+    string expect = "{\"cards\":[{\"id\":1,\"name\":\"card\"},{\"id\":1,\"name\":\"card\"}],\"none\":null}";
+    EXPECT_EQ(xpack::json::encode(r), expect);
+
+    c->id = 2; // changed without new version, the cached fragment is used
+    EXPECT_EQ(xpack::json::encode(r), expect);
+    EXPECT_EQ(xpack::json::encode(r, 0, 1, ' ').find("\"id\": 1"), string::npos); // pretty is not cached
+
+    xpack::EncodeCache<MemoCard, xpack::json>::Instance().Invalidate(c.get());
+    EXPECT_TRUE(xpack::json::encode(r).find("\"id\":2") != string::npos);
+
+    c->id = 3;
+    r.cards[0] = xpack::Memo<MemoCard>(c, 1);
+    r.cards[1] = xpack::Memo<MemoCard>(c, 1);
+    EXPECT_EQ(xpack::json::encode(r), "{\"cards\":[{\"id\":3,\"name\":\"card\"},{\"id\":3,\"name\":\"card\"}],\"none\":null}");
+
+    MemoResp d;
+    xpack::json::decode(expect, d);
+    EXPECT_EQ(d.cards.size(), 2U);
+    EXPECT_EQ(d.cards[1]->name, "card");
+    EXPECT_TRUE(!d.none);
+
+    xpack::EncodeCache<MemoCard, xpack::json>::Instance().SetCapacity(0);
+    EXPECT_TRUE(xpack::json::encode(r).find("\"id\":3") != string::npos);
+}
+#endif
+
+#ifdef X_PACK_SUPPORT_CXX0X
+// count heap allocations for the fixed encoding test, every form of new/delete is replaced so they match.
+// not inlined, otherwise gcc sees free() of the result of operator new(-Wmismatched-new-delete)
+#if defined(__GNUC__)
+#define X_TEST_NOINLINE __attribute__((noinline))
+#else
+#define X_TEST_NOINLINE
+#endif
+static size_t new_count = 0;
+static void* counted_new(size_t size) noexcept {
+    ++new_count;
+    return malloc(size>0?size:1);
+}
+X_TEST_NOINLINE void* operator new(size_t size) {
+    void *p = counted_new(size);
+    if (NULL == p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+X_TEST_NOINLINE void* operator new[](size_t size) {
+    return operator new(size);
+}
+X_TEST_NOINLINE void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return counted_new(size);
+}
+X_TEST_NOINLINE void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return counted_new(size);
+}
+X_TEST_NOINLINE void operator delete(void *p) noexcept {
+    free(p);
+}
+X_TEST_NOINLINE void operator delete[](void *p) noexcept {
+    free(p);
+}
+X_TEST_NOINLINE void operator delete(void *p, const std::nothrow_t&) noexcept {
+    free(p);
+}
+X_TEST_NOINLINE void operator delete[](void *p, const std::nothrow_t&) noexcept {
+    free(p);
+}
+#ifdef __cpp_sized_deallocation
+X_TEST_NOINLINE void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+X_TEST_NOINLINE void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+#endif
+#endif
+struct FixedInner {
+    double d;
+    char code[8];
+    XPACK(O(d, code));
+};
+struct FixedMsg {
+    int id;
+    string text;
+    FixedInner inner;
+    map<string, int> qty;
+    vector<string> names;
+    vector<FixedInner> cells;
+    XPACK(O(id, text, inner, qty, names), X(F(COL), cells));
+};
+#ifdef X_PACK_SUPPORT_CXX0X
+struct FixedDeep {
+    int v;
+    shared_ptr<FixedDeep> next;
+    XPACK(O(v, next));
+};
+#endif
+TEST(fixed, encode) {
+    FixedMsg m;
+    m.id = 7;
+    m.text = string(100, 'x')+"\"q\"";
+    m.inner.d = 1.5;
+    strcpy(m.inner.code, "ABC");
+    m.qty["a long key that is not in sso buffer"] = 1;
+    m.names.push_back(string(64, 'n'));
+    m.cells.push_back(m.inner);
+    m.cells.push_back(m.inner);
+
+    char buf[1024];
+    size_t len = 0;
+    #ifdef X_PACK_SUPPORT_CXX0X
+    size_t before = new_count;
+    #endif
+    bool ok = xpack::json::encode_fixed(m, buf, sizeof(buf), len);
+    #ifdef X_PACK_SUPPORT_CXX0X
+    EXPECT_EQ(new_count, before);
+    #endif
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(string(buf, len), xpack::json::encode(m));
+
+    EXPECT_TRUE(xpack::json::encode_fixed(m, buf, sizeof(buf), len, 0, 2, ' '));
+    EXPECT_EQ(string(buf, len), xpack::json::encode(m, 0, 2, ' '));
+
+    EXPECT_TRUE(!xpack::json::encode_fixed(m, buf, 50, len));
+    EXPECT_TRUE(len <= 50U);
+
+    #ifdef X_PACK_SUPPORT_CXX0X
+    // too deep is not written instead of throwing
+    FixedDeep deep;
+    FixedDeep *tail = &deep;
+    for (size_t i=0; i<100; ++i) {
+        tail->next.reset(new FixedDeep);
+        tail = tail->next.get();
+    }
+    bool thrown = false;
+    try {
+        ok = xpack::json::encode_fixed(deep, buf, sizeof(buf), len);
+    } catch (...) {
+        thrown = true;
+    }
+    EXPECT_TRUE(!thrown);
+    EXPECT_TRUE(!ok);
+    EXPECT_TRUE(!xpack::json::encode_fixed(deep, buf, sizeof(buf), len, 0, 2, ' '));
+
+    deep.next->next.reset();
+    EXPECT_TRUE(xpack::json::encode_fixed(deep, buf, sizeof(buf), len));
+    EXPECT_EQ(string(buf, len), xpack::json::encode(deep));
+    #endif
+}
+
+TEST(size, encoded) {
+    FixedMsg m;
+    m.id = -7;
+    m.text = "\\esc\"\n\x01\xe4\xbd\xa0";
+    m.inner.d = 3.14159;
+    strcpy(m.inner.code, "A&<");
+    m.qty["k"] = 100;
+    m.names.push_back("n");
+    m.names.push_back("");
+
+    EXPECT_EQ(xpack::json::encoded_size(m), xpack::json::encode(m).length());
+    EXPECT_EQ(xpack::json::encoded_size(m, 0, 2, ' '), xpack::json::encode(m, 0, 2, ' ').length());
+    EXPECT_EQ(xpack::json::encoded_size(m, X_PACK_FLAG_OE, -1, ' '), xpack::json::encode(m, X_PACK_FLAG_OE, -1, ' ').length());
+    EXPECT_EQ(xpack::xml::encoded_size(m, "root"), xpack::xml::encode(m, "root").length());
+    EXPECT_EQ(xpack::xml::encoded_size(m, "root", 0, 2, ' '), xpack::xml::encode(m, "root", 0, 2, ' ').length());
+}
+
+struct MaskItem {
+    int price;
+    string title;
+    XPACK(O(price, title));
+};
+struct MaskUser:public MaskItem {
+    int id;
+    string name;
+    vector<MaskItem> items;
+    map<string, MaskItem> best;
+    MaskItem one;
+    XPACK(I(MaskItem), O(id), A(name, "json:nick"), O(items, best, one));
+};
+TEST(mask, encode) {
+    MaskUser u;
+    u.price = 1;
+    u.title = "t";
+    u.id = 2;
+    u.name = "n";
+    u.items.resize(2);
+    u.items[0].price = 3;
+    u.items[1].price = 4;
+    u.best["b"].price = 5;
+    u.one.price = 6;
+    u.one.title = "o";
+
+    xpack::FieldMask<MaskUser> m1("id, nick,items.price,best.title,one, title");
+    EXPECT_EQ(xpack::json::encode(u, m1), "{\"title\":\"t\",\"id\":2,\"nick\":\"n\",\"items\":[{\"price\":3},{\"price\":4}],\"best\":{\"b\":{\"title\":\"\"}},\"one\":{\"price\":6,\"title\":\"o\"}}");
+
+    xpack::FieldMask<MaskUser> all("");
+    EXPECT_EQ(xpack::json::encode(u, all), xpack::json::encode(u));
+
+    vector<MaskUser> vu(2, u);
+    xpack::FieldMask<vector<MaskUser> > m2("one.title,one.price");
+    EXPECT_EQ(xpack::json::encode(vu, m2, 0, 1, ' '), "[\n {\n  \"one\": {\n   \"price\": 6,\n   \"title\": \"o\"\n  }\n },\n {\n  \"one\": {\n   \"price\": 6,\n   \"title\": \"o\"\n  }\n }\n]");
+
+    bool except = false;
+    try {
+        xpack::FieldMask<MaskUser> bad("id,none");
+    } catch(...) {
+        except = true;
+    }
+    EXPECT_TRUE(except);
+    except = false;
+    try {
+        xpack::FieldMask<MaskUser> bad("id.x");
+    } catch(...) {
+        except = true;
+    }
+    EXPECT_TRUE(except);
+}
+
+struct MaskTable {
+    vector<MaskUser> users;
+    XPACK(X(F(COL), users));
+};
+TEST(mask, columns) {
+    MaskTable t;
+    t.users.resize(2);
+    t.users[0].title = "t";
+    t.users[0].id = 2;
+    t.users[0].one.title = "o";
+    t.users[1].id = 3;
+    t.users[1].one.title = "o";
+
+    xpack::FieldMask<MaskTable> m("users.id,users.title,users.one.title");
+    EXPECT_EQ(xpack::json::encode(t, m), "{\"users\":{\"cols\":[\"title\",\"id\",\"one\"],\"rows\":[[\"t\",2,{\"title\":\"o\"}],[\"\",3,{\"title\":\"o\"}]]}}");
+
+    xpack::FieldMask<MaskTable> whole("users");
+    EXPECT_EQ(xpack::json::encode(t, whole), xpack::json::encode(t));
+}
+
+#ifdef XPACK_SUPPORT_ZLIB
+TEST(gzip, file) {
+    vector<Base> vb(20000, Base(1, "gzip"));
+    string file = "/tmp/xpack_test.json.gz";
+    xpack::json::encode_file(vb, file);
+    vector<Base> db;
+    xpack::json::decode_file(file, db, X_PACK_DOC_FLAG_UTF8);
+    EXPECT_EQ(xpack::json::encode(db), xpack::json::encode(vb));
+
+    CountSink cs;
+    xpack::json::encode_gz(vb, cs);
+    EXPECT_TRUE(cs.blocks > 0);
+    EXPECT_TRUE(cs.data.length() < xpack::json::encode(vb).length()/10);
+
+    FILE *fp = fopen(file.c_str(), "wb"); // truncated
+    fwrite(cs.data.data(), 1, cs.data.length()/2, fp);
+    fclose(fp);
+    bool except = false;
+    try {
+        xpack::json::decode_file(file, db);
+    } catch(...) {
+        except = true;
+    }
+    EXPECT_TRUE(except);
+    remove(file.c_str());
+}
+#endif
+
+struct BlobMsg {
+    vector<unsigned char> img;
+    vector<float> w;
+    vector<string> s; // not numbers, F(B64) is ignored
+    vector<int> ids;
+    XPACK(X(F(B64), img, w, s), O(ids));
+};
+TEST(blob, base64) {
+    BlobMsg m;
+    m.img.push_back(1);
+    m.img.push_back(2);
+    m.img.push_back(3);
+    m.w.push_back(1.0f);
+    m.s.push_back("a");
+    m.ids.push_back(1);
+    string s = xpack::json::encode(m);
+    EXPECT_EQ(s, "{\"img\":\"AQID\",\"w\":\"AACAPw==\",\"s\":[\"a\"],\"ids\":[1]}");
+
+    BlobMsg d;
+    xpack::json::decode(s, d);
+    EXPECT_EQ(xpack::json::encode(d), s);
+
+    for (int i=0; i<1000; ++i) {
+        m.img.push_back((unsigned char)(i*7));
+        m.w.push_back((float)i/3);
+    }
+    BlobMsg dj, dx;
+    xpack::json::decode(xpack::json::encode(m), dj);
+    EXPECT_TRUE(dj.img == m.img);
+    EXPECT_TRUE(dj.w == m.w);
+    xpack::xml::decode(xpack::xml::encode(m, "root"), dx);
+    EXPECT_TRUE(dx.img == m.img);
+    EXPECT_TRUE(dx.w == m.w);
+
+    bool except = false;
+    try {
+        xpack::json::decode("{\"w\":\"AQID\"}", d); // 3 bytes is not a float array
+    } catch(...) {
+        except = true;
+    }
+    EXPECT_TRUE(except);
+    except = false;
+    try {
+        xpack::json::decode("{\"img\":\"AQ*D\"}", d);
+    } catch(...) {
+        except = true;
+    }
+    EXPECT_TRUE(except);
+}
+
+struct ColRow:public MaskItem {
+    int id;
+    string name;
+    vector<int> tags;
+    XPACK(I(MaskItem), O(id), A(name, "json:nick"), X(F(OE), tags));
+};
+struct ColReport {
+    vector<ColRow> rows;
+    vector<int> ids; // not struct, F(COL) is ignored
+    XPACK(X(F(COL), rows, ids));
+};
+TEST(columns, json) {
+    ColReport r;
+    r.rows.resize(2);
+    r.rows[0].price = 1;
+    r.rows[0].title = "a";
+    r.rows[0].id = 10;
+    r.rows[1].price = 2;
+    r.rows[1].id = 20;
+    r.rows[1].name = "n";
+    r.rows[1].tags.push_back(3);
+    r.ids.push_back(5);
+    string s = xpack::json::encode(r);
+    EXPECT_EQ(s, "{\"rows\":{\"cols\":[\"price\",\"title\",\"id\",\"nick\",\"tags\"],\"rows\":[[1,\"a\",10,\"\",[]],[2,\"\",20,\"n\",[3]]]},\"ids\":[5]}");
+    EXPECT_EQ(xpack::json::encode(r.rows, X_PACK_FLAG_COL, 1, ' '), "{\n \"cols\": [\"price\", \"title\", \"id\", \"nick\", \"tags\"],\n \"rows\": [\n  [1, \"a\", 10, \"\", []],\n  [2, \"\", 20, \"n\", [3]]\n ]\n}");
+
+    ColReport d;
+    xpack::json::decode(s, d);
+    EXPECT_EQ(xpack::json::encode(d), s);
+    vector<ColRow> rows; // both layouts are accepted
+    xpack::json::decode(xpack::json::encode(r.rows), rows);
+    EXPECT_EQ(xpack::json::encode(rows, X_PACK_FLAG_COL, -1, ' '), xpack::json::encode(r.rows, X_PACK_FLAG_COL, -1, ' '));
+
+    // columns in any order, unknown and missing columns, short rows
+    rows.clear();
+    xpack::json::decode("{\"cols\":[\"id\",\"x\",\"price\"],\"rows\":[[1,0,2],[3],[null,0,4]]}", rows);
+    EXPECT_EQ(rows.size(), 3U);
+    EXPECT_EQ(rows[0].id, 1);
+    EXPECT_EQ(rows[0].price, 2);
+    EXPECT_EQ(rows[1].id, 3);
+    EXPECT_EQ(rows[2].price, 4);
+}
+
+struct FloatMsg {
+    float f;
+    vector<float> v;
+    XPACK(O(f, v));
+};
+TEST(float, shortest) {
+    FloatMsg m;
+    m.f = 0.1f;
+    m.v.push_back(1.0f);
+    m.v.push_back(-3.3f);
+    m.v.push_back(1e30f);
+    m.v.push_back(3.4028235e38f);
+    EXPECT_EQ(xpack::json::encode(m), "{\"f\":0.1,\"v\":[1.0,-3.3,1e30,3.4028235e38]}");
+    EXPECT_EQ(xpack::xml::encode(m, "root"), "<root><f>0.1</f><v><v>1</v><v>-3.3</v><v>1e30</v><v>3.4028235e38</v></v></root>");
+
+    // read back as the same float
+    srand(7);
+    for (int i=0; i<1000; ++i) {
+        m.v.push_back((float)rand()/(float)(rand()+1));
+    }
+    FloatMsg dj, dx;
+    xpack::json::decode(xpack::json::encode(m), dj);
+    xpack::xml::decode(xpack::xml::encode(m, "root"), dx);
+    EXPECT_TRUE(dj.v == m.v);
+    EXPECT_TRUE(dx.v == m.v);
+}
+
+struct ValueMsg:public MaskItem {
+    int id;
+    map<string, int> m;
+    xpack::JsonData extra;
+    XPACK(I(MaskItem), O(id), A(m, "json:mm"), O(extra));
+};
+TEST(value, encode) {
+    ValueMsg v;
+    v.price = 1;
+    v.title = "t";
+    v.id = 2;
+    v.m["k"] = 3;
+    xpack::json::decode("{\"a\":[1,null]}", v.extra);
+
+    xpack::rapidjson::Document doc(xpack::rapidjson::kObjectType);
+    xpack::rapidjson::Value one;
+    xpack::json::to_value(v, one, doc.GetAllocator());
+    doc.AddMember("one", one, doc.GetAllocator());
+    vector<ValueMsg> vs(2, v);
+    xpack::rapidjson::Value rows;
+    xpack::json::to_value(vs, rows, doc.GetAllocator(), X_PACK_FLAG_COL);
+    doc.AddMember("rows", rows, doc.GetAllocator());
+
+    xpack::rapidjson::StringBuffer sb;
+    xpack::rapidjson::Writer<xpack::rapidjson::StringBuffer> w(sb);
+    doc.Accept(w);
+    EXPECT_EQ(string(sb.GetString()), "{\"one\":"+xpack::json::encode(v)+",\"rows\":"+xpack::json::encode(vs, X_PACK_FLAG_COL, -1, ' ')+"}");
+
+    xpack::JsonData d = xpack::JsonData::from(v);
+    EXPECT_EQ(d["mm"]["k"].GetInt(), 3);
+    ValueMsg back;
+    d.decode(back);
+    EXPECT_EQ(xpack::json::encode(back), xpack::json::encode(v));
+}
+
+#ifdef X_PACK_SUPPORT_CXX0X
+struct RefNode {
+    int id;
+    vector<shared_ptr<RefNode> > deps;
+    XPACK(O(id, deps));
+};
+struct RefGraph {
+    vector<shared_ptr<RefNode> > nodes;
+    shared_ptr<string> a;
+    shared_ptr<string> b;
+    XPACK(O(nodes, a, b));
+};
+
+TEST(ref, shared) {
+    shared_ptr<RefNode> leaf(new RefNode);
+    leaf->id = 3;
+    shared_ptr<RefNode> mid(new RefNode);
+    mid->id = 2;
+    mid->deps.push_back(leaf);
+    mid->deps.push_back(leaf);
+    RefGraph g;
+    g.nodes.push_back(mid);
+    g.nodes.push_back(leaf);
+    g.nodes.push_back(mid);
+    g.a.reset(new string("s"));
+    g.b = g.a;
+
+    string s = xpack::json::encode(g, 0, -1, ' ', X_PACK_DOC_FLAG_REF);
+    EXPECT_EQ(s, "{\"nodes\":[{\"$id\":1,\"id\":2,\"deps\":[{\"$id\":2,\"id\":3,\"deps\":[]},{\"$ref\":2}]},{\"$ref\":2},{\"$ref\":1}],"
+                 "\"a\":{\"$id\":3,\"$value\":\"s\"},\"b\":{\"$ref\":3}}");
+
+    RefGraph d;
+    xpack::json::decode(s, d, X_PACK_DOC_FLAG_REF);
+    EXPECT_EQ(d.nodes.size(), 3U);
+    EXPECT_TRUE(d.nodes[0] == d.nodes[2]);
+    EXPECT_TRUE(d.nodes[1] == d.nodes[0]->deps[0]);
+    EXPECT_TRUE(d.nodes[1] == d.nodes[0]->deps[1]);
+    EXPECT_EQ(d.nodes[1]->id, 3);
+    EXPECT_TRUE(d.a == d.b);
+    EXPECT_EQ(*d.b, "s");
+    EXPECT_EQ(xpack::json::encode(d), xpack::json::encode(g)); // duplicated without the flag
+
+    bool thrown = false;
+    try {
+        xpack::json::decode("{\"a\":{\"$ref\":9}}", d, X_PACK_DOC_FLAG_REF);
+    } catch (const std::exception &e) {
+        thrown = true;
+    }
+    EXPECT_TRUE(thrown);
+
+    // "$id" and "$ref" are ordinary members without the flag
+    RefGraph plain;
+    xpack::json::decode("{\"nodes\":[{\"$ref\":9,\"id\":4}]}", plain);
+    EXPECT_EQ(plain.nodes.size(), 1U);
+    EXPECT_EQ(plain.nodes[0]->id, 4);
+}
+#endif
+
+TEST(value, docflag) {
+    FloatMsg m;
+    m.f = 0.1f;
+    m.v.push_back(-3.3f);
+    m.v.push_back(3.4028235e38f);
+    EXPECT_EQ(xpack::JsonData::from(m).String(), xpack::json::encode(m));
+
+    ValueMsg v;
+    v.title = "\xff";
+    v.id = 1;
+    xpack::json::decode("{}", v.extra);
+    xpack::JsonData::from(v); // not validated by default
+    bool thrown = false;
+    try {
+        xpack::JsonData::from(v, 0, X_PACK_DOC_FLAG_UTF8);
+    } catch (const std::exception &e) {
+        thrown = true;
+    }
+    EXPECT_TRUE(thrown);
+
+    #ifdef X_PACK_SUPPORT_CXX0X
+    shared_ptr<RefNode> leaf(new RefNode);
+    leaf->id = 3;
+    RefGraph g;
+    g.nodes.push_back(leaf);
+    g.nodes.push_back(leaf);
+    g.a.reset(new string("s"));
+    g.b = g.a;
+    EXPECT_EQ(xpack::JsonData::from(g, 0, X_PACK_DOC_FLAG_REF).String(), xpack::json::encode(g, 0, -1, ' ', X_PACK_DOC_FLAG_REF));
+    #endif
+}
+
+TEST(jsondata, mutation) {
+    xpack::JsonData d;
+    xpack::json::decode("{\"a\":1,\"b\":{\"c\":\"x\",\"d\":[1,2]},\"e\":true}", d);
+    EXPECT_EQ(d.String(), "{\"a\":1,\"b\":{\"c\":\"x\",\"d\":[1,2]},\"e\":true}");
+
+    xpack::JsonData b = d["b"]; // changes through b are seen by d
+    b.Set("c", string("y")).Set("n", 5);
+    b["d"].PushBack(3);
+    EXPECT_TRUE(b["d"].Erase((size_t)0));
+    EXPECT_TRUE(d.Erase("e"));
+    EXPECT_TRUE(!d.Erase("e"));
+    d["a"].Set(2.5);
+    EXPECT_EQ(d.String(), "{\"a\":2.5,\"b\":{\"c\":\"y\",\"d\":[2,3],\"n\":5}}");
+
+    xpack::JsonData p;
+    xpack::json::decode("{\"b\":{\"c\":null,\"m\":[0]}}", p);
+    d.Merge(p);
+    vector<int> v(2, 7);
+    d.Set("v", v);
+    EXPECT_EQ(d.String(), "{\"a\":2.5,\"b\":{\"d\":[2,3],\"n\":5,\"m\":[0]},\"v\":[7,7]}");
+    EXPECT_EQ(xpack::json::encode(d), d.String());
+
+    xpack::JsonData n; // builder
+    n.Set("k", d["b"]["d"]).Set("s", string("z"));
+    n["k"].PushBack(n["s"]);
+    EXPECT_EQ(n.String(), "{\"k\":[2,3,\"z\"],\"s\":\"z\"}");
+
+    bool thrown = false;
+    try {
+        n["k"].Set("x", 1);
+    } catch (const std::exception &e) {
+        thrown = true;
+    }
+    EXPECT_TRUE(thrown);
+}
+
+struct MsgItem {
+    int id;
+    string name;
+    XPACK(O(id), A(name, "msgpack:n"));
+};
+struct MsgAll {
+    bool b;
+    char c;
+    int i;
+    long long big;
+    unsigned long long u;
+    float f;
+    double d;
+    string s;
+    string empty;
+    vector<int> nums;
+    vector<double> blob;
+    vector<string> strs;
+    map<string, int> m;
+    map<int, string> im;
+    MsgItem item;
+    vector<MsgItem> items;
+    XPACK(O(b, c, i, big, u, f, d, s), X(F(OE), empty), O(nums), X(F(B64), blob), O(strs, m, im, item, items));
+};
+
+TEST(msgpack, codec) {
+    MsgItem it;
+    it.id = 1;
+    it.name = "x";
+    string small = xpack::msgpack::encode(it);
+    EXPECT_EQ(small, string("\x82\xa2id\x01\xa1n\xa1x", 9));
+
+    MsgAll a;
+    a.b = true;
+    a.c = -5;
+    a.i = -300;
+    a.big = -5000000000LL;
+    a.u = 18000000000000000000ULL;
+    a.f = 0.1f;
+    a.d = 3.25;
+    a.s = string(40, 's');
+    for (int i=0; i<20; ++i) {
+        a.nums.push_back(i*1000-7000);
+        a.blob.push_back(i/3.0);
+    }
+    a.strs.push_back("a");
+    a.strs.push_back("");
+    a.m["k"] = 70000;
+    a.im[-2] = "v";
+    a.item = it;
+    for (int i=0; i<17; ++i) {
+        a.items.push_back(it);
+        a.items.back().id = i;
+    }
+    string data = xpack::msgpack::encode(a);
+    MsgAll b;
+    xpack::msgpack::decode(data, b);
+    EXPECT_EQ(xpack::json::encode(b), xpack::json::encode(a));
+    EXPECT_TRUE(b.blob == a.blob);
+    EXPECT_EQ(b.f, a.f);
+    EXPECT_TRUE(data.length() < xpack::json::encode(a).length());
+
+    MsgItem miss;
+    miss.id = 9;
+    xpack::msgpack::decode(string("\x81\xa1n\xa1y", 5), miss); // id not present
+    EXPECT_EQ(miss.id, 9);
+    EXPECT_EQ(miss.name, "y");
+
+    bool thrown = false;
+    try {
+        xpack::msgpack::decode(data.substr(0, data.length()-1), b);
+    } catch (const std::exception &e) {
+        thrown = true;
+    }
+    EXPECT_TRUE(thrown);
+}
+
+TEST(utf8, multibyte) {
+    // long CJK text crosses the 16/32 bytes blocks of the simd version
+    string cjk;
+    for (int i=0; i<40; ++i) {
+        cjk += "\xe4\xbd\xa0\xe5\xa5\xbd\xf0\x9f\x98\x80\xc3\xa9";
+    }
+    EXPECT_TRUE(xpack::Utf8::Valid(cjk));
+
+    const char *bads[] = {"\xc0\xaf", "\xe0\x80\x80", "\xed\xa0\x80", "\xf0\x80\x80\x80", "\xf4\x90\x80\x80", "\x80", "\xe4\xbd"};
+    for (size_t i=0; i<sizeof(bads)/sizeof(bads[0]); ++i) {
+        for (size_t pos=0; pos<=96; pos+=12) { // on a character boundary
+            string s = cjk.substr(0, pos)+bads[i]+cjk.substr(pos, 96-pos);
+            size_t offset = 0;
+            EXPECT_FALSE(xpack::Utf8::Valid(s, &offset));
+            EXPECT_TRUE(offset >= pos && offset < pos+4);
+        }
+    }
+    EXPECT_FALSE(xpack::Utf8::Valid(cjk.substr(0, cjk.length()-1))); // truncated at the end
+}
+
+#ifdef X_PACK_SUPPORT_CXX0X
+TEST(decodecache, budget) {
+    xpack::DecodeCache<CachedConfig, xpack::json> &cache = xpack::DecodeCache<CachedConfig, xpack::json>::Instance();
+    string s1 = "{\"name\":\"one\"}";
+    string s2 = "{\"name\":\"two\"}";
+
+    cache.SetCapacity(1); // exactly one document
+    shared_ptr<const CachedConfig> c1 = xpack::json::decode_cached<CachedConfig>(s1);
+    xpack::json::decode_cached<CachedConfig>(s2);
+    EXPECT_TRUE(c1 != xpack::json::decode_cached<CachedConfig>(s1));
+
+    cache.SetCapacity(1000, s1.length()*32); // limited by bytes, 2 documents per shard
+    c1 = xpack::json::decode_cached<CachedConfig>(s1);
+    EXPECT_TRUE(c1 == xpack::json::decode_cached<CachedConfig>(s1));
+    cache.SetCapacity(1000, 1);             // smaller than any document
+    EXPECT_TRUE(c1 != xpack::json::decode_cached<CachedConfig>(s1));
+    EXPECT_EQ(xpack::json::decode_cached<CachedConfig>(s1)->name, "one");
+
+    cache.SetCapacity(128);
+}
+#endif
+
+#ifdef X_PACK_SUPPORT_CXX0X
+TEST(istr, capacity) {
+    xpack::InternPool &pool = xpack::InternPool::Instance();
+    xpack::IStr cn("CN");
+    size_t size = pool.Size();
+    pool.SetCapacity(size+2);
+
+    vector<InternRow> rows;
+    string s = "[";
+    for (int i=0; i<10; ++i) {
+        s += "{\"id\":"+to_string(i)+",\"country\":\"unique"+to_string(i)+"\"},";
+    }
+    s += "{\"id\":10,\"country\":\"CN\"}]";
+    xpack::json::decode(s, rows);
+    EXPECT_EQ(pool.Size(), size+2);   // bounded
+    EXPECT_EQ(rows[9].country.str(), "unique9");
+    EXPECT_TRUE(rows[9].country == xpack::IStr("unique9")); // not interned, compare the content
+    EXPECT_TRUE(rows[9].country != rows[8].country);
+    EXPECT_TRUE(&rows[10].country.str() == &cn.str()); // old value is still shared
+
+    pool.SetCapacity(65536);
+}
+#endif
+
+#ifdef X_PACK_SUPPORT_CXX0X
+TEST(parallel, flag) {
+    vector<Base> vb;
+    for (int i=0; i<3000; ++i) {
+        vb.push_back(Base(i, "p"));
+    }
+    EXPECT_EQ(xpack::json::encode_parallel(vb, 4, X_PACK_FLAG_COL), xpack::json::encode(vb, X_PACK_FLAG_COL, -1, ' '));
+    EXPECT_EQ(xpack::json::encode_parallel(vb, 4, X_PACK_FLAG_COL, 2, ' '), xpack::json::encode(vb, X_PACK_FLAG_COL, 2, ' '));
+
+    vector<int> vi(3000, 7);
+    EXPECT_EQ(xpack::json::encode_parallel(vi, 4, X_PACK_FLAG_B64), xpack::json::encode(vi, X_PACK_FLAG_B64, -1, ' '));
+    EXPECT_TRUE(xpack::json::encode_parallel(vi, 4, X_PACK_FLAG_B64)[0] == '"');
+
+    // $id is numbered across the whole array
+    shared_ptr<RefNode> same(new RefNode);
+    same->id = 1;
+    vector<shared_ptr<RefNode> > vs(600, same);
+    string ref = xpack::json::encode_parallel(vs, 4, 0, -1, ' ', X_PACK_DOC_FLAG_REF);
+    EXPECT_EQ(ref, xpack::json::encode(vs, 0, -1, ' ', X_PACK_DOC_FLAG_REF));
+    EXPECT_EQ(ref.find("$id", ref.find("$id")+1), string::npos);
+}
+#endif
+
+struct IovRow {
+    int id;
+    string name;
+    XPACK(O(id), X(F(REF), name));
+};
+struct IovTable {
+    vector<IovRow> rows;
+    string plain;
+    XPACK(X(F(COL), rows), O(plain));
+};
+TEST(iov, columns) {
+    IovTable t;
+    for (int i=0; i<3; ++i) {
+        IovRow r;
+        r.id = i;
+        r.name = string("row")+char('0'+i);
+        t.rows.push_back(r);
+    }
+    t.plain = "not flagged";
+
+    xpack::JsonIov iov;
+    xpack::json::encode_iov(t, iov, 1); // names of columns are temporaries, must be copied
+    EXPECT_EQ(iov.String(), xpack::json::encode(t));
+    for (size_t i=0; i<iov.Count(); ++i) {
+        EXPECT_TRUE(iov.Data()[i].iov_base != (void*)t.plain.data());
+    }
+}
+
+struct PatchBase {
+    int level;
+    XPACK(O(level));
+};
+struct PatchFull:public PatchBase {
+    int cache;  // not in XPACK
+    string name;
+    string note;
+    PatchPos pos;
+    vector<PatchPos> path;
+    map<string, PatchPos> marks;
+    unsigned flag:4;
+    XPACK(I(PatchBase), A(name, "json:n"), X(F(OE), note), O(pos, path, marks), B(F(0), flag));
+};
+TEST(patch, inplace) {
+    PatchFull a;
+    a.level = 1;
+    a.cache = 0;
+    a.name = "a";
+    a.note = "note";
+    a.pos.x = 1;
+    a.pos.y = 2;
+    a.path.push_back(a.pos);
+    a.marks["m1"] = a.pos;
+    a.marks["m2"] = a.pos;
+    a.flag = 3;
+
+    PatchFull b = a;
+    EXPECT_EQ(xpack::json::encode_diff(a, b), "{}");
+
+    b.level = 2;
+    b.name = "b";
+    b.note = "";
+    b.pos.x = 5;
+    b.path[0].y = 9;
+    b.marks["m1"].y = 7;
+    b.marks.erase("m2");
+    b.flag = 5;
+    string d = xpack::json::encode_diff(a, b);
+    EXPECT_EQ(d, "{\"level\":2,\"n\":\"b\",\"note\":null,\"pos\":{\"x\":5},\"path\":[{\"x\":1,\"y\":9}],\"marks\":{\"m1\":{\"y\":7},\"m2\":null},\"flag\":5}");
+
+    PatchFull c = a;
+    c.cache = 42;
+    xpack::json::decode_patch(d, c);
+    EXPECT_EQ(xpack::json::encode(c), xpack::json::encode(b));
+    EXPECT_EQ(c.cache, 42);       // not in XPACK, unchanged
+    EXPECT_EQ(c.pos.y, 2);        // not in the patch, unchanged
+    EXPECT_EQ(c.marks.count("m2"), 0U);
+
+    xpack::json::decode_patch("{\"pos\":null}", c);
+    EXPECT_EQ(c.pos.x, 0);
+    EXPECT_EQ(c.pos.y, 0);
+
+    // a bitfield not in the patch is unchanged
+    PatchFull e = b;
+    e.level = 7;
+    d = xpack::json::encode_diff(b, e);
+    EXPECT_EQ(d, "{\"level\":7}");
+    PatchFull f = b;
+    xpack::json::decode_patch(d, f);
+    EXPECT_EQ(f.level, 7);
+    EXPECT_EQ(f.flag, 5U);
+}
+
+#ifdef X_PACK_SUPPORT_CXX0X
+// counts the control blocks of allocate_shared that are freed
+static size_t memo_freed = 0;
+template <class T>
+struct MemoAlloc {
+    typedef T value_type;
+    MemoAlloc() {}
+    template <class U>
+    MemoAlloc(const MemoAlloc<U>&) {}
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n*sizeof(T)));
+    }
+    void deallocate(T *p, size_t) {
+        ++memo_freed;
+        ::operator delete(p);
+    }
+    template <class U>
+    bool operator == (const MemoAlloc<U>&) const {return true;}
+    template <class U>
+    bool operator != (const MemoAlloc<U>&) const {return false;}
+};
+TEST(memo, options) {
+    std::shared_ptr<MemoCard> c(new MemoCard);
+    c->id = 1;
+    c->name = "\xe4\xbd"; // invalid utf-8
+    MemoResp r;
+    r.cards.push_back(xpack::Memo<MemoCard>(c));
+    xpack::json::encode(r); // cached without X_PACK_DOC_FLAG_UTF8
+    bool except = false;
+    try {
+        xpack::json::encode(r, 0, -1, ' ', X_PACK_DOC_FLAG_UTF8);
+    } catch (...) {
+        except = true;
+    }
+    EXPECT_TRUE(except);
+
+    // shared objects are numbered in the whole document
+    c->name = "card";
+    r.cards.push_back(r.cards[0]);
+    EXPECT_EQ(xpack::json::encode(r, 0, -1, ' ', X_PACK_DOC_FLAG_REF), "{\"cards\":[{\"$id\":1,\"id\":1,\"name\":\"card\"},{\"$ref\":1}],\"none\":null}");
+
+    // entries of released objects are swept
+    xpack::EncodeCache<MemoCard, xpack::json>::Instance().Clear();
+    xpack::EncodeCache<MemoCard, xpack::json>::Instance().SetCapacity(16<<20);
+    memo_freed = 0;
+    {
+        MemoResp t;
+        t.cards.push_back(xpack::Memo<MemoCard>(std::allocate_shared<MemoCard>(MemoAlloc<MemoCard>())));
+        xpack::json::encode(t);
+    }
+    EXPECT_EQ(memo_freed, 0U); // weak_ptr in cache keeps the block
+    for (int i=0; i<64; ++i) {
+        xpack::json::encode(r);
+    }
+    EXPECT_EQ(memo_freed, 1U);
+}
+
+struct MemoOmit {
+    xpack::Memo<string> note;
+    int id;
+    XPACK(X(F(OE), note), O(id));
+};
+TEST(memo, omitempty) {
+    MemoOmit m;
+    m.note = xpack::Memo<string>(std::make_shared<const string>(""));
+    m.id = 1;
+    EXPECT_EQ(xpack::json::encode(m), "{\"id\":1}");
+}
+#endif
+
 // ++++++++++++++++++bug history+++++++++++++++++++++++
 TEST(bughis, notexists) {
     Base b(9, "");
@@ -0,0 +1,183 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_GZIP_H
+#define __X_PACK_GZIP_H
+
+#include "config.h"
+
+#ifdef XPACK_SUPPORT_ZLIB
+
+#include <string>
+#include <cstring>
+#include <stdexcept>
+#include <zlib.h>
+
+#include "traits.h"
+#include "sink.h"
+
+namespace xpack {
+
+// file name ends with .gz
+inline bool GzipFileName(const std::string &file_name) {
+    return file_name.length()>3 && 0==file_name.compare(file_name.length()-3, 3, ".gz");
+}
+
+/*
+  Compression stage in front of another sink. Data is deflated in blocks and the compressed
+  blocks are written to the next sink, call Finish at the end to write the trailer.
+  gzip format by default, raw deflate(no header) if gzip is false.
+*/
+class GzipSink:public Sink, private noncopyable {
+public:
+    GzipSink(Sink &out, int level=Z_DEFAULT_COMPRESSION, bool gzip=true):_out(out), _finished(false) {
+        memset(&_zs, 0, sizeof(_zs));
+        if (Z_OK != deflateInit2(&_zs, level, Z_DEFLATED, gzip?(15+16):-15, 8, Z_DEFAULT_STRATEGY)) {
+            throw std::runtime_error("gzip init fail");
+        }
+    }
+    ~GzipSink() {
+        deflateEnd(&_zs);
+    }
+
+    void Write(const char *data, size_t len) {
+        while (len > 0) { // avail_in is 32bit
+            uInt n = len>BLOCK?(uInt)BLOCK:(uInt)len;
+            deflate(data, n, Z_NO_FLUSH);
+            data += n;
+            len -= n;
+        }
+    }
+    void Finish() {
+        if (!_finished) {
+            _finished = true;
+            deflate(NULL, 0, Z_FINISH);
+        }
+    }
+
+private:
+    static const size_t BLOCK = 16*1024;
+
+    void deflate(const char *data, uInt len, int flush) {
+        _zs.next_in = (Bytef*)data;
+        _zs.avail_in = len;
+        int ret;
+        do {
+            _zs.next_out = (Bytef*)_buf;
+            _zs.avail_out = (uInt)sizeof(_buf);
+            ret = ::deflate(&_zs, flush);
+            if (ret == Z_STREAM_ERROR) {
+                throw std::runtime_error("gzip deflate fail");
+            }
+            size_t n = sizeof(_buf)-_zs.avail_out;
+            if (n > 0) {
+                _out.Write(_buf, n);
+            }
+        } while (_zs.avail_out == 0 || (flush==Z_FINISH && ret!=Z_STREAM_END));
+    }
+
+    Sink &_out;
+    z_stream _zs;
+    bool _finished;
+    char _buf[BLOCK];
+};
+
+/*
+  rapidjson input stream over a gzip file(plain file is read as is), the file is inflated
+  in blocks while parsing, the whole text is never held in memory.
+*/
+class GzipReadStream:private noncopyable {
+public:
+    typedef char Ch;
+
+    GzipReadStream(const std::string &file_name):_file(gzopen(file_name.c_str(), "rb")), _cur(_buf), _end(_buf), _count(0), _eof(false), _error(false) {
+        if (NULL != _file) {
+            read();
+        }
+    }
+    ~GzipReadStream() {
+        if (NULL != _file) {
+            gzclose(_file);
+            _file = NULL;
+        }
+    }
+
+    bool Good() const {
+        return NULL != _file;
+    }
+    // data is corrupted or truncated
+    bool Error() const {
+        return _error;
+    }
+
+    Ch Peek() const {
+        return _cur<_end?*_cur:'\0';
+    }
+    Ch Take() {
+        if (_cur >= _end) {
+            return '\0';
+        }
+        Ch c = *_cur++;
+        if (_cur == _end) {
+            read();
+        }
+        return c;
+    }
+    size_t Tell() const {
+        return _count+(size_t)(_cur-_buf);
+    }
+
+    // not used by reader
+    Ch* PutBegin() { return NULL; }
+    void Put(Ch) {}
+    void Flush() {}
+    size_t PutEnd(Ch*) { return 0; }
+
+private:
+    void read() {
+        _count += (size_t)(_end-_buf);
+        _cur = _end = _buf;
+        if (_eof) {
+            return;
+        }
+        int n = gzread(_file, _buf, (unsigned)sizeof(_buf));
+        if (n < 0) {
+            _error = true;
+            _eof = true;
+        } else if (n == 0) {
+            int err;
+            gzerror(_file, &err);
+            _error = (err != Z_OK); // Z_BUF_ERROR if truncated
+            _eof = true;
+        } else {
+            _end = _buf+n;
+        }
+    }
+
+    gzFile _file;
+    Ch _buf[16*1024];
+    Ch *_cur;
+    Ch *_end;
+    size_t _count;
+    bool _eof;
+    bool _error;
+};
+
+}
+
+#endif // XPACK_SUPPORT_ZLIB
+
+#endif
@@ -0,0 +1,229 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_ISTR_H
+#define __X_PACK_ISTR_H
+
+#include <string>
+#include <ostream>
+
+#include "extend.h"
+#include "traits.h"
+#include "util.h"
+
+#ifndef X_PACK_SUPPORT_CXX0X
+#error IStr need c++11
+#endif
+
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace xpack {
+
+/*
+  Interned string. Equal values share one immutable std::string in a global pool,
+  an IStr member is just a pointer, so repetitive values(country code, status, enum-ish token...)
+  cost no memory per row:
+
+    struct Row {
+        int id;
+        xpack::IStr country;
+        XPACK(O(id, country));
+    };
+
+  The pool never releases a string, so it's bounded by a capacity(default 65536 strings).
+  When it's full, a new value is not interned and the IStr owns a copy, so untrusted
+  input with high cardinality does not grow the pool without bound.
+*/
+class InternPool:private noncopyable {
+public:
+    static InternPool& Instance() {
+        static InternPool inst;
+        return inst;
+    }
+
+    // max number of strings in pool. strings already interned are kept
+    void SetCapacity(size_t capacity) {
+        _capacity = capacity;
+    }
+
+    // the returned pointer is valid forever. return NULL if the pool is full and the value is new
+    const std::string* Intern(const char *data, size_t len) {
+        uint64_t h = Util::hash(data, len);
+
+        // recently used strings of this thread, hit without lock
+        Recent &r = recent()[h%RECENT];
+        if (r.hash == h && NULL != r.str && equal(*r.str, data, len)) {
+            return r.str;
+        }
+
+        Shard &s = _shards[h%SHARDS];
+        std::lock_guard<std::mutex> lock(s.mu);
+        const std::string *str = s.find(h, data, len);
+        if (NULL == str) {
+            if (_size >= _capacity) {
+                return NULL;
+            }
+            s.strs.push_back(std::string(data, len)); // deque, address is stable
+            str = &s.strs.back();
+            s.index.insert(std::make_pair(h, str));
+            ++_size;
+        }
+        r.hash = h;
+        r.str = str;
+        return str;
+    }
+
+    const std::string* Intern(const std::string &str) {
+        return Intern(str.data(), str.length());
+    }
+
+    // number of different strings in pool
+    size_t Size() {
+        return _size;
+    }
+
+private:
+    static const size_t SHARDS = 16;
+    static const size_t RECENT = 256;
+
+    struct Shard {
+        std::mutex mu;
+        std::deque<std::string> strs;
+        std::unordered_multimap<uint64_t, const std::string*> index; // hash -> string, lookup without building a std::string
+
+        const std::string* find(uint64_t h, const char *data, size_t len) const {
+            typedef std::unordered_multimap<uint64_t, const std::string*>::const_iterator iterator;
+            std::pair<iterator, iterator> range = index.equal_range(h);
+            for (iterator it=range.first; it!=range.second; ++it) {
+                if (equal(*it->second, data, len)) {
+                    return it->second;
+                }
+            }
+            return NULL;
+        }
+    };
+
+    struct Recent {
+        uint64_t hash;
+        const std::string *str;
+    };
+
+    static bool equal(const std::string &str, const char *data, size_t len) {
+        return str.length() == len && 0 == memcmp(str.data(), data, len);
+    }
+
+    // the pool is a singleton, so the cache of a thread is shared by all the decodes in the thread
+    static Recent* recent() {
+        static thread_local Recent r[RECENT] = {};
+        return r;
+    }
+
+    InternPool():_capacity(65536), _size(0) {}
+
+    Shard _shards[SHARDS];
+    std::atomic<size_t> _capacity;
+    std::atomic<size_t> _size;
+};
+
+class IStr {
+public:
+    IStr():_str(empty_str()) {}
+    IStr(const std::string &str) {
+        init(str.data(), str.length());
+    }
+    IStr(const char *str) {
+        init(str, NULL==str?0:strlen(str));
+    }
+    IStr(const char *str, size_t len) {
+        init(str, len);
+    }
+
+    const std::string& str() const {
+        return *_str;
+    }
+    operator const std::string&() const {
+        return *_str;
+    }
+    const char* c_str() const {
+        return _str->c_str();
+    }
+    size_t length() const {
+        return _str->length();
+    }
+    bool empty() const {
+        return _str->empty();
+    }
+
+    // same interned value always has the same address, only the values not interned(pool is full) compare the content
+    bool operator == (const IStr &that) const {
+        return _str == that._str || ((_own || that._own) && *_str == *that._str);
+    }
+    bool operator != (const IStr &that) const {
+        return !(*this == that);
+    }
+    bool operator < (const IStr &that) const {
+        return *_str < *that._str;
+    }
+
+private:
+    static const std::string* empty_str() {
+        static const std::string e;
+        return &e;
+    }
+
+    void init(const char *str, size_t len) {
+        if (0 == len) {
+            _str = empty_str();
+        } else if (NULL == (_str = InternPool::Instance().Intern(str, len))) {
+            _own = std::make_shared<const std::string>(str, len);
+            _str = _own.get();
+        }
+    }
+
+    const std::string *_str;
+    std::shared_ptr<const std::string> _own; // only if the pool is full
+};
+
+inline std::ostream& operator << (std::ostream &os, const IStr &s) {
+    return os<<s.str();
+}
+
+template<>
+struct is_xpack_xtype<IStr> {static bool const value = true;};
+
+template <class OBJ>
+bool xpack_xtype_decode(OBJ &obj, const char*key, IStr &val, const Extend *ext) {
+    static thread_local std::string buf; // reused, value already in pool costs no allocation
+    bool ret = obj.decode(key, buf, ext);
+    if (ret) {
+        val = IStr(buf.data(), buf.length());
+    }
+    return ret;
+}
+
+template <class OBJ>
+bool xpack_xtype_encode(OBJ &obj, const char*key, const IStr &val, const Extend *ext) {
+    return obj.encode(key, val.str(), ext);
+}
+
+}
+
+#endif
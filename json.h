@@ -19,8 +19,19 @@
 
 #include "json_decoder.h"
 #include "json_encoder.h"
+#include "size_hint.h"
+#include "json_iov.h"
+#include "json_patch.h"
+#include "field_mask.h"
+#include "json_value.h"
 #if defined(X_PACK_SUPPORT_CXX0X) || defined (_GNU_SOURCE)
 #include "json_data.h"
+#include "json_document.h"
+#endif
+#ifdef X_PACK_SUPPORT_CXX0X
+#include "decode_cache.h"
+#include "encode_cache.h"
+#include "json_parallel.h"
 #endif
 #include "xpack.h"
 
@@ -33,30 +44,306 @@ public:
         JsonDecoder doc(data);
         doc.decode(NULL, val, NULL);
     }
+    // docFlag: X_PACK_DOC_FLAG_xxx
+    template <class T>
+    static void decode(const std::string &data, T &val, int docFlag) {
+        if (0 == (docFlag&X_PACK_DOC_FLAG_STOP)) {
+            JsonDecoder doc(data, false, docFlag);
+            doc.decode(NULL, val, NULL);
+        } else {
+            JsonKeysStop stop(JsonKeysStop::Keys<T>());
+            JsonDecoder doc(data, false, docFlag, stop);
+            doc.decode(NULL, val, NULL);
+        }
+    }
+    // stop parsing when stop(key) return true. stop is called after each member of the top level object is parsed
+    template <class T, class Stop>
+    static void decode_until(const std::string &data, T &val, Stop stop, int docFlag=0) {
+        JsonDecoder doc(data, false, docFlag, stop);
+        doc.decode(NULL, val, NULL);
+    }
     template <class T>
     static void decode(const rapidjson::Value &data, T &val) {
         JsonDecoder doc(&data);
         doc.decode(NULL, val, NULL);
     }
+    #ifdef X_PACK_SUPPORT_CXX0X
+    // return a shared immutable result. byte-identical data decoded before is returned from a LRU cache.
+    // the budget(documents and bytes) can be changed by xpack::DecodeCache<T, xpack::json>::Instance().SetCapacity
+    template <class T>
+    static std::shared_ptr<const T> decode_cached(const std::string &data) {
+        return DecodeCache<T, json>::Instance().Get(data, decode_string<T>);
+    }
+    #endif
+
+    /*
+      apply a merge patch(RFC 7386) made by encode_diff to val in place: members not in the patch are unchanged,
+      null resets a member, see JsonPatchDecoder
+    */
+    template <class T>
+    static void decode_patch(const std::string &patch, T &val) {
+        rapidjson::Document p;
+        std::string err = JsonDecoder::Parse(p, patch, false, 0);
+        if (!err.empty()) {
+            throw std::runtime_error(err);
+        }
+        JsonPatchDecoder::Apply(p, val);
+    }
+
     template <class T>
-    static void decode_file(const std::string &file_name, T &val) {
-        JsonDecoder doc(file_name, true);
+    static void decode_file(const std::string &file_name, T &val, int docFlag=0) {
+        JsonDecoder doc(file_name, true, docFlag);
         doc.decode(NULL, val, NULL);
     }
 
     template <class T>
     static std::string encode(const T &val) {
-        JsonEncoder doc(-1);
+        JsonCompactEncoder doc;
+        doc.Reserve(SizeHint<T, JsonCompactEncoder>::Get());
         doc.encode(NULL, val, NULL);
+        SizeHint<T, JsonCompactEncoder>::Update(doc.Size());
         return doc.String();
     }
 
     template <class T>
-    static std::string encode(const T &val, int flag, int indentCount, char indentChar) {
-        JsonEncoder doc(indentCount, indentChar);
+    static std::string encode(const T &val, int flag, int indentCount, char indentChar, int docFlag=0) {
+        if (indentCount < 0) {
+            return encode_with<JsonCompactEncoder>(val, flag, indentCount, indentChar, docFlag, NULL, 0);
+        } else {
+            return encode_with<JsonPrettyEncoder>(val, flag, indentCount, indentChar, docFlag, NULL, 0);
+        }
+    }
+
+    // sizeHint: expected size of the output, the buffer is allocated once if it's big enough.
+    // without hint the buffer is reserved by the average encoded size of T
+    template <class T>
+    static std::string encode_hint(const T &val, size_t sizeHint, int flag=0, int indentCount=-1, char indentChar=' ', int docFlag=0) {
+        if (indentCount < 0) {
+            return encode_with<JsonCompactEncoder>(val, flag, indentCount, indentChar, docFlag, NULL, sizeHint);
+        } else {
+            return encode_with<JsonPrettyEncoder>(val, flag, indentCount, indentChar, docFlag, NULL, sizeHint);
+        }
+    }
+
+    // write to sink by blocks(see sink.h), the whole json is never held in memory
+    template <class T>
+    static void encode(const T &val, Sink &sink, int flag=0, int indentCount=-1, char indentChar=' ', int docFlag=0) {
+        if (indentCount < 0) {
+            encode_with<JsonCompactEncoder>(val, flag, indentCount, indentChar, docFlag, &sink, 0);
+        } else {
+            encode_with<JsonPrettyEncoder>(val, flag, indentCount, indentChar, docFlag, &sink, 0);
+        }
+    }
+
+    /*
+      merge patch(RFC 7386) from oldVal to newVal, only the changed members are included,
+      nested XPACK structs and maps are compared member by member. return {} if nothing changed.
+      apply it with decode_patch
+    */
+    template <class T>
+    static std::string encode_diff(const T &oldVal, const T &newVal) {
+        JsonBuffer buf;
+        JsonDiffEncoder::writer_type w(buf);
+        JsonDiffEncoder::Diff(oldVal, newVal, w);
+        return std::string(buf.GetString(), buf.GetSize());
+    }
+
+    // only the members selected by mask are encoded, see FieldMask
+    template <class T>
+    static std::string encode(const T &val, const FieldMask<T> &mask, int flag=0, int indentCount=-1, char indentChar=' ') {
+        if (indentCount < 0) {
+            return encode_mask<JsonCompactEncoder>(val, mask, flag, indentCount, indentChar);
+        } else {
+            return encode_mask<JsonPrettyEncoder>(val, mask, flag, indentCount, indentChar);
+        }
+    }
+
+    // build rapidjson nodes in alloc(e.g. doc.GetAllocator()) directly, no text is encoded and parsed back
+    template <class T>
+    static void to_value(const T &val, rapidjson::Value &out, rapidjson::MemoryPoolAllocator<> &alloc, int flag=0, int docFlag=0) {
+        JsonValueEncoder doc(out, alloc);
+        Extend ext(flag, NULL);
+        doc.SetDocFlag(docFlag);
+        doc.encode(NULL, val, &ext);
+    }
+    #ifdef X_PACK_SUPPORT_CXX0X
+    template <class T>
+    static rapidjson::Value to_value(const T &val, rapidjson::MemoryPoolAllocator<> &alloc, int flag=0, int docFlag=0) {
+        rapidjson::Value v;
+        to_value(val, v, alloc, flag, docFlag);
+        return v;
+    }
+    #endif
+
+    // exact length of the output of encode with the same arguments, nothing is written
+    template <class T>
+    static size_t encoded_size(const T &val, int flag=0, int indentCount=-1, char indentChar=' ', int docFlag=0) {
+        if (indentCount < 0) {
+            return encoded_size_with<JsonCountCompactEncoder>(val, flag, indentCount, indentChar, docFlag);
+        } else {
+            return encoded_size_with<JsonCountPrettyEncoder>(val, flag, indentCount, indentChar, docFlag);
+        }
+    }
+
+    // encode with a user writer policy, see JsonWriterEncoder
+    template <class WRITER, class T>
+    static std::string encode_writer(const T &val, int flag=0, int indentCount=-1, char indentChar=' ', int docFlag=0) {
+        return encode_with<JsonWriterEncoder<WRITER> >(val, flag, indentCount, indentChar, docFlag, NULL, 0);
+    }
+
+    #ifdef X_PACK_SUPPORT_CXX0X
+    // encode large vector with several threads(threads<=0 means hardware concurrency), output is the same as encode.
+    // flag changes how the vector itself is written(B64, COL, SL...), and X_PACK_DOC_FLAG_REF numbers objects
+    // across the whole document, so it's encoded by one thread if either is set
+    template <class T>
+    static std::string encode_parallel(const std::vector<T> &val, int threads=0, int flag=0, int indentCount=-1, char indentChar=' ', int docFlag=0) {
+        if (val.empty() || flag!=0 || 0!=(docFlag&X_PACK_DOC_FLAG_REF) || threads==1) {
+            return encode(val, flag, indentCount, indentChar, docFlag);
+        } else if (indentCount < 0) {
+            return JsonParallel::Encode<JsonCompactEncoder>(val, threads, indentCount, indentChar, docFlag);
+        } else {
+            return JsonParallel::Encode<JsonPrettyEncoder>(val, threads, indentCount, indentChar, docFlag);
+        }
+    }
+    #endif
+
+    // append to out
+    template <class T>
+    static void encode(const T &val, std::string &out) {
+        StringSink sink(out);
+        encode(val, sink);
+    }
+    template <class T>
+    static void encode(const T &val, std::vector<char> &out) {
+        VectorSink sink(out);
+        encode(val, sink);
+    }
+    template <class T>
+    static void encode(const T &val, std::ostream &out) {
+        OStreamSink sink(out);
+        encode(val, sink);
+    }
+    template <class T>
+    static void encode_fd(const T &val, int fd) {
+        FdSink sink(fd);
+        encode(val, sink);
+    }
+    /*
+      scatter-gather encode, the output is out.Data()/out.Count() for writev.
+      std::string member flagged with F(REF)(e.g. X(F(REF), body)), not shorter than refMin and need no escaping,
+      is referenced in place instead of copied, so val must be kept unchanged until the iovec is used.
+    */
+    template <class T>
+    static void encode_iov(const T &val, JsonIov &out, size_t refMin=1024, int flag=0, int indentCount=-1, char indentChar=' ') {
+        if (indentCount < 0) {
+            encode_refs<JsonCompactEncoder>(val, out, refMin, flag, indentCount, indentChar);
+        } else {
+            encode_refs<JsonPrettyEncoder>(val, out, refMin, flag, indentCount, indentChar);
+        }
+    }
+
+    /*
+      encode into [buf, buf+cap) without any heap allocation, for paths that must not allocate.
+      return false if the output doesn't fit, the content of buf is undefined then.
+      len is the length of the output, no '\0' is appended.
+      nesting is limited to JsonFixedStack::DEPTH levels, deeper nesting returns false too
+    */
+    template <class T>
+    static bool encode_fixed(const T &val, char *buf, size_t cap, size_t &len, int flag=0, int indentCount=-1, char indentChar=' ') {
+        if (indentCount < 0) {
+            return encode_fixed_with<JsonFixedCompactEncoder>(val, buf, cap, len, flag, indentCount, indentChar);
+        } else {
+            return encode_fixed_with<JsonFixedPrettyEncoder>(val, buf, cap, len, flag, indentCount, indentChar);
+        }
+    }
+
+    // write to file through a 4KB buffer. with XPACK_SUPPORT_ZLIB, file_name ends with .gz is compressed
+    template <class T>
+    static void encode_file(const T &val, const std::string &file_name, int flag=0, int indentCount=-1, char indentChar=' ', int docFlag=0) {
+        FileSink sink(file_name);
+        #ifdef XPACK_SUPPORT_ZLIB
+        if (GzipFileName(file_name)) {
+            encode_gz(val, sink, flag, indentCount, indentChar, docFlag);
+            sink.Close();
+            return;
+        }
+        #endif
+        encode(val, sink, flag, indentCount, indentChar, docFlag);
+        sink.Close();
+    }
+
+    #ifdef XPACK_SUPPORT_ZLIB
+    // gzip compressed json is written to sink by blocks, neither the json nor the compressed data is held in memory
+    template <class T>
+    static void encode_gz(const T &val, Sink &sink, int flag=0, int indentCount=-1, char indentChar=' ', int docFlag=0, int level=Z_DEFAULT_COMPRESSION) {
+        GzipSink gz(sink, level);
+        encode(val, gz, flag, indentCount, indentChar, docFlag);
+        gz.Finish();
+    }
+    #endif
+
+private:
+    template <class T>
+    static void decode_string(const std::string &data, T &val) {
+        decode(data, val);
+    }
+
+    template <class ENCODER, class T>
+    static std::string encode_mask(const T &val, const FieldMask<T> &mask, int flag, int indentCount, char indentChar) {
+        ENCODER doc(indentCount, indentChar);
+        Extend ext(flag, NULL);
+
+        FieldMaskEncoder<ENCODER>::Encode(doc, NULL, val, mask.Root(), &ext);
+        return doc.String();
+    }
+
+    template <class ENCODER, class T>
+    static size_t encoded_size_with(const T &val, int flag, int indentCount, char indentChar, int docFlag) {
+        ENCODER doc(indentCount, indentChar);
+        Extend ext(flag, NULL);
+
+        doc.SetDocFlag(docFlag);
+        doc.encode(NULL, val, &ext);
+        return doc.Size();
+    }
+
+    template <class ENCODER, class T>
+    static bool encode_fixed_with(const T &val, char *buf, size_t cap, size_t &len, int flag, int indentCount, char indentChar) {
+        ENCODER doc(buf, cap, indentCount, indentChar);
+        Extend ext(flag, NULL);
+
+        doc.encode(NULL, val, &ext);
+        len = doc.Size();
+        return !doc.Overflow();
+    }
+
+    template <class ENCODER, class T>
+    static void encode_refs(const T &val, JsonIov &out, size_t refMin, int flag, int indentCount, char indentChar) {
+        ENCODER doc(indentCount, indentChar);
+        Extend ext(flag, NULL);
+
+        out._refs.refs.clear();
+        doc.SetRefs(&out._refs, refMin>0?refMin:1);
+        doc.encode(NULL, val, &ext);
+        out._buf.Swap(doc.Buffer());
+        out.build();
+    }
+
+    template <class ENCODER, class T>
+    static std::string encode_with(const T &val, int flag, int indentCount, char indentChar, int docFlag, Sink *sink, size_t sizeHint) {
+        ENCODER doc(indentCount, indentChar, sink);
         Extend ext(flag, NULL);
 
+        if (NULL == sink) {
+            doc.Reserve(sizeHint>0?sizeHint:SizeHint<T, ENCODER>::Get());
+        }
+        doc.SetDocFlag(docFlag);
         doc.encode(NULL, val, &ext);
+        if (NULL != sink) {
+            doc.Flush();
+            return std::string();
+        }
+        SizeHint<T, ENCODER>::Update(doc.Size());
         return doc.String();
     }
 };
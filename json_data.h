@@ -24,6 +24,8 @@ so the other way around
 */
 #include "json_encoder.h"
 #include "json_decoder.h"
+#include "json_value.h"
+#include "json_patch.h"
 
 namespace xpack {
 
@@ -61,13 +63,13 @@ public:
     void reset(T *p = NULL) {
         *this = x_shared_ptr(p);
     }
-    T* operator ->() {
+    T* operator ->() const {
         return ptr;
     }
-    T* get() {
+    T* get() const {
         return ptr;
     }
-    T& operator *() {
+    T& operator *() const {
         return *ptr;
     }
 private:
@@ -102,9 +104,6 @@ enum JsonType {
     kNumberType = 6     //!< number
 };
 
-class JsonEncoder;
-
-
 class JsonData {
     class MemberIterator {
     public:
@@ -133,6 +132,7 @@ class JsonData {
     struct Resource {
         x_shared_ptr<rapidjson::MemoryPoolAllocator<> > allocator;
         x_shared_ptr<rapidjson::Value> root; // release root first
+        x_shared_ptr<size_t> version; // increased when the document is changed, shared by all JsonData of it
         const rapidjson::Value *node; // current node
 
         Resource() :node(NULL) {
@@ -143,9 +143,11 @@ class JsonData {
         void reset(const rapidjson::Value *v = NULL, bool initNull = false) {
             root.reset();
             allocator.reset();
+            version.reset();
 
             if (NULL != v || initNull) {
                 allocator.reset(new rapidjson::MemoryPoolAllocator<>());
+                version.reset(new size_t(0));
                 if (NULL != v) {
                     root.reset(new rapidjson::Value(*v, *allocator, true));
                 } else {
@@ -158,6 +160,9 @@ class JsonData {
 public:
     typedef MemberIterator Iterator;
 
+    JsonData():_json_version(0) {
+    }
+
     // check type
     JsonType Type() const {
         return static_cast<JsonType>(_res.node->GetType());
@@ -229,17 +234,112 @@ public:
         return Iterator(_res.node->MemberEnd(), this);
     }
 
+    // build from a value directly instead of encoding it to text and parsing back
+    template <class T>
+    static JsonData from(const T &val, int flag=0, int docFlag=0) {
+        JsonData d;
+        d._res.reset(NULL, true);
+        JsonValueEncoder e(*d._res.root, *d._res.allocator);
+        Extend ext(flag, NULL);
+        e.SetDocFlag(docFlag);
+        e.encode(NULL, val, &ext);
+        return d;
+    }
+
     template <class T>
     bool decode(T &val) const {
         JsonDecoder d(_res.node);
         return d.decode(NULL, val, NULL);
     }
 
+    /*
+      change the document in place, memory comes from the allocator of the document, so a JsonData
+      got by [] changes the document it belongs to. val is anything that can be encoded(JsonData, struct...).
+      like iterators, JsonData of the members of a changed object/array may be invalid after that.
+      a JsonData without document(default constructed) becomes a new document.
+    */
+    template <class T>
+    JsonData& Set(const T &val) {
+        rapidjson::Value &node = mutable_node();
+        rapidjson::Value v;
+        encode_value(val, v);
+        node = v;
+        return *this;
+    }
+    // set member of object, added if not exists. null becomes object
+    template <class T>
+    JsonData& Set(const char *key, const T &val) {
+        rapidjson::Value &node = mutable_node();
+        if (node.IsNull()) {
+            node.SetObject();
+        } else if (!node.IsObject()) {
+            throw std::runtime_error(std::string("JsonData set key fail, not object. key=")+key);
+        }
+        rapidjson::Value v;
+        encode_value(val, v);
+        rapidjson::Value::MemberIterator iter = node.FindMember(key);
+        if (iter != node.MemberEnd()) {
+            iter->value = v;
+        } else {
+            rapidjson::Value name(key, *_res.allocator);
+            node.AddMember(name, v, *_res.allocator);
+        }
+        return *this;
+    }
+    // append to array. null becomes array
+    template <class T>
+    JsonData& PushBack(const T &val) {
+        rapidjson::Value &node = mutable_node();
+        if (node.IsNull()) {
+            node.SetArray();
+        } else if (!node.IsArray()) {
+            throw std::runtime_error("JsonData push back fail, not array");
+        }
+        rapidjson::Value v;
+        encode_value(val, v);
+        node.PushBack(v, *_res.allocator);
+        return *this;
+    }
+    // remove member of object, the order of other members is kept. return false if not found
+    bool Erase(const char *key) {
+        if (NULL == _res.node || !_res.node->IsObject() || !_res.node->HasMember(key)) {
+            return false;
+        }
+        rapidjson::Value &node = mutable_node();
+        node.EraseMember(node.FindMember(key));
+        return true;
+    }
+    // remove element of array
+    bool Erase(size_t index) {
+        if (NULL == _res.node || !_res.node->IsArray() || index >= (size_t)_res.node->Size()) {
+            return false;
+        }
+        rapidjson::Value &node = mutable_node();
+        node.Erase(node.Begin()+index);
+        return true;
+    }
+    // merge patch(RFC 7386): objects are merged recursively, null removes the member, others are replaced
+    JsonData& Merge(const JsonData &patch) {
+        if (NULL == patch._res.node) {
+            return *this;
+        }
+        rapidjson::Value &node = mutable_node();
+        if (patch._res.root.get() == _res.root.get()) { // patch may be changed while applying
+            rapidjson::Value tmp(*patch._res.node, *_res.allocator, true);
+            JsonMergePatch::Apply(node, tmp, *_res.allocator);
+        } else {
+            JsonMergePatch::Apply(node, *patch._res.node, *_res.allocator);
+        }
+        return *this;
+    }
+
     std::string String() {
-        if (_json_string.empty()) {
-            JsonEncoder e(-1);
+        size_t version = (NULL!=_res.version.get())?*_res.version:0;
+        if (_json_string.empty() || _json_version != version) {
+            JsonCompactEncoder e;
             xpack_encode(e, NULL, NULL);
             _json_string = e.String();
+            _json_version = version;
         }
         return _json_string;
     }
@@ -258,9 +358,11 @@ public:
         } else {
             _res.reset(v, false);
         }
+        _json_string.clear();
         return true;
     }
-    bool xpack_encode(JsonEncoder &obj, const char*key, const Extend *ext) const {
+    template <class OBJ>
+    bool xpack_encode(OBJ &obj, const char*key, const Extend *ext) const {
         switch (Type()){
         case kNullType:
             return obj.writeNull(key, ext);
@@ -300,9 +402,26 @@ public:
     }
 
 private:
+    rapidjson::Value& mutable_node() {
+        if (NULL == _res.allocator.get()) {
+            _res.reset(_res.node, true);
+        } else if (NULL == _res.node) {
+            throw std::runtime_error("JsonData is invalid(member not exists)");
+        }
+        ++*_res.version;
+        return *const_cast<rapidjson::Value*>(_res.node);
+    }
+
+    template <class T>
+    void encode_value(const T &val, rapidjson::Value &v) {
+        JsonValueEncoder e(v, *_res.allocator);
+        e.encode(NULL, val, NULL);
+    }
+
     Resource _res;
 
     std::string _json_string;
+    size_t _json_version; // version of the document when _json_string is made
 };
 
 template<>
@@ -311,7 +430,11 @@ struct is_xpack_xtype<JsonData> {static bool const value = true;};
 inline bool xpack_xtype_decode(JsonDecoder &obj, const char*key, JsonData &val, const Extend *ext) {
     return val.xpack_decode(obj, key, ext);
 }
-inline bool xpack_xtype_encode(JsonEncoder &obj, const char*key, const JsonData &val, const Extend *ext) {
+template <class WRITER>
+inline bool xpack_xtype_encode(JsonWriterEncoder<WRITER> &obj, const char*key, const JsonData &val, const Extend *ext) {
+    return val.xpack_encode(obj, key, ext);
+}
+inline bool xpack_xtype_encode(JsonValueEncoder &obj, const char*key, const JsonData &val, const Extend *ext) {
     return val.xpack_encode(obj, key, ext);
 }
 
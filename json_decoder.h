@@ -18,16 +18,67 @@
 #define __X_PACK_JSON_DECODER_H
 
 #include <fstream>
+#include <set>
+#include <map>
+#include <cstring>
+#include <algorithm>
 
 #include "rapidjson_custom.h"
 #include "xrapidjson/document.h"
 #include "xrapidjson/error/en.h"
 
 #include "xdecoder.h"
+#include "utf8.h"
+#include "members.h"
+#include "gzip.h"
 
 
 namespace xpack {
 
+// never stop, for JsonDecoder::Parse without stop condition
+struct JsonNoStop {
+    bool operator()(const char *key) {
+        (void)key;
+        return false;
+    }
+};
+
+// stop when all the keys are found, for X_PACK_DOC_FLAG_STOP
+class JsonKeysStop {
+public:
+    // sorted keys of T, collected once per T
+    template <class T>
+    static const std::vector<std::string>& Keys() {
+        static const std::vector<std::string> keys(sorted_keys<T>());
+        return keys;
+    }
+
+    // keys must be sorted and unique(see Keys), it's referenced, not copied
+    JsonKeysStop(const std::vector<std::string> &keys):_keys(keys), _found(keys.size(), false), _left(keys.size()) {
+    }
+    bool operator()(const char *key) {
+        std::vector<std::string>::const_iterator it = std::lower_bound(_keys.begin(), _keys.end(), key);
+        if (it!=_keys.end() && *it==key && !_found[it-_keys.begin()]) {
+            _found[it-_keys.begin()] = true;
+            --_left;
+        }
+        return !_keys.empty() && 0==_left;
+    }
+private:
+    template <class T>
+    static std::vector<std::string> sorted_keys() {
+        std::vector<std::string> keys;
+        Members::Names<T>("json", keys);
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        return keys;
+    }
+
+    const std::vector<std::string> &_keys;
+    std::vector<bool> _found;
+    size_t _left;
+};
+
 class JsonDecoder:public XDecoder<JsonDecoder>, private noncopyable {
     friend class XDecoder<JsonDecoder>;
     friend class JsonData;
@@ -56,12 +107,55 @@ public:
     using xdoc_type::decode;
     typedef MemberIterator Iterator;
 
-    JsonDecoder(const std::string& str, bool isfile=false):xdoc_type(NULL, ""),_doc(new rapidjson::Document),_val(_doc) {
+    JsonDecoder(const std::string& str, bool isfile=false, int docFlag=0):xdoc_type(NULL, ""),_doc(new rapidjson::Document),_val(_doc),_doc_flag(docFlag) {
+        JsonNoStop stop;
+        init_doc(str, isfile, docFlag, stop);
+    }
+
+    // stop parsing when stop(key) return true, checked every time a member of the top level object is parsed.
+    // the rest of the input is not parsed(kParseStopWhenDoneFlag like), so members after that are not decoded.
+    template <class Stop>
+    JsonDecoder(const std::string& str, bool isfile, int docFlag, Stop &stop):xdoc_type(NULL, ""),_doc(new rapidjson::Document),_val(_doc),_doc_flag(docFlag) {
+        init_doc(str, isfile, docFlag, stop);
+    }
+
+    JsonDecoder(const rapidjson::Value*v, int docFlag=0):xdoc_type(NULL, ""),_doc(NULL),_val(v),_doc_flag(docFlag) {
+    }
+
+    ~JsonDecoder() {
+        if (NULL != _doc) {
+            delete _doc;
+            _doc = NULL;
+        }
+    }
+
+    inline const char * Type() const {
+        return "json";
+    }
+
+    // parse str(or the content of file str if isfile) into doc. return error message, empty if success
+    static std::string Parse(rapidjson::Document &doc, const std::string& str, bool isfile, int docFlag) {
+        JsonNoStop stop;
+        return Parse(doc, str, isfile, docFlag, stop);
+    }
+
+    template <class Stop>
+    static std::string Parse(rapidjson::Document &doc, const std::string& str, bool isfile, int docFlag, Stop &stop) {
         std::string err;
         std::string data;
 
         do {
             const unsigned int parseFlags = rapidjson::kParseNanAndInfFlag;
+            #ifdef XPACK_SUPPORT_ZLIB
+            if (isfile && GzipFileName(str)) { // inflated while parsing
+                if (is_no_stop(stop)) {
+                    err = parse_gzip<parseFlags>(doc, str, docFlag);
+                } else {
+                    err = "Parse json file \""+str+"\" fail. err=stop is not supported for gzip file";
+                }
+                break;
+            }
+            #endif
             if (isfile) {
                 std::ifstream fs(str.c_str(), std::ifstream::binary);
                 if (!fs) {
@@ -70,45 +164,47 @@ public:
                 }
                 std::string _tmp((std::istreambuf_iterator<char>(fs)), std::istreambuf_iterator<char>());
                 data.swap(_tmp);
-                _doc->Parse<parseFlags>(data.data(), data.length());
-            } else  {
-                _doc->Parse<parseFlags>(str.data(), str.length());
             }
 
-            if (_doc->HasParseError()) {
-                size_t offset = _doc->GetErrorOffset();
-                std::string parse_err(rapidjson::GetParseError_En(_doc->GetParseError()));
+            // json structural characters are all ascii, so a valid utf-8 text means every string is valid utf-8.
+            // check the text once instead of kParseValidateEncodingFlag, which validates byte by byte.
+            // with a stop condition only the bytes parsed are checked, after parsing
+            const std::string &text = isfile?data:str;
+            size_t bad;
+            if ((docFlag&X_PACK_DOC_FLAG_UTF8) && is_no_stop(stop) && !Utf8::Valid(text, &bad)) {
+                err = "Parse json fail. err=Invalid encoding in string. offset="+Util::itoa(bad);
+                break;
+            }
+            rapidjson::ParseErrorCode code;
+            size_t offset;
+            if (is_no_stop(stop)) {
+                doc.Parse<parseFlags>(text.data(), text.length());
+                code = doc.GetParseError();
+                offset = doc.GetErrorOffset();
+            } else {
+                StopGenerator<Stop, parseFlags> gen(text, stop);
+                doc.Populate(gen);
+                code = gen.code;
+                offset = gen.offset;
+                if (code==rapidjson::kParseErrorNone && (docFlag&X_PACK_DOC_FLAG_UTF8) && !Utf8::Valid(text.data(), gen.parsed, &bad)) {
+                    err = "Parse json fail. err=Invalid encoding in string. offset="+Util::itoa(bad);
+                    break;
+                }
+            }
+
+            if (code != rapidjson::kParseErrorNone) {
+                std::string parse_err(rapidjson::GetParseError_En(code));
                 if  (isfile) {
                     std::string err_data = data.substr(offset, 32);
                     err = "Parse json file \""+str+"\" fail. err="+parse_err+". offset="+err_data;
-                    break;
                 } else {
                     std::string err_data = str.substr(offset, 32);
                     err = "Parse json string fail. err="+parse_err+". offset="+err_data;
-                    break;
                 }
             }
-
-            return;
         } while (false);
 
-        delete _doc;
-        _doc = NULL;
-        throw std::runtime_error(err);
-    }
-
-    JsonDecoder(const rapidjson::Value*v):xdoc_type(NULL, ""),_doc(NULL),_val(v) {
-    }
-
-    ~JsonDecoder() {
-        if (NULL != _doc) {
-            delete _doc;
-            _doc = NULL;
-        }
-    }
-
-    inline const char * Type() const {
-        return "json";
+        return err;
     }
 
 public:
@@ -154,6 +250,30 @@ public:
         }
         return false;
     }
+    // vector of struct, the layout of F(COL) {"cols":[...],"rows":[[...],...]} is accepted too
+    template <class T>
+    bool decode_columns(const char*key, std::vector<T> &val, const Extend *ext) {
+        return columns(key, val, ext, 0);
+    }
+    // base64 text of F(B64) without copying
+    bool decode_blob(const char*key, std::string &tmp, const char *&data, size_t &len, const Extend *ext) {
+        (void)tmp;
+        bool isNull;
+        const rapidjson::Value *v = get_val(key, isNull);
+        if (NULL != v) {
+            if (!v->IsString()) {
+                decode_exception("type unmatch", key);
+            }
+            data = v->GetString();
+            len = v->GetStringLength();
+            return true;
+        } else if (isNull) {
+            return true;
+        } else if (NULL!=key && Extend::Mandatory(ext)) {
+            decode_exception("mandatory key not found", key);
+        }
+        return false;
+    }
     bool decode(const char*key, bool &val, const Extend *ext) {
         bool isNull;
         const rapidjson::Value *v = get_val(key, isNull);
@@ -241,6 +361,51 @@ public:
     }
     #endif
 
+    #ifdef X_PACK_SUPPORT_CXX0X
+    /*
+      with X_PACK_DOC_FLAG_REF, restore the sharing written by the encoder: an object whose first member
+      is "$id" is recorded, a later {"$ref":id} points to the same object. other objects are decoded as before
+    */
+    template <class T>
+    bool decode(const char*key, std::shared_ptr<T>& val, const Extend *ext) {
+        if (0 == (top()->_doc_flag&X_PACK_DOC_FLAG_REF)) {
+            return xdoc_type::decode(key, val, ext);
+        }
+        bool isNull;
+        const rapidjson::Value *v = get_val(key, isNull);
+        if (NULL==v || !v->IsObject() || v->MemberCount()==0 || !v->MemberBegin()->value.IsInt()) {
+            return xdoc_type::decode(key, val, ext);
+        }
+        const char *name = v->MemberBegin()->name.GetString();
+        bool ref = 0==strcmp(name, "$ref");
+        if (!ref && 0!=strcmp(name, "$id")) {
+            return xdoc_type::decode(key, val, ext);
+        }
+
+        int id = v->MemberBegin()->value.GetInt();
+        std::map<int, SharedObject> &objects = shared_objects();
+        const void *type = &x_type_tag<T>::value;
+        if (ref) {
+            typename std::map<int, SharedObject>::const_iterator iter = objects.find(id);
+            if (iter == objects.end() || iter->second.second != type) {
+                decode_exception("$ref not found or type mismatch", key);
+            }
+            val = std::static_pointer_cast<T>(iter->second.first);
+            return true;
+        }
+
+        if (NULL == val.get()) {
+            val.reset(new T);
+        }
+        objects[id] = SharedObject(std::static_pointer_cast<void>(val), type); // before members, so they can refer to it
+        JsonDecoder tmp;
+        JsonDecoder *obj = this->find(key, &tmp, ext);
+        Extend vext(Extend::Flag(ext), NULL);
+        obj->shared_value(*val, &vext, 0);
+        return true;
+    }
+    #endif
+
     // array
     size_t Size() {
         if (_val->IsArray()) {
@@ -274,9 +439,298 @@ public:
     }
 
 private:
-    JsonDecoder():xdoc_type(NULL, ""),_doc(NULL),_val(NULL) {
+    JsonDecoder():xdoc_type(NULL, ""),_doc(NULL),_val(NULL),_doc_flag(0) {
+    }
+
+    template <class Stop>
+    void init_doc(const std::string& str, bool isfile, int docFlag, Stop &stop) {
+        std::string err = Parse(*_doc, str, isfile, docFlag, stop);
+        if (!err.empty()) {
+            delete _doc;
+            _doc = NULL;
+            throw std::runtime_error(err);
+        }
     }
 
+    // proxy document of a row of F(COL), members are decoded from the cells of their columns
+    class ColumnRow:private noncopyable {
+    public:
+        ColumnRow(JsonDecoder &row, const std::vector<std::string> &keys, const std::vector<std::string> &cols, const std::vector<size_t> &index):_row(row), _keys(keys), _cols(cols), _index(index), _i(0) {}
+
+        inline const char *Type() const {
+            return "json";
+        }
+
+        template <class T>
+        bool decode(const char *key, T &val, const Extend *ext) {
+            if (NULL == key) { // top level or inherit
+                return row(val, ext, 0);
+            }
+            size_t c = column(key);
+            if (c >= _row.Size()) {
+                if (Extend::Mandatory(ext)) {
+                    _row.decode_exception("mandatory key not found", key);
+                }
+                return false;
+            }
+            JsonDecoder cell;
+            _row.member(c, cell, ext);
+            if (cell._val->IsNull()) {
+                return false;
+            }
+            return cell.decode(NULL, val, ext);
+        }
+
+    private:
+        template <class T>
+        XPACK_IS_XPACK(T) row(T &val, const Extend *ext, int) {
+            val.__x_pack_decode(*this, val, ext);
+            return true;
+        }
+        template <class T>
+        XPACK_IS_XOUT(T) row(T &val, const Extend *ext, int) {
+            __x_pack_decode_out(*this, val, ext);
+            return true;
+        }
+        template <class T>
+        bool row(T &val, const Extend *ext, long) {
+            (void)val;
+            (void)ext;
+            return false;
+        }
+
+        // members come in declare order, so the index is resolved once per vector
+        size_t column(const char *key) {
+            size_t i = _i++;
+            if (i<_keys.size() && _keys[i]==key) {
+                return _index[i];
+            }
+            for (size_t c=0; c<_cols.size(); ++c) {
+                if (_cols[c] == key) {
+                    return c;
+                }
+            }
+            return (size_t)-1;
+        }
+
+        JsonDecoder &_row;
+        const std::vector<std::string> &_keys;
+        const std::vector<std::string> &_cols;
+        const std::vector<size_t> &_index;
+        size_t _i;
+    };
+
+    // the decoder of the document, which has the doc flag
+    JsonDecoder* top() {
+        JsonDecoder *top = this;
+        while (NULL != top->_parent) {
+            top = const_cast<JsonDecoder*>(top->_parent);
+        }
+        return top;
+    }
+
+    #ifdef X_PACK_SUPPORT_CXX0X
+    typedef std::pair<std::shared_ptr<void>, const void*> SharedObject; // object, x_type_tag
+
+    // $id table is kept by the top level decoder
+    std::map<int, SharedObject>& shared_objects() {
+        JsonDecoder *top = this->top();
+        if (NULL == top->_shared.get()) {
+            top->_shared.reset(new std::map<int, SharedObject>);
+        }
+        return *top->_shared;
+    }
+
+    // "$id" is an unknown member to the struct, so it's skipped
+    template <class T>
+    XPACK_IS_XPACK(T) shared_value(T &val, const Extend *ext, int) {
+        return this->decode(NULL, val, ext);
+    }
+    template <class T>
+    XPACK_IS_XOUT(T) shared_value(T &val, const Extend *ext, int) {
+        return this->decode(NULL, val, ext);
+    }
+    template <class T>
+    bool shared_value(T &val, const Extend *ext, long) {
+        return this->decode("$value", val, ext);
+    }
+    #endif
+
+    template <class T>
+    XPACK_IS_XPACK(T) columns(const char*key, std::vector<T> &val, const Extend *ext, int) {
+        return decode_rows(key, val, ext);
+    }
+    template <class T>
+    XPACK_IS_XOUT(T) columns(const char*key, std::vector<T> &val, const Extend *ext, int) {
+        return decode_rows(key, val, ext);
+    }
+    template <class T>
+    bool columns(const char*key, std::vector<T> &val, const Extend *ext, long) { // not a struct
+        return this->decode_vector(key, val, ext);
+    }
+    template <class T>
+    bool decode_rows(const char*key, std::vector<T> &val, const Extend *ext) {
+        bool isNull;
+        const rapidjson::Value *v = get_val(key, isNull);
+        if (NULL==v || !v->IsObject()) {
+            return this->decode_vector(key, val, ext);
+        }
+
+        JsonDecoder tmp, cols, rows, sub;
+        JsonDecoder *obj = this->find(key, &tmp, ext);
+        obj->member("cols", cols, NULL);
+        obj->member("rows", rows, NULL);
+        if (!cols || !rows) {
+            decode_exception("cols and rows not found", key);
+        }
+        std::vector<std::string> names(cols.Size());
+        for (size_t i=0; i<names.size(); ++i) {
+            cols.member(i, sub, NULL).decode(NULL, names[i], NULL);
+        }
+
+        std::vector<std::string> keys;
+        Members::Names<T>("json", keys);
+        std::vector<size_t> index(keys.size(), (size_t)-1);
+        for (size_t i=0; i<keys.size(); ++i) {
+            for (size_t c=0; c<names.size(); ++c) {
+                if (names[c] == keys[i]) {
+                    index[i] = c;
+                    break;
+                }
+            }
+        }
+
+        size_t s = rows.Size();
+        val.resize(s);
+        for (size_t i=0; i<s; ++i) {
+            ColumnRow row(rows.member(i, sub, NULL), keys, names, index);
+            row.decode(NULL, val[i], NULL);
+        }
+        return true;
+    }
+
+    #ifdef XPACK_SUPPORT_ZLIB
+    template <unsigned parseFlags>
+    static std::string parse_gzip(rapidjson::Document &doc, const std::string &file_name, int docFlag) {
+        GzipReadStream is(file_name);
+        if (!is.Good()) {
+            return "Open file["+file_name+"] fail.";
+        }
+        if (docFlag&X_PACK_DOC_FLAG_UTF8) { // the text is not kept, so validate while parsing
+            doc.ParseStream<parseFlags|rapidjson::kParseValidateEncodingFlag>(is);
+        } else {
+            doc.ParseStream<parseFlags>(is);
+        }
+        if (is.Error()) {
+            return "Parse json file \""+file_name+"\" fail. err=gzip data error";
+        } else if (doc.HasParseError()) {
+            return "Parse json file \""+file_name+"\" fail. err="+rapidjson::GetParseError_En(doc.GetParseError())+". offset="+Util::itoa(doc.GetErrorOffset());
+        }
+        return std::string();
+    }
+    #endif
+
+    static bool is_no_stop(const JsonNoStop&) {
+        return true;
+    }
+    template <class Stop>
+    static bool is_no_stop(const Stop&) {
+        return false;
+    }
+
+    // sax handler, forward events to rapidjson::Document and terminate the parse when stop say so.
+    // the top level object is closed with the members got so far, so the document is still complete.
+    template <class Stop>
+    class StopHandler {
+    public:
+        StopHandler(rapidjson::Document &doc, Stop &stop):_doc(doc), _stop(stop), _depth(0), _object(false), _members(0), _stopped(false) {}
+
+        bool Null() { _doc.Null(); return value(); }
+        bool Bool(bool b) { _doc.Bool(b); return value(); }
+        bool Int(int i) { _doc.Int(i); return value(); }
+        bool Uint(unsigned i) { _doc.Uint(i); return value(); }
+        bool Int64(int64_t i) { _doc.Int64(i); return value(); }
+        bool Uint64(uint64_t i) { _doc.Uint64(i); return value(); }
+        bool Double(double d) { _doc.Double(d); return value(); }
+        bool RawNumber(const char *str, rapidjson::SizeType length, bool copy) { _doc.RawNumber(str, length, copy); return value(); }
+        bool String(const char *str, rapidjson::SizeType length, bool copy) { _doc.String(str, length, copy); return value(); }
+        bool Key(const char *str, rapidjson::SizeType length, bool copy) {
+            if (_object && 1 == _depth) {
+                _key.assign(str, length);
+                ++_members;
+            }
+            return _doc.Key(str, length, copy);
+        }
+        bool StartObject() {
+            if (0 == _depth++) {
+                _object = true;
+            }
+            return _doc.StartObject();
+        }
+        bool EndObject(rapidjson::SizeType memberCount) {
+            --_depth;
+            _doc.EndObject(memberCount);
+            return value();
+        }
+        bool StartArray() {
+            ++_depth;
+            return _doc.StartArray();
+        }
+        bool EndArray(rapidjson::SizeType elementCount) {
+            --_depth;
+            _doc.EndArray(elementCount);
+            return value();
+        }
+
+        bool Stopped() const {
+            return _stopped;
+        }
+    private:
+        bool value() {
+            if (_object && 1 == _depth && _stop(_key.c_str())) {
+                _doc.EndObject(_members);
+                _stopped = true;
+                return false;
+            }
+            return true;
+        }
+
+        rapidjson::Document &_doc;
+        Stop &_stop;
+        int _depth;
+        bool _object;       // top level is object
+        rapidjson::SizeType _members;
+        std::string _key;   // current key of top level object
+        bool _stopped;
+    };
+
+    // generator for rapidjson::Document::Populate
+    template <class Stop, unsigned parseFlags>
+    struct StopGenerator {
+        const std::string &text;
+        Stop &stop;
+        rapidjson::ParseErrorCode code;
+        size_t offset;
+        size_t parsed; // bytes consumed by the parser
+
+        StopGenerator(const std::string &_text, Stop &_stop):text(_text), stop(_stop), code(rapidjson::kParseErrorNone), offset(0), parsed(0) {}
+
+        bool operator()(rapidjson::Document &doc) {
+            rapidjson::MemoryStream ms(text.data(), text.length());
+            rapidjson::EncodedInputStream<rapidjson::UTF8<>, rapidjson::MemoryStream> is(ms);
+            rapidjson::Reader reader;
+            StopHandler<Stop> handler(doc, stop);
+            rapidjson::ParseResult ret = reader.Parse<parseFlags>(is, handler);
+            parsed = is.Tell();
+            if (ret || handler.Stopped()) {
+                return true;
+            }
+            code = ret.Code();
+            offset = ret.Offset();
+            return false;
+        }
+    };
+
     JsonDecoder& member(size_t index, JsonDecoder&d, const Extend *ext) const {
         (void)ext;
         if (NULL != _val && _val->IsArray()) {
@@ -337,6 +791,10 @@ private:
 
     rapidjson::Document* _doc;
     const rapidjson::Value* _val;
+    int _doc_flag; // X_PACK_DOC_FLAG_xxx, only set in the top level decoder
+    #ifdef X_PACK_SUPPORT_CXX0X
+    std::unique_ptr<std::map<int, SharedObject> > _shared;
+    #endif
 };
 
 
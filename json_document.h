@@ -0,0 +1,122 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_JSON_DOCUMENT_H
+#define __X_PACK_JSON_DOCUMENT_H
+
+#include "json_data.h"
+
+namespace xpack {
+
+/*
+  Immutable parsed json document. Parse once, then decode subtrees from many threads at the same time:
+
+    xpack::JsonDocument doc(data);
+    // thread 1
+    doc["db"].decode(dbConfig);
+    // thread 2
+    doc["cache"].decode(cacheConfig);
+
+  Nothing is modified after the constructor, copies share the same parsed document.
+  Each decode uses its own JsonDecoder on the stack, so there is no shared decoder state.
+  Cursor is just a pointer into the document, it's valid as long as one JsonDocument sharing the parse alive.
+*/
+class JsonDocument {
+public:
+    class Cursor {
+        friend class JsonDocument;
+    public:
+        Cursor():_val(NULL) {}
+
+        // object member, invalid cursor if not object or key not exists
+        Cursor operator[](const char *key) const {
+            Cursor c;
+            if (NULL != _val && _val->IsObject()) {
+                rapidjson::Value::ConstMemberIterator iter = _val->FindMember(key);
+                if (iter != _val->MemberEnd()) {
+                    c._val = &iter->value;
+                }
+            }
+            return c;
+        }
+        // array element, invalid cursor if not array or out of index
+        Cursor operator[](size_t index) const {
+            Cursor c;
+            if (NULL != _val && _val->IsArray() && index < (size_t)_val->Size()) {
+                c._val = &(*_val)[(rapidjson::SizeType)index];
+            }
+            return c;
+        }
+        size_t Size() const {
+            if (NULL != _val && _val->IsArray()) {
+                return (size_t)_val->Size();
+            }
+            return 0;
+        }
+        operator bool() const {
+            return NULL != _val;
+        }
+
+        // return false if cursor is invalid or the value is null
+        template <class T>
+        bool decode(T &val) const {
+            if (NULL == _val) {
+                return false;
+            }
+            JsonDecoder d(_val);
+            return d.decode(NULL, val, NULL);
+        }
+    private:
+        const rapidjson::Value *_val;
+    };
+
+    JsonDocument(const std::string &str, bool isfile=false, int docFlag=0) {
+        rapidjson::Document *doc = new rapidjson::Document;
+        std::string err = JsonDecoder::Parse(*doc, str, isfile, docFlag);
+        if (!err.empty()) {
+            delete doc;
+            throw std::runtime_error(err);
+        }
+        _doc.reset(doc);
+    }
+
+    Cursor Root() const {
+        Cursor c;
+        c._val = _doc.get();
+        return c;
+    }
+    Cursor operator[](const char *key) const {
+        return Root()[key];
+    }
+    Cursor operator[](size_t index) const {
+        return Root()[index];
+    }
+    size_t Size() const {
+        return Root().Size();
+    }
+
+    template <class T>
+    bool decode(T &val) const {
+        return Root().decode(val);
+    }
+
+private:
+    x_shared_ptr<const rapidjson::Document> _doc;
+};
+
+}
+
+#endif
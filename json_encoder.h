@@ -18,47 +18,735 @@
 #define __X_PACK_JSON_ENCODER_H
 
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <new>
+#include <cstring>
+#include <cstdlib>
 
 #include "rapidjson_custom.h"
 #include "xrapidjson/prettywriter.h"
-#include "xrapidjson/stringbuffer.h"
 
 #include "xencoder.h"
+#include "sink.h"
+#include "utf8.h"
+#include "members.h"
+#include "ftoa.h"
 
 namespace xpack {
 
-class JsonEncoder:public XEncoder<JsonEncoder>, private noncopyable {
-    typedef rapidjson::StringBuffer JSON_WRITER_BUFFER;
-    typedef rapidjson::Writer<rapidjson::StringBuffer> JSON_WRITER_WRITER;
-    typedef rapidjson::PrettyWriter<rapidjson::StringBuffer> JSON_WRITER_PRETTY;
+/*
+  Output stream of JsonEncoder(rapidjson stream concept).
+  Without sink it grows like rapidjson::StringBuffer, the first allocation is delayed so
+  that Reserve(size hint) allocates once. With sink it's a fixed staging buffer, which is
+  handed to the sink when full, so memory is bounded whatever the output size.
+*/
+class JsonBuffer:private noncopyable {
 public:
-    friend class XEncoder<JsonEncoder>;
-    using xdoc_type::encode;
+    typedef char Ch;
+
+    JsonBuffer(Sink *sink=NULL):_sink(sink), _data(NULL), _size(0), _cap(0) {
+    }
+    ~JsonBuffer() {
+        if (NULL != _data) {
+            free(_data);
+            _data = NULL;
+        }
+    }
+
+    void Put(Ch c) {
+        if (_size == _cap) {
+            Reserve(1);
+        }
+        _data[_size++] = c;
+    }
+    // with sink Reserve doesn't guarantee the room(see Reserve), so it's checked here too
+    void PutUnsafe(Ch c) {
+        if (_size == _cap) {
+            Reserve(1);
+        }
+        _data[_size++] = c;
+    }
+    /*
+      make sure there is room for count bytes. with sink the staging buffer never grows beyond
+      STAGING, the room may be less than count then(rapidjson reserves 6 bytes per char for a string),
+      Put/PutUnsafe flush it when it's full
+    */
+    void Reserve(size_t count) {
+        if (_cap-_size >= count) {
+            return;
+        }
+        if (NULL != _sink) {
+            Flush();
+            if (_cap == 0) {
+                grow(STAGING);
+            }
+            return;
+        }
+        size_t cap = _cap*2;
+        if (cap < _size+count) {
+            cap = _size+count;
+        }
+        if (cap < 256U) {
+            cap = 256U;
+        }
+        grow(cap);
+    }
+    // append len bytes with one memcpy, with sink data longer than the staging buffer is written through
+    void Write(const Ch *data, size_t len) {
+        if (NULL!=_sink && _cap-_size<len) {
+            Flush();
+            if (len > STAGING) {
+                _sink->Write(data, len);
+                return;
+            }
+        }
+        Reserve(len);
+        memcpy(_data+_size, data, len);
+        _size += len;
+    }
+    void Flush() {
+        if (NULL != _sink && _size > 0) {
+            _sink->Write(_data, _size);
+            _size = 0;
+        }
+    }
+
+    const Ch* GetString() const {
+        return NULL!=_data?_data:"";
+    }
+    size_t GetSize() const {
+        return _size;
+    }
+    size_t GetCapacity() const {
+        return _cap;
+    }
+
+    void Swap(JsonBuffer &that) {
+        std::swap(_sink, that._sink);
+        std::swap(_data, that._data);
+        std::swap(_size, that._size);
+        std::swap(_cap, that._cap);
+    }
+
+private:
+    static const size_t STAGING = 4096; // size of the staging buffer with sink
+
+    void grow(size_t cap) {
+        Ch *data = (Ch*)realloc(_data, cap);
+        if (NULL == data) {
+            throw std::bad_alloc();
+        }
+        _data = data;
+        _cap = cap;
+    }
+
+    Sink *_sink;
+    Ch *_data;
+    size_t _size;
+    size_t _cap;
+};
+
+// found by ADL from rapidjson::Writer, replace the generic version which check capacity for every char
+inline void PutReserve(JsonBuffer &stream, size_t count) {
+    stream.Reserve(count);
+}
+inline void PutUnsafe(JsonBuffer &stream, char c) {
+    stream.PutUnsafe(c);
+}
 
-    JsonEncoder(int indentCount=-1, char indentChar=' ') {
-        _buf = new JSON_WRITER_BUFFER;
-        if (indentCount < 0) {
-            _writer = new JSON_WRITER_WRITER(*_buf);
-            _pretty = NULL;
+/*
+  Output stream over a fixed buffer of the caller, for heap-free encoding. It never grows,
+  bytes beyond the capacity are dropped and Overflow() becomes true, so the encoding
+  always runs to the end and the caller checks Overflow() once.
+  Reserve of rapidjson is pessimistic(6 bytes per char for string), so every write is checked.
+*/
+class JsonFixedBuffer:private noncopyable {
+public:
+    typedef char Ch;
+
+    JsonFixedBuffer(Ch *data, size_t cap):_data(data), _size(0), _cap(cap), _overflow(false) {
+    }
+
+    void Put(Ch c) {
+        if (_size < _cap) {
+            _data[_size++] = c;
         } else {
-            _pretty = new JSON_WRITER_PRETTY(*_buf);
-            _pretty->SetIndent(indentChar, indentCount);
-            _writer = NULL;
+            _overflow = true;
+        }
+    }
+    void PutUnsafe(Ch c) {
+        Put(c);
+    }
+    void Reserve(size_t count) {
+        (void)count;
+    }
+    void Write(const Ch *data, size_t len) {
+        if (_cap-_size >= len) {
+            memcpy(_data+_size, data, len);
+            _size += len;
+        } else {
+            _overflow = true;
+        }
+    }
+    void Flush() {
+    }
+
+    const Ch* GetString() const {
+        return _data;
+    }
+    size_t GetSize() const {
+        return _size;
+    }
+    size_t GetCapacity() const {
+        return _cap;
+    }
+    bool Overflow() const {
+        return _overflow;
+    }
+    // the output is incomplete for another reason(nesting too deep)
+    void SetOverflow() {
+        _overflow = true;
+    }
+
+private:
+    Ch *_data;
+    size_t _size;
+    size_t _cap;
+    bool _overflow;
+};
+
+inline void PutReserve(JsonFixedBuffer &stream, size_t count) {
+    (void)stream;
+    (void)count;
+}
+inline void PutUnsafe(JsonFixedBuffer &stream, char c) {
+    stream.Put(c);
+}
+
+/*
+  Output stream that only counts the bytes, for computing the encoded size without output.
+  The sink is ignored, it's accepted for the constructor of JsonWriterEncoder.
+*/
+class JsonCountBuffer:private noncopyable {
+public:
+    typedef char Ch;
+
+    JsonCountBuffer(Sink *sink=NULL):_size(0) {
+        (void)sink;
+    }
+
+    void Put(Ch c) {
+        (void)c;
+        ++_size;
+    }
+    void PutUnsafe(Ch c) {
+        (void)c;
+        ++_size;
+    }
+    void Reserve(size_t count) {
+        (void)count;
+    }
+    void Write(const Ch *data, size_t len) {
+        (void)data;
+        _size += len;
+    }
+    void Flush() {
+    }
+
+    const Ch* GetString() const {
+        return "";
+    }
+    size_t GetSize() const {
+        return _size;
+    }
+
+private:
+    size_t _size;
+};
+
+inline void PutReserve(JsonCountBuffer &stream, size_t count) {
+    (void)stream;
+    (void)count;
+}
+inline void PutUnsafe(JsonCountBuffer &stream, char c) {
+    stream.PutUnsafe(c);
+}
+
+/*
+  Stack allocator of rapidjson Writer in a fixed array, so JsonFixedBuffer encoding doesn't
+  allocate for the nesting levels either. Supports DEPTH levels of array/object, JsonFixedWriter
+  never goes deeper.
+*/
+class JsonFixedStack {
+public:
+    static const bool kNeedFree = false;
+    static const size_t DEPTH = 64;
+
+    void* Malloc(size_t size) {
+        return Realloc(NULL, 0, size);
+    }
+    void* Realloc(void *originalPtr, size_t originalSize, size_t newSize) {
+        (void)originalPtr;
+        (void)originalSize;
+        if (newSize > sizeof(_data)) {
+            throw std::runtime_error("json fixed encode: nesting too deep");
+        }
+        return _data;
+    }
+    static void Free(void *ptr) {
+        (void)ptr;
+    }
+private:
+    size_t _data[DEPTH*2]; // rapidjson Writer::Level is {size_t, bool}
+};
+
+// true if [str, str+len) has no character that must be escaped in json string
+inline bool JsonNoEscape(const char *str, size_t len) {
+    for (size_t i=0; i<len; ++i) {
+        unsigned char c = (unsigned char)str[i];
+        if (c < 0x20 || c == '"' || c == '\\') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+  Output segments that reference memory outside JsonBuffer, for json::encode_iov.
+  A referenced string is not copied, the output is buffer[0, off1) + ref1 + buffer[off1, off2) + ref2 ...
+*/
+struct JsonRefs {
+    struct Ref {
+        const char *data;
+        size_t len;
+        size_t off; // offset in JsonBuffer where it's inserted
+    };
+    std::vector<Ref> refs;
+};
+
+// Writer/PrettyWriter with RawKey, which writes a key that needs no escaping by memcpy, and RawJson
+template <class Base, class OS=JsonBuffer, class ALLOC=rapidjson::CrtAllocator>
+class JsonKeyWriter:public Base {
+public:
+    typedef OS buffer_type;
+
+    JsonKeyWriter(OS &os, ALLOC *alloc=NULL, size_t levelDepth=Base::kDefaultLevelDepth):Base(os, alloc, levelDepth) {}
+
+    // write a string that needs no escaping as a reference, the data is not copied
+    bool RefString(const char *str, size_t len, JsonRefs &refs) {
+        prefix((Base*)this, rapidjson::kStringType);
+        OS &os = *Base::os_;
+        os.Put('"');
+        JsonRefs::Ref r;
+        r.data = str;
+        r.len = len;
+        r.off = os.GetSize();
+        refs.refs.push_back(r);
+        os.Put('"');
+        return Base::EndValue(true);
+    }
+
+    bool RawKey(const char *key, size_t len) {
+        prefix((Base*)this, rapidjson::kStringType);
+        OS &os = *Base::os_;
+        os.Reserve(len+2);
+        PutUnsafe(os, '"');
+        os.Write(key, len);
+        PutUnsafe(os, '"');
+        return Base::EndValue(true);
+    }
+
+    // write an encoded json value as is
+    bool RawJson(const char *json, size_t len) {
+        prefix((Base*)this, rapidjson::kObjectType);
+        Base::os_->Write(json, len);
+        return Base::EndValue(true);
+    }
+
+    // shortest digits of float(0.1f is 0.1 instead of 0.10000000149011612), NaN/Inf as Double
+    bool Float(float f) {
+        if (rapidjson::internal::Double(f).IsNanOrInf()) {
+            return Base::Double(f);
+        }
+        prefix((Base*)this, rapidjson::kNumberType);
+        char buffer[32];
+        char *end = ftoa(f, buffer, Base::GetMaxDecimalPlaces());
+        Base::os_->Write(buffer, (size_t)(end-buffer));
+        return Base::EndValue(true);
+    }
+
+    // write bytes as a base64 string, encoded block by block into the buffer
+    bool Blob(const void *data, size_t len) {
+        prefix((Base*)this, rapidjson::kStringType);
+        OS &os = *Base::os_;
+        os.Put('"');
+        const char *p = (const char*)data;
+        char buf[4096];
+        while (len > 0) {
+            size_t n = len>3072?3072:len;
+            os.Write(buf, Base64::Encode(p, n, buf));
+            p += n;
+            len -= n;
+        }
+        os.Put('"');
+        return Base::EndValue(true);
+    }
+private:
+    template <class S, class SE, class TE, class SA, unsigned F>
+    void prefix(rapidjson::Writer<S, SE, TE, SA, F> *, rapidjson::Type type) {
+        Base::Prefix(type);
+    }
+    template <class S, class SE, class TE, class SA, unsigned F>
+    void prefix(rapidjson::PrettyWriter<S, SE, TE, SA, F> *, rapidjson::Type type) {
+        Base::PrettyPrefix(type);
+    }
+};
+
+/*
+  Pre-escaped keys. Keys from XPACK are string literals or names of a static Alias(json alias
+  already resolved), XPACK marks them by Extend::key, so the pointer is stable. The length and
+  whether it needs escaping are computed once per pointer in an encoder, after that writing
+  a key is one memcpy, e.g. for vector<Struct> the keys are scanned only for the first element.
+  Other keys(map, JsonData, manual add...) are not cached.
+*/
+class JsonKeyCache:private noncopyable {
+public:
+    JsonKeyCache() {
+        memset(_slots, 0, sizeof(_slots));
+    }
+
+    // return false if key needs escaping
+    bool Get(const char *key, size_t &len) {
+        Slot &s = _slots[((size_t)key>>3)%SLOTS];
+        if (s.key != key) {
+            s.key = key;
+            s.len = raw_len(key);
+        }
+        len = s.len;
+        return len != NEED_ESCAPE;
+    }
+
+    // length of key, or NEED_ESCAPE
+    static size_t raw_len(const char *key) {
+        size_t i = 0;
+        for (; key[i] != '\0'; ++i) {
+            unsigned char c = (unsigned char)key[i];
+            if (c < 0x20 || c == '"' || c == '\\') {
+                return NEED_ESCAPE;
+            }
+        }
+        return i;
+    }
+private:
+    static const size_t SLOTS = 64;
+    static const size_t NEED_ESCAPE = (size_t)-1;
+
+    struct Slot {
+        const char *key;
+        size_t len;
+    };
+    Slot _slots[SLOTS];
+};
+
+/*
+  Writer policy of JsonWriterEncoder. A policy is constructed by (buffer_type&, indentCount, indentChar),
+  provides the rapidjson Writer handlers used by the encoder plus RawKey and SingleLine.
+  buffer_type is JsonBuffer, JsonFixedBuffer for the heap-free writers, or JsonCountBuffer for the size-only writers.
+  JsonCompactWriter and JsonPrettyWriter are resolved at compile time, the encoder stores it by value.
+*/
+template <class OS, class ALLOC=rapidjson::CrtAllocator>
+class JsonBasicCompactWriter:public JsonKeyWriter<rapidjson::Writer<OS, rapidjson::UTF8<>, rapidjson::UTF8<>, ALLOC>, OS, ALLOC> {
+    typedef JsonKeyWriter<rapidjson::Writer<OS, rapidjson::UTF8<>, rapidjson::UTF8<>, ALLOC>, OS, ALLOC> base_type;
+public:
+    JsonBasicCompactWriter(OS &os, int indentCount, char indentChar, ALLOC *alloc=NULL, size_t levelDepth=base_type::kDefaultLevelDepth):base_type(os, alloc, levelDepth) {
+        (void)indentCount;
+        (void)indentChar;
+    }
+    void SingleLine(bool on) {
+        (void)on;
+    }
+};
+
+template <class OS, class ALLOC=rapidjson::CrtAllocator>
+class JsonBasicPrettyWriter:public JsonKeyWriter<rapidjson::PrettyWriter<OS, rapidjson::UTF8<>, rapidjson::UTF8<>, ALLOC>, OS, ALLOC> {
+    typedef JsonKeyWriter<rapidjson::PrettyWriter<OS, rapidjson::UTF8<>, rapidjson::UTF8<>, ALLOC>, OS, ALLOC> base_type;
+public:
+    JsonBasicPrettyWriter(OS &os, int indentCount, char indentChar, ALLOC *alloc=NULL, size_t levelDepth=base_type::kDefaultLevelDepth):base_type(os, alloc, levelDepth) {
+        if (indentCount >= 0) { // default is 4 spaces
+            this->SetIndent(indentChar, (unsigned)indentCount);
+        }
+    }
+    void SingleLine(bool on) {
+        this->SetFormatOptions(on?rapidjson::kFormatSingleLineArray:rapidjson::kFormatDefault);
+    }
+};
+
+class JsonCompactWriter:public JsonBasicCompactWriter<JsonBuffer> {
+public:
+    JsonCompactWriter(JsonBuffer &os, int indentCount, char indentChar):JsonBasicCompactWriter<JsonBuffer>(os, indentCount, indentChar) {}
+};
+
+class JsonPrettyWriter:public JsonBasicPrettyWriter<JsonBuffer> {
+public:
+    JsonPrettyWriter(JsonBuffer &os, int indentCount, char indentChar):JsonBasicPrettyWriter<JsonBuffer>(os, indentCount, indentChar) {}
+};
+
+/*
+  Write to a fixed buffer without heap allocation. An array/object deeper than JsonFixedStack::DEPTH
+  is written as null and everything in it is dropped, the buffer is marked overflow, so encode_fixed
+  returns false instead of running out of the fixed stack.
+*/
+template <class Base>
+class JsonFixedWriter:private JsonFixedStack, public Base {
+public:
+    JsonFixedWriter(JsonFixedBuffer &os, int indentCount, char indentChar):Base(os, indentCount, indentChar, this, JsonFixedStack::DEPTH), _os(os), _depth(0) {}
+
+    bool StartObject() {
+        return start()?Base::StartObject():true;
+    }
+    bool EndObject() {
+        return end()?Base::EndObject():true;
+    }
+    bool StartArray() {
+        return start()?Base::StartArray():true;
+    }
+    bool EndArray() {
+        return end()?Base::EndArray():true;
+    }
+
+    #define X_PACK_JSON_FIXED_WRITE(f, args, vals) \
+        bool f args {                             \
+            return _depth>DEPTH || Base::f vals;  \
+        }
+    X_PACK_JSON_FIXED_WRITE(Null, (), ())
+    X_PACK_JSON_FIXED_WRITE(Bool, (bool b), (b))
+    X_PACK_JSON_FIXED_WRITE(Int, (int i), (i))
+    X_PACK_JSON_FIXED_WRITE(Uint, (unsigned u), (u))
+    X_PACK_JSON_FIXED_WRITE(Int64, (int64_t i), (i))
+    X_PACK_JSON_FIXED_WRITE(Uint64, (uint64_t u), (u))
+    X_PACK_JSON_FIXED_WRITE(Float, (float f), (f))
+    X_PACK_JSON_FIXED_WRITE(Double, (double d), (d))
+    X_PACK_JSON_FIXED_WRITE(String, (const char *str, rapidjson::SizeType len), (str, len))
+    X_PACK_JSON_FIXED_WRITE(Key, (const char *str), (str))
+    X_PACK_JSON_FIXED_WRITE(RawKey, (const char *key, size_t len), (key, len))
+    X_PACK_JSON_FIXED_WRITE(RawJson, (const char *json, size_t len), (json, len))
+    X_PACK_JSON_FIXED_WRITE(Blob, (const void *data, size_t len), (data, len))
+    X_PACK_JSON_FIXED_WRITE(RefString, (const char *str, size_t len, JsonRefs &refs), (str, len, refs))
+    #undef X_PACK_JSON_FIXED_WRITE
+
+private:
+    // false if the level is not written
+    bool start() {
+        if (_depth++ < DEPTH) {
+            return true;
+        } else if (_depth == DEPTH+1) { // keeps the parent level valid
+            _os.SetOverflow();
+            Base::Null();
         }
+        return false;
+    }
+    bool end() {
+        return _depth-- <= DEPTH;
     }
-    ~JsonEncoder() {
-        if (NULL != _buf) {
-            delete _buf;
-            _buf = NULL;
+
+    JsonFixedBuffer &_os;
+    size_t _depth;
+};
+
+class JsonFixedCompactWriter:public JsonFixedWriter<JsonBasicCompactWriter<JsonFixedBuffer, xpack::JsonFixedStack> > {
+public:
+    JsonFixedCompactWriter(JsonFixedBuffer &os, int indentCount, char indentChar):JsonFixedWriter<JsonBasicCompactWriter<JsonFixedBuffer, xpack::JsonFixedStack> >(os, indentCount, indentChar) {}
+};
+
+class JsonFixedPrettyWriter:public JsonFixedWriter<JsonBasicPrettyWriter<JsonFixedBuffer, xpack::JsonFixedStack> > {
+public:
+    JsonFixedPrettyWriter(JsonFixedBuffer &os, int indentCount, char indentChar):JsonFixedWriter<JsonBasicPrettyWriter<JsonFixedBuffer, xpack::JsonFixedStack> >(os, indentCount, indentChar) {}
+};
+
+// count the output only, see json::encoded_size
+typedef JsonBasicCompactWriter<JsonCountBuffer> JsonCountCompactWriter;
+typedef JsonBasicPrettyWriter<JsonCountBuffer> JsonCountPrettyWriter;
+
+// select compact(indentCount<0) or pretty at runtime, for JsonEncoder
+class JsonAnyWriter:private noncopyable {
+public:
+    typedef JsonBuffer buffer_type;
+
+    JsonAnyWriter(JsonBuffer &os, int indentCount, char indentChar):_compact(os, indentCount, indentChar), _pretty(os, indentCount, indentChar), _is_pretty(indentCount>=0) {}
+
+    #define X_PACK_JSON_ANY_WRITER(f, ARGS, ...) \
+        bool f ARGS {                            \
+            if (!_is_pretty) {                   \
+                return _compact.f(__VA_ARGS__);  \
+            } else {                             \
+                return _pretty.f(__VA_ARGS__);   \
+            }                                    \
+        }
+    X_PACK_JSON_ANY_WRITER(StartArray, ())
+    X_PACK_JSON_ANY_WRITER(EndArray, ())
+    X_PACK_JSON_ANY_WRITER(StartObject, ())
+    X_PACK_JSON_ANY_WRITER(EndObject, ())
+    X_PACK_JSON_ANY_WRITER(Null, ())
+    X_PACK_JSON_ANY_WRITER(Bool, (bool b), b)
+    X_PACK_JSON_ANY_WRITER(Int, (int i), i)
+    X_PACK_JSON_ANY_WRITER(Uint, (unsigned u), u)
+    X_PACK_JSON_ANY_WRITER(Int64, (int64_t i), i)
+    X_PACK_JSON_ANY_WRITER(Uint64, (uint64_t u), u)
+    X_PACK_JSON_ANY_WRITER(Double, (double d), d)
+    X_PACK_JSON_ANY_WRITER(Float, (float f), f)
+    X_PACK_JSON_ANY_WRITER(String, (const char *str, rapidjson::SizeType length), str, length)
+    X_PACK_JSON_ANY_WRITER(Key, (const char *str), str)
+    X_PACK_JSON_ANY_WRITER(RawKey, (const char *key, size_t len), key, len)
+    X_PACK_JSON_ANY_WRITER(RefString, (const char *str, size_t len, JsonRefs &refs), str, len, refs)
+    X_PACK_JSON_ANY_WRITER(RawJson, (const char *json, size_t len), json, len)
+    X_PACK_JSON_ANY_WRITER(Blob, (const void *data, size_t len), data, len)
+    #undef X_PACK_JSON_ANY_WRITER
+
+    void SingleLine(bool on) {
+        if (_is_pretty) {
+            _pretty.SingleLine(on);
         }
-        if (NULL != _writer) {
-            delete _writer;
-            _writer = NULL;
+    }
+    void SetMaxDecimalPlaces(int maxDecimalPlaces) {
+        _compact.SetMaxDecimalPlaces(maxDecimalPlaces);
+        _pretty.SetMaxDecimalPlaces(maxDecimalPlaces);
+    }
+private:
+    JsonCompactWriter _compact;
+    JsonPrettyWriter _pretty;
+    bool _is_pretty;
+};
+
+/*
+  F(COL) for the json encoders. The row is a proxy document, every member is written as a cell
+  of the row array in declare order. Empty members are written too(OE ignored), so the cells match the columns.
+*/
+template <class DOC>
+class JsonColumnRow:private noncopyable {
+public:
+    // vector of struct as {"cols":["id","name"],"rows":[[1,"a"],[2,"b"]]}, others as a list
+    template <class T>
+    static bool Encode(DOC &doc, const char*key, const std::vector<T> &val, const Extend *ext) {
+        return columns(doc, key, val, ext, 0);
+    }
+
+    JsonColumnRow(DOC &doc):_doc(doc) {}
+
+    inline const char *Type() const {
+        return _doc.Type();
+    }
+
+    template <class T>
+    bool encode(const char *key, const T &val, const Extend *ext) {
+        if (NULL == key) { // top level or inherit
+            return row(val, ext, 0);
+        }
+        Extend cell(ext);
+        cell.flag &= ~X_PACK_FLAG_OE;
+        cell.key = NULL;
+        if (!_doc.encode(NULL, val, &cell)) {
+            _doc.writeNull(NULL, &cell);
+        }
+        return true;
+    }
+
+private:
+    template <class T>
+    XPACK_IS_XPACK(T) row(const T &val, const Extend *ext, int) {
+        val.__x_pack_encode(*this, val, ext);
+        return true;
+    }
+    template <class T>
+    XPACK_IS_XOUT(T) row(const T &val, const Extend *ext, int) {
+        __x_pack_encode_out(*this, val, ext);
+        return true;
+    }
+    template <class T>
+    bool row(const T &val, const Extend *ext, long) {
+        (void)val;
+        (void)ext;
+        return false;
+    }
+
+    template <class T>
+    static XPACK_IS_XPACK(T) columns(DOC &doc, const char*key, const std::vector<T> &val, const Extend *ext, int) {
+        return rows(doc, key, val, ext);
+    }
+    template <class T>
+    static XPACK_IS_XOUT(T) columns(DOC &doc, const char*key, const std::vector<T> &val, const Extend *ext, int) {
+        return rows(doc, key, val, ext);
+    }
+    template <class T>
+    static bool columns(DOC &doc, const char*key, const std::vector<T> &val, const Extend *ext, long) { // not a struct
+        return doc.template encode_list<std::vector<T> >(key, val, ext);
+    }
+    template <class T>
+    static bool rows(DOC &doc, const char*key, const std::vector<T> &val, const Extend *ext) {
+        if (val.empty()) {
+            if (Extend::OmitEmpty(ext)) {
+                return false;
+            } else if (Extend::EmptyNull(ext)) {
+                return doc.writeNull(key, ext);
+            }
+        }
+
+        Extend line(X_PACK_FLAG_SL, NULL); // one row per line in pretty mode
+
+        doc.ObjectBegin(key, ext);
+        doc.ArrayBegin("cols", &line);
+        Cols cols(doc);
+        T t;
+        MemberWalker<Cols>::Walk(cols, t);
+        doc.ArrayEnd("cols", &line);
+        doc.ArrayBegin("rows", NULL);
+        JsonColumnRow row(doc);
+        for (size_t i=0; i<val.size(); ++i) {
+            doc.ArrayBegin(NULL, &line);
+            row.encode(NULL, val[i], NULL);
+            doc.ArrayEnd(NULL, &line);
+        }
+        doc.ArrayEnd("rows", NULL);
+        doc.ObjectEnd(key, ext);
+        return true;
+    }
+
+    // writes the names of the columns as they are walked, nothing is allocated(encode_fixed)
+    class Cols:private noncopyable {
+    public:
+        Cols(DOC &doc):_doc(doc) {}
+
+        inline const char *Type() const {
+            return _doc.Type();
         }
-        if (NULL != _pretty) {
-            delete _pretty;
-            _pretty = NULL;
+        template <class T>
+        void member(const char *key, T &val, const Extend *ext) {
+            (void)val;
+            (void)ext;
+            _doc.encode(NULL, key, strlen(key), NULL);
         }
+    private:
+        DOC &_doc;
+    };
+
+    DOC &_doc;
+};
+
+template <class WRITER>
+class JsonWriterEncoder:public XEncoder<JsonWriterEncoder<WRITER> >, private noncopyable {
+public:
+    friend class XEncoder<JsonWriterEncoder>;
+    using XEncoder<JsonWriterEncoder>::encode;
+
+    typedef typename WRITER::buffer_type buffer_type;
+
+    // if sink is not NULL, output is written to sink instead of kept in memory, call Flush at the end
+    JsonWriterEncoder(int indentCount=-1, char indentChar=' ', Sink *sink=NULL):_buf(sink), _writer(_buf, indentCount, indentChar), _doc_flag(0), _refs(NULL), _ref_min(0) {
+    }
+    // for JsonFixedBuffer, write to [data, data+cap). check Overflow after encoding
+    JsonWriterEncoder(char *data, size_t cap, int indentCount=-1, char indentChar=' '):_buf(data, cap), _writer(_buf, indentCount, indentChar), _doc_flag(0), _refs(NULL), _ref_min(0) {
     }
 
     inline const char *Type() const {
@@ -74,59 +762,78 @@ public:
     }
 
     std::string String() {
-        return _buf->GetString();
+        return std::string(_buf.GetString(), _buf.GetSize());
+    }
+
+    void Flush() {
+        _buf.Flush();
+    }
+
+    // reserve output buffer, avoid growing if the size is known
+    void Reserve(size_t size) {
+        _buf.Reserve(size);
+    }
+    // bytes encoded so far(without sink)
+    size_t Size() const {
+        return _buf.GetSize();
+    }
+    // for JsonFixedBuffer, true if the output doesn't fit in the buffer
+    bool Overflow() const {
+        return _buf.Overflow();
     }
 
     void SetMaxDecimalPlaces(int maxDecimalPlaces) {
-        if (NULL != _writer) {
-            _writer->SetMaxDecimalPlaces(maxDecimalPlaces);
-        } else {
-            _pretty->SetMaxDecimalPlaces(maxDecimalPlaces);
-        }
+        _writer.SetMaxDecimalPlaces(maxDecimalPlaces);
+    }
+    int MaxDecimalPlaces() const {
+        return _writer.GetMaxDecimalPlaces();
+    }
+
+    // X_PACK_DOC_FLAG_xxx
+    void SetDocFlag(int docFlag) {
+        _doc_flag = docFlag;
+    }
+    int DocFlag() const {
+        return _doc_flag;
+    }
+
+    /*
+      std::string/char array members flagged with F(REF), not shorter than refMin and need no escaping,
+      are recorded in refs instead of copied(see json::encode_iov). strings that are not the member
+      itself(converted by xtype or custom encode, names of F(COL)...) are still copied.
+    */
+    void SetRefs(JsonRefs *refs, size_t refMin) {
+        _refs = refs;
+        _ref_min = refMin;
+    }
+
+    buffer_type& Buffer() {
+        return _buf;
     }
 
 public:
     void ArrayBegin(const char *key, const Extend *ext) {
-        (void)ext;
-        xpack_set_key(key);
-        if (NULL != _writer) {
-            _writer->StartArray();
-        } else {
-            if (Extend::Flag(ext) & X_PACK_FLAG_SL) {
-                _pretty->SetFormatOptions(rapidjson::kFormatSingleLineArray);
-            }
-            _pretty->StartArray();
+        xpack_set_key(key, ext);
+        _writer.StartArray(); // the array itself starts in a new line if it's in an array
+        if (Extend::Flag(ext) & X_PACK_FLAG_SL) {
+            _writer.SingleLine(true);
         }
     }
     void ArrayEnd(const char *key, const Extend *ext) {
         (void)key;
-        (void)ext;
-        if (NULL != _writer) {
-            _writer->EndArray();
-        } else {
-            _pretty->EndArray();
-            if (Extend::Flag(ext) & X_PACK_FLAG_SL) {
-                _pretty->SetFormatOptions(rapidjson::kFormatDefault);
-            }
+        _writer.EndArray();
+        if (Extend::Flag(ext) & X_PACK_FLAG_SL) {
+            _writer.SingleLine(false);
         }
     }
     void ObjectBegin(const char *key, const Extend *ext) {
-        (void)ext;
-        xpack_set_key(key);
-        if (NULL != _writer) {
-            _writer->StartObject();
-        } else {
-            _pretty->StartObject();
-        }
+        xpack_set_key(key, ext);
+        _writer.StartObject();
     }
     void ObjectEnd(const char *key, const Extend *ext) {
         (void)key;
         (void)ext;
-        if (NULL != _writer) {
-            _writer->EndObject();
-        } else {
-            _pretty->EndObject();
-        }
+        _writer.EndObject();
     }
 
 public:
@@ -138,12 +845,8 @@ public:
                 return writeNull(key, ext); \
             }                            \
         }                                \
-        xpack_set_key(key);              \
-        if (NULL != _writer) {           \
-            _writer->f(__VA_ARGS__);     \
-        } else {                         \
-            _pretty->f(__VA_ARGS__);     \
-        }                                \
+        xpack_set_key(key, ext);         \
+        _writer.f(__VA_ARGS__);          \
         return true
 
 	#define X_PACK_JSON_ENCODE(cond, f) X_PACK_JSON_ENCODE_ARG(cond, f, val)
@@ -152,16 +855,36 @@ public:
         if (Extend::OmitEmpty(ext)) {
             return false;
         }
-        xpack_set_key(key);
-        if (NULL != _writer) {
-            _writer->Null();
-        } else {
-            _pretty->Null();
-        }
+        xpack_set_key(key, ext);
+        _writer.Null();
+        return true;
+    }
+    // json is a complete encoded value, e.g. a cached fragment. it's copied without check
+    bool writeRaw(const char*key, const char *json, size_t len, const Extend *ext) {
+        xpack_set_key(key, ext);
+        _writer.RawJson(json, len);
+        return true;
+    }
+    bool encode_blob(const char*key, const void *data, size_t len, const Extend *ext) {
+        xpack_set_key(key, ext);
+        _writer.Blob(data, len);
         return true;
     }
+    // F(COL), vector of struct as {"cols":["id","name"],"rows":[[1,"a"],[2,"b"]]}, keys are written once
+    template <class T>
+    bool encode_columns(const char*key, const std::vector<T> &val, const Extend *ext) {
+        return JsonColumnRow<JsonWriterEncoder>::Encode(*this, key, val, ext);
+    }
     bool encode(const char*key, const std::string &val, const Extend *ext) {
-        X_PACK_JSON_ENCODE_ARG(val.empty(), String, val.data(), val.length());
+        return encode_string(key, val.data(), val.length(), &val, ext);
+    }
+    // char array, written in place instead of converted to std::string
+    bool encode(const char*key, const char *val, size_t N, const Extend *ext) {
+        size_t len = 0;
+        while (len<N && val[len]!='\0') {
+            ++len;
+        }
+        return encode_string(key, val, len, val, ext);
     }
     bool encode(const char*key, const bool &val, const Extend *ext) {
         X_PACK_JSON_ENCODE(!val, Bool);
@@ -200,7 +923,7 @@ public:
         return this->encode(key, (const unsigned long long&)val, ext);
     }
     bool encode(const char*key, const float & val, const Extend *ext) {
-        X_PACK_JSON_ENCODE(val==0, Double);
+        X_PACK_JSON_ENCODE(val==0, Float);
     }
     bool encode(const char*key, const double & val, const Extend *ext) {
         X_PACK_JSON_ENCODE(val==0, Double);
@@ -212,39 +935,124 @@ public:
     // map<int, T> xml not support use number as label
     template <class K, class T>
     typename x_enable_if<numeric<K>::is_integer, bool>::type encode(const char*key, const std::map<K,T>& val, const Extend *ext) {
-        return encode_map<const std::map<K,T>, K>(key, val, ext, Util::itoa);
+        return this->template encode_map<const std::map<K,T>, K>(key, val, ext, Util::itoa);
     }
 
     #ifdef X_PACK_SUPPORT_CXX0X
     // enum is_enum implementation is too complicated, so not support in c++03
     template <class K, class T>
     typename x_enable_if<std::is_enum<K>::value, bool>::type  encode(const char*key, const std::map<K,T>& val, const Extend *ext) {
-        return encode_map<const std::map<K,T>, K>(key, val, ext, Util::itoa);
+        return this->template encode_map<const std::map<K,T>, K>(key, val, ext, Util::itoa);
     }
     #endif
 
     #ifdef XPACK_SUPPORT_QT
     template <class K, class T>
     typename x_enable_if<numeric<K>::is_integer, bool>::type encode(const char*key, const QMap<K,T>& val, const Extend *ext) {
-        return encode_qmap<const QMap<K,T>, K>(key, val, ext, Util::itoa);
+        return this->template encode_qmap<const QMap<K,T>, K>(key, val, ext, Util::itoa);
+    }
+    #endif
+
+    #ifdef X_PACK_SUPPORT_CXX0X
+    /*
+      X_PACK_DOC_FLAG_REF: the first time an object is met it's written as {"$id":1,...members}
+      ({"$id":1,"$value":v} if it's not a struct), after that as {"$ref":1}.
+      objects are identified by address and type, so a DAG is written without duplication
+    */
+    template <class T>
+    bool encode(const char*key, const std::shared_ptr<T>& val, const Extend *ext) {
+        if (0==(_doc_flag&X_PACK_DOC_FLAG_REF) || NULL==val.get()) {
+            return XEncoder<JsonWriterEncoder>::encode(key, val, ext);
+        }
+
+        std::pair<const void*, const void*> id((const void*)val.get(), (const void*)&x_type_tag<T>::value);
+        typename std::map<std::pair<const void*, const void*>, int>::iterator iter = _shared.find(id);
+        ObjectBegin(key, ext);
+        if (iter != _shared.end()) {
+            this->encode("$ref", iter->second, NULL);
+        } else {
+            int n = (int)_shared.size()+1;
+            _shared[id] = n;
+            this->encode("$id", n, NULL);
+            Extend vext(Extend::Flag(ext), NULL);
+            shared_value(*val, &vext, 0);
+        }
+        ObjectEnd(key, ext);
+        return true;
     }
     #endif
 private:
-    void xpack_set_key(const char*key) { // openssl defined set_key macro, so we named it xpack_set_key
+    #ifdef X_PACK_SUPPORT_CXX0X
+    // members of a struct are written after "$id"
+    template <class T>
+    XPACK_IS_XPACK(T) shared_value(const T &val, Extend *ext, int) {
+        ext->ctrl_flag |= X_PACK_CTRL_FLAG_INHERIT;
+        return this->encode(NULL, val, ext);
+    }
+    template <class T>
+    XPACK_IS_XOUT(T) shared_value(const T &val, Extend *ext, int) {
+        ext->ctrl_flag |= X_PACK_CTRL_FLAG_INHERIT;
+        return this->encode(NULL, val, ext);
+    }
+    template <class T>
+    bool shared_value(const T &val, Extend *ext, long) {
+        return this->encode("$value", val, ext);
+    }
+    #endif
+
+    // obj is the address of the string object, only the member itself can be referenced
+    bool encode_string(const char*key, const char *val, size_t len, const void *obj, const Extend *ext) {
+        if ((_doc_flag&X_PACK_DOC_FLAG_UTF8) && !Utf8::Valid(val, len)) {
+            throw std::runtime_error(std::string("Invalid utf-8 string. key=")+(NULL!=key?key:""));
+        }
+        if (NULL!=_refs && len>=_ref_min && Extend::Ref(ext, obj) && JsonNoEscape(val, len)) {
+            xpack_set_key(key, ext);
+            _writer.RefString(val, len, *_refs);
+            return true;
+        }
+        X_PACK_JSON_ENCODE_ARG(len==0, String, val, (rapidjson::SizeType)len);
+    }
+
+    void xpack_set_key(const char*key, const Extend *ext) { // openssl defined set_key macro, so we named it xpack_set_key
         if (NULL!=key && key[0]!='\0') {
-            if (NULL != _writer) {
-                _writer->Key(key);
+            size_t len;
+            if (NULL != ext && ext->key == key && _keys.Get(key, len)) {
+                _writer.RawKey(key, len);
             } else {
-                _pretty->Key(key);
+                _writer.Key(key);
             }
         }
     }
 
-    JSON_WRITER_BUFFER* _buf;
-    JSON_WRITER_WRITER* _writer;
-    JSON_WRITER_PRETTY* _pretty;
+    buffer_type _buf;
+    WRITER _writer;
+    JsonKeyCache _keys;
+
+    int _doc_flag;
+
+    JsonRefs *_refs;
+    size_t _ref_min;
+
+    #ifdef X_PACK_SUPPORT_CXX0X
+    std::map<std::pair<const void*, const void*>, int> _shared; // (address, type) -> $id
+    #endif
 };
 
+// branch free encoders, xpack::json::encode selects one of them
+typedef JsonWriterEncoder<JsonCompactWriter> JsonCompactEncoder;
+typedef JsonWriterEncoder<JsonPrettyWriter> JsonPrettyEncoder;
+
+// compact or pretty selected by indentCount at runtime, compatible with old versions
+typedef JsonWriterEncoder<JsonAnyWriter> JsonEncoder;
+
+// heap-free encoders over a fixed buffer, see json::encode_fixed
+typedef JsonWriterEncoder<JsonFixedCompactWriter> JsonFixedCompactEncoder;
+typedef JsonWriterEncoder<JsonFixedPrettyWriter> JsonFixedPrettyEncoder;
+
+// size-only encoders, Size() is the exact length of the output
+typedef JsonWriterEncoder<JsonCountCompactWriter> JsonCountCompactEncoder;
+typedef JsonWriterEncoder<JsonCountPrettyWriter> JsonCountPrettyEncoder;
+
 }
 
 #endif
@@ -0,0 +1,104 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_JSON_IOV_H
+#define __X_PACK_JSON_IOV_H
+
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+namespace xpack {
+struct x_iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+}
+#else
+#include <sys/uio.h>
+namespace xpack {
+typedef struct iovec x_iovec;
+}
+#endif
+
+#include "json_encoder.h"
+
+namespace xpack {
+
+/*
+  Result of json::encode_iov, a list of iovec that can be passed to writev/sendmsg directly.
+  Structural text and small strings are in an internal buffer, large std::string members flagged
+  with F(REF) that need no escaping point to the memory of the encoded object, so the object must not be changed or freed
+  before the iovec is used.
+*/
+class JsonIov:private noncopyable {
+    friend class json;
+public:
+    const x_iovec* Data() const {
+        return _iov.empty()?NULL:&_iov[0];
+    }
+    // number of iovec
+    size_t Count() const {
+        return _iov.size();
+    }
+    // total bytes
+    size_t Size() const {
+        size_t n = 0;
+        for (size_t i=0; i<_iov.size(); ++i) {
+            n += _iov[i].iov_len;
+        }
+        return n;
+    }
+    // joined output, for debug
+    std::string String() const {
+        std::string s;
+        s.reserve(Size());
+        for (size_t i=0; i<_iov.size(); ++i) {
+            s.append((const char*)_iov[i].iov_base, _iov[i].iov_len);
+        }
+        return s;
+    }
+
+private:
+    void build() {
+        _iov.clear();
+        const char *buf = _buf.GetString();
+        size_t off = 0;
+        for (size_t i=0; i<_refs.refs.size(); ++i) {
+            const JsonRefs::Ref &r = _refs.refs[i];
+            add(buf+off, r.off-off);
+            add(r.data, r.len);
+            off = r.off;
+        }
+        add(buf+off, _buf.GetSize()-off);
+    }
+    void add(const char *data, size_t len) {
+        if (len > 0) {
+            x_iovec v;
+            v.iov_base = (void*)data;
+            v.iov_len = len;
+            _iov.push_back(v);
+        }
+    }
+
+    JsonBuffer _buf;
+    JsonRefs _refs;
+    std::vector<x_iovec> _iov;
+};
+
+}
+
+#endif
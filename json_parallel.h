@@ -0,0 +1,120 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_JSON_PARALLEL_H
+#define __X_PACK_JSON_PARALLEL_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <exception>
+
+#include "json_encoder.h"
+
+namespace xpack {
+
+/*
+  Encode a large array with several threads. The elements are split into ranges, each thread
+  encodes its range as an array, then the brackets are stripped and the ranges are joined by ','.
+  Elements of an array are encoded without Extend(the caller handles a vector with flags in one
+  thread, see json::encode_parallel), and the writer of each range starts at the
+  same level(the outer array), so the result is byte-identical to the single thread one,
+  including indentation of pretty json.
+*/
+class JsonParallel {
+public:
+    // LIST need random access, threads<=0 means hardware concurrency
+    template <class ENCODER, class LIST>
+    static std::string Encode(const LIST &val, int threads, int indentCount, char indentChar, int docFlag) {
+        size_t n = threads>0?(size_t)threads:(size_t)std::thread::hardware_concurrency();
+        if (n*MIN_RANGE > val.size()) {
+            n = val.size()/MIN_RANGE;
+        }
+        if (n < 1) {
+            n = 1;
+        }
+
+        std::vector<std::string> parts(n);
+        std::vector<std::exception_ptr> errs(n);
+        std::vector<std::thread> ths;
+        for (size_t i=0; i<n; ++i) { // n<=size/MIN_RANGE, so every range has elements
+            size_t begin = val.size()*i/n;
+            size_t end = val.size()*(i+1)/n;
+            if (i == n-1) { // encode the last range in this thread
+                range<ENCODER>(val, begin, end, indentCount, indentChar, docFlag, parts[i], errs[i]);
+            } else {
+                ths.push_back(std::thread(range<ENCODER, LIST>, std::cref(val), begin, end, indentCount, indentChar, docFlag, std::ref(parts[i]), std::ref(errs[i])));
+            }
+        }
+        for (size_t i=0; i<ths.size(); ++i) {
+            ths[i].join();
+        }
+        for (size_t i=0; i<n; ++i) {
+            if (errs[i]) {
+                std::rethrow_exception(errs[i]);
+            }
+        }
+
+        if (n == 1) {
+            return parts[0];
+        }
+
+        // parts[i] is "[...]" or "[\n...\n]"(pretty)
+        size_t tail = indentCount<0?1:2;
+        size_t total = 0;
+        for (size_t i=0; i<n; ++i) {
+            total += parts[i].length();
+        }
+        std::string out;
+        out.reserve(total);
+        out.push_back('[');
+        for (size_t i=0; i<n; ++i) {
+            if (i > 0) {
+                out.push_back(',');
+            }
+            out.append(parts[i], 1, parts[i].length()-1-tail);
+            std::string().swap(parts[i]);
+        }
+        if (indentCount >= 0) {
+            out.push_back('\n');
+        }
+        out.push_back(']');
+        return out;
+    }
+
+private:
+    static const size_t MIN_RANGE = 256; // less elements is not worth a thread
+
+    template <class ENCODER, class LIST>
+    static void range(const LIST &val, size_t begin, size_t end, int indentCount, char indentChar, int docFlag, std::string &out, std::exception_ptr &err) {
+        try {
+            ENCODER doc(indentCount, indentChar);
+            doc.SetDocFlag(docFlag);
+            doc.ArrayBegin(NULL, NULL);
+            for (size_t i=begin; i<end; ++i) {
+                doc.encode(doc.IndexKey(i), val[i], NULL);
+            }
+            doc.ArrayEnd(NULL, NULL);
+            out = doc.String();
+        } catch (...) {
+            err = std::current_exception();
+        }
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,453 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_JSON_PATCH_H
+#define __X_PACK_JSON_PATCH_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+
+#include "rapidjson_custom.h"
+#include "xrapidjson/document.h"
+#include "xrapidjson/writer.h"
+
+#include "json_encoder.h"
+#include "json_decoder.h"
+
+namespace xpack {
+
+/*
+  JSON merge patch(RFC 7386) of json values, used by JsonData::Merge:
+  - members of objects are patched one by one, nested objects are patched recursively
+  - a null member removes the member
+  - any other value(number, string, array...) is replaced as a whole
+*/
+class JsonMergePatch:private noncopyable {
+public:
+    // apply patch to target
+    static void Apply(rapidjson::Value &target, const rapidjson::Value &patch, rapidjson::Value::AllocatorType &alloc) {
+        if (!patch.IsObject()) {
+            target.CopyFrom(patch, alloc, true);
+            return;
+        }
+        if (!target.IsObject()) {
+            target.SetObject();
+        }
+
+        for (rapidjson::Value::ConstMemberIterator it=patch.MemberBegin(); it!=patch.MemberEnd(); ++it) {
+            rapidjson::Value::MemberIterator t = target.FindMember(it->name);
+            if (it->value.IsNull()) {
+                if (t != target.MemberEnd()) {
+                    target.EraseMember(t); // keep the order of other members
+                }
+            } else if (t != target.MemberEnd()) {
+                Apply(t->value, it->value, alloc);
+            } else {
+                rapidjson::Value name(it->name, alloc, true);
+                rapidjson::Value val;
+                Apply(val, it->value, alloc);
+                target.AddMember(name, val, alloc);
+            }
+        }
+    }
+};
+
+/*
+  Merge patch(RFC 7386) from an old value to a new value of the same type, without encoding
+  or parsing them. It's the proxy document passed to __x_pack_encode of the new value, each member
+  is compared with the member at the same offset of the old value(see Extend::member):
+  - XPACK struct, map with string key and shared_ptr of them are compared member by member
+  - other values(number, string, vector...) are written as a whole if changed
+  - a member without address(bitfield, temporary of custom codec) is found in the old value by its
+    position in XPACK
+  - a member omitted(F(OE)) in the new value is written as null
+*/
+class JsonDiffEncoder:private noncopyable {
+public:
+    typedef rapidjson::Writer<JsonBuffer> writer_type;
+
+    template <class T>
+    static void Diff(const T &oldVal, const T &newVal, writer_type &w) {
+        JsonDiffEncoder d(w);
+        d.value(NULL, oldVal, newVal, NULL, 0);
+    }
+
+    inline const char *Type() const {
+        return "json";
+    }
+
+    // members of the new value, called by __x_pack_encode
+    template <class T>
+    bool encode(const char *key, const T &val, const Extend *ext) {
+        if (0 != (X_PACK_CTRL_FLAG_INHERIT&Extend::CtrlFlag(ext))) { // members of parent are in the same level
+            return walk(*this, val, ext, 0);
+        }
+        Frame &f = _frames.back();
+        size_t index = f.index++;
+        if (NULL!=ext && ext->member==&val) {
+            const T &old = *(const T*)((const char*)f.old+((const char*)&val-(const char*)f.now));
+            return value(key, old, val, ext, 0);
+        }
+        std::string n = fragment(val, ext);
+        if (n != f.pick(f.old, index)) {
+            write(key, n);
+        }
+        return true;
+    }
+
+private:
+    // one struct or map being compared, its key and '{' are written only if some member changed
+    struct Frame {
+        const char *key;
+        bool open;
+        const void *old;
+        const void *now;
+        size_t index; // index of member in XPACK
+        std::string (*pick)(const void *old, size_t index);
+    };
+
+    // encode the index-th member of a struct, to find a member without address in the old value
+    class Picker:private noncopyable {
+    public:
+        Picker(size_t index):_target(index), _index(0) {}
+
+        inline const char *Type() const {
+            return "json";
+        }
+        template <class T>
+        bool encode(const char *key, const T &val, const Extend *ext) {
+            (void)key;
+            if (0 != (X_PACK_CTRL_FLAG_INHERIT&Extend::CtrlFlag(ext))) {
+                return walk(*this, val, ext, 0);
+            }
+            if (_index++ == _target) {
+                _out = fragment(val, ext);
+            }
+            return true;
+        }
+
+        size_t _target;
+        size_t _index;
+        std::string _out;
+    };
+
+    JsonDiffEncoder(writer_type &w):_w(w) {}
+
+    template <class T>
+    static std::string pick(const void *old, size_t index) {
+        Picker p(index);
+        walk(p, *(const T*)old, NULL, 0);
+        return p._out;
+    }
+
+    template <class DOC, class T>
+    static XPACK_IS_XPACK(T) walk(DOC &doc, const T &val, const Extend *ext, int) {
+        val.__x_pack_encode(doc, val, ext);
+        return true;
+    }
+    template <class DOC, class T>
+    static XPACK_IS_XOUT(T) walk(DOC &doc, const T &val, const Extend *ext, int) {
+        __x_pack_encode_out(doc, val, ext);
+        return true;
+    }
+    template <class DOC, class T>
+    static bool walk(DOC &doc, const T &val, const Extend *ext, long) {
+        (void)doc;
+        (void)val;
+        (void)ext;
+        return false;
+    }
+
+    template <class T>
+    XPACK_IS_XPACK(T) value(const char *key, const T &o, const T &n, const Extend *ext, int) {
+        return object(key, o, n, ext);
+    }
+    template <class T>
+    XPACK_IS_XOUT(T) value(const char *key, const T &o, const T &n, const Extend *ext, int) {
+        return object(key, o, n, ext);
+    }
+    template <class T>
+    bool value(const char *key, const std::map<std::string, T> &o, const std::map<std::string, T> &n, const Extend *ext, int) {
+        (void)ext;
+        return map(key, o, n);
+    }
+    #ifdef X_PACK_SUPPORT_CXX0X
+    template <class T>
+    bool value(const char *key, const std::unordered_map<std::string, T> &o, const std::unordered_map<std::string, T> &n, const Extend *ext, int) {
+        (void)ext;
+        return map(key, o, n);
+    }
+    template <class T>
+    bool value(const char *key, const std::shared_ptr<T> &o, const std::shared_ptr<T> &n, const Extend *ext, int) {
+        if (o.get()!=NULL && n.get()!=NULL) {
+            return value(key, *o, *n, ext, 0);
+        }
+        return value(key, o, n, ext, 0L);
+    }
+    #endif
+    // compared and written as a whole
+    template <class T>
+    bool value(const char *key, const T &o, const T &n, const Extend *ext, long) {
+        if (_frames.empty()) { // top level
+            std::string s = fragment(n, ext);
+            _w.RawValue(s.data(), s.length(), rapidjson::kObjectType);
+        } else if (!equal(o, n, ext)) {
+            write(key, fragment(n, ext));
+        }
+        return true;
+    }
+
+    template <class T>
+    bool object(const char *key, const T &o, const T &n, const Extend *ext) {
+        push(key, &o, &n, pick<T>);
+        walk(*this, n, ext, 0);
+        pop();
+        return true;
+    }
+
+    template <class MAP>
+    bool map(const char *key, const MAP &o, const MAP &n) {
+        push(key, NULL, NULL, NULL);
+        for (typename MAP::const_iterator it=n.begin(); it!=n.end(); ++it) {
+            typename MAP::const_iterator old = o.find(it->first);
+            if (old == o.end()) {
+                write(it->first.c_str(), fragment(it->second, NULL));
+            } else {
+                value(it->first.c_str(), old->second, it->second, NULL, 0);
+            }
+        }
+        for (typename MAP::const_iterator it=o.begin(); it!=o.end(); ++it) {
+            if (n.find(it->first) == n.end()) {
+                write(it->first.c_str(), std::string());
+            }
+        }
+        pop();
+        return true;
+    }
+
+    template <class T>
+    static typename x_enable_if<numeric<T>::value, bool>::type equal(const T &o, const T &n, const Extend *ext) {
+        (void)ext;
+        return o == n;
+    }
+    static bool equal(const bool &o, const bool &n, const Extend *ext) {
+        (void)ext;
+        return o == n;
+    }
+    static bool equal(const std::string &o, const std::string &n, const Extend *ext) {
+        (void)ext;
+        return o == n;
+    }
+    template <class T>
+    static typename x_enable_if<!numeric<T>::value, bool>::type equal(const T &o, const T &n, const Extend *ext) {
+        return fragment(o, ext) == fragment(n, ext);
+    }
+
+    // json of val, empty if omitted
+    template <class T>
+    static std::string fragment(const T &val, const Extend *ext) {
+        JsonCompactEncoder doc;
+        doc.encode(NULL, val, ext);
+        return doc.String();
+    }
+
+    void push(const char *key, const void *o, const void *n, std::string (*p)(const void*, size_t)) {
+        Frame f;
+        f.key = key;
+        f.open = false;
+        f.old = o;
+        f.now = n;
+        f.index = 0;
+        f.pick = p;
+        _frames.push_back(f);
+        if (_frames.size() == 1) { // top level is always written
+            open();
+        }
+    }
+    void pop() {
+        if (_frames.back().open) {
+            _w.EndObject();
+        }
+        _frames.pop_back();
+    }
+    void open() {
+        for (size_t i=0; i<_frames.size(); ++i) {
+            if (!_frames[i].open) {
+                if (NULL != _frames[i].key) {
+                    _w.Key(_frames[i].key);
+                }
+                _w.StartObject();
+                _frames[i].open = true;
+            }
+        }
+    }
+    // empty json means removed
+    void write(const char *key, const std::string &json) {
+        open();
+        _w.Key(key);
+        if (json.empty()) {
+            _w.Null();
+        } else {
+            _w.RawValue(json.data(), json.length(), rapidjson::kObjectType);
+        }
+    }
+
+    writer_type &_w;
+    std::vector<Frame> _frames;
+};
+
+/*
+  Apply a merge patch(RFC 7386) to a value in place. It's the proxy document passed to
+  __x_pack_decode of the value:
+  - a member not in the patch is unchanged, null resets it to the default value
+  - XPACK struct, map with string key and shared_ptr of them are patched member by member,
+    null in a map erases the key
+  - other values(number, string, vector...) are decoded from the patch as a whole
+  Members not in XPACK are never touched.
+*/
+class JsonPatchDecoder:private noncopyable {
+public:
+    template <class T>
+    static void Apply(const rapidjson::Value &patch, T &val) {
+        JsonPatchDecoder d(&patch);
+        if (patch.IsNull()) {
+            reset(val);
+        } else {
+            d.value(patch, val, NULL, 0);
+        }
+    }
+
+    inline const char *Type() const {
+        return "json";
+    }
+
+    // members of the value, called by __x_pack_decode
+    template <class T>
+    bool decode(const char *key, T &val, const Extend *ext) {
+        if (0 != (X_PACK_CTRL_FLAG_INHERIT&Extend::CtrlFlag(ext))) { // members of parent are in the same level
+            return walk(*this, val, ext, 0);
+        }
+        if (NULL == key) {
+            return false;
+        }
+        rapidjson::Value::ConstMemberIterator it = _patch->FindMember(key);
+        if (it == _patch->MemberEnd()) {
+            return false;
+        } else if (it->value.IsNull()) {
+            reset(val);
+            return true;
+        }
+        return value(it->value, val, ext, 0);
+    }
+
+private:
+    JsonPatchDecoder(const rapidjson::Value *patch):_patch(patch) {}
+
+    template <class T>
+    static void reset(T &val) {
+        val = T();
+    }
+    template <class T, size_t N>
+    static void reset(T (&val)[N]) {
+        for (size_t i=0; i<N; ++i) {
+            reset(val[i]);
+        }
+    }
+
+    template <class DOC, class T>
+    static XPACK_IS_XPACK(T) walk(DOC &doc, T &val, const Extend *ext, int) {
+        val.__x_pack_decode(doc, val, ext);
+        return true;
+    }
+    template <class DOC, class T>
+    static XPACK_IS_XOUT(T) walk(DOC &doc, T &val, const Extend *ext, int) {
+        __x_pack_decode_out(doc, val, ext);
+        return true;
+    }
+    template <class DOC, class T>
+    static bool walk(DOC &doc, T &val, const Extend *ext, long) {
+        (void)doc;
+        (void)val;
+        (void)ext;
+        return false;
+    }
+
+    template <class T>
+    XPACK_IS_XPACK(T) value(const rapidjson::Value &patch, T &val, const Extend *ext, int) {
+        return object(patch, val, ext);
+    }
+    template <class T>
+    XPACK_IS_XOUT(T) value(const rapidjson::Value &patch, T &val, const Extend *ext, int) {
+        return object(patch, val, ext);
+    }
+    template <class T>
+    bool value(const rapidjson::Value &patch, std::map<std::string, T> &val, const Extend *ext, int) {
+        return map(patch, val, ext);
+    }
+    #ifdef X_PACK_SUPPORT_CXX0X
+    template <class T>
+    bool value(const rapidjson::Value &patch, std::unordered_map<std::string, T> &val, const Extend *ext, int) {
+        return map(patch, val, ext);
+    }
+    template <class T>
+    bool value(const rapidjson::Value &patch, std::shared_ptr<T> &val, const Extend *ext, int) {
+        if (val.get() == NULL) {
+            val.reset(new T);
+        }
+        return value(patch, *val, ext, 0);
+    }
+    #endif
+    // decoded as a whole
+    template <class T>
+    bool value(const rapidjson::Value &patch, T &val, const Extend *ext, long) {
+        JsonDecoder d(&patch);
+        return d.decode(NULL, val, ext);
+    }
+
+    template <class T>
+    bool object(const rapidjson::Value &patch, T &val, const Extend *ext) {
+        if (!patch.IsObject()) {
+            return value(patch, val, ext, 0L); // let decoder report the error
+        }
+        JsonPatchDecoder d(&patch);
+        walk(d, val, ext, 0);
+        return true;
+    }
+
+    template <class MAP>
+    bool map(const rapidjson::Value &patch, MAP &val, const Extend *ext) {
+        if (!patch.IsObject()) {
+            return value(patch, val, ext, 0L);
+        }
+        for (rapidjson::Value::ConstMemberIterator it=patch.MemberBegin(); it!=patch.MemberEnd(); ++it) {
+            std::string name(it->name.GetString(), it->name.GetStringLength());
+            if (it->value.IsNull()) {
+                val.erase(name);
+            } else {
+                value(it->value, val[name], NULL, 0);
+            }
+        }
+        return true;
+    }
+
+    const rapidjson::Value *_patch;
+};
+
+}
+
+#endif
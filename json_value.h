@@ -0,0 +1,248 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_JSON_VALUE_H
+#define __X_PACK_JSON_VALUE_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "rapidjson_custom.h"
+#include "xrapidjson/document.h"
+
+#include "xencoder.h"
+#include "json_encoder.h"
+#include "ftoa.h"
+#include "utf8.h"
+
+namespace xpack {
+
+/*
+  Encoder that builds rapidjson::Value nodes instead of text, see json::to_value and JsonData::from.
+  Strings are copied into the allocator, except keys declared in XPACK which are static
+  and referenced(same as JsonKeyCache).
+*/
+class JsonValueEncoder:public XEncoder<JsonValueEncoder>, private noncopyable {
+public:
+    friend class XEncoder<JsonValueEncoder>;
+    using XEncoder<JsonValueEncoder>::encode;
+
+    typedef rapidjson::MemoryPoolAllocator<> allocator_type;
+
+    // the encoded value is moved to out
+    JsonValueEncoder(rapidjson::Value &out, allocator_type &alloc):_out(out), _alloc(alloc), _doc_flag(0) {
+    }
+
+    // X_PACK_DOC_FLAG_UTF8 and X_PACK_DOC_FLAG_REF, same as JsonWriterEncoder
+    void SetDocFlag(int docFlag) {
+        _doc_flag = docFlag;
+    }
+    int DocFlag() const {
+        return _doc_flag;
+    }
+
+    inline const char *Type() const {
+        return "json";
+    }
+    inline const char *IndexKey(size_t index) {
+        (void)index;
+        return NULL;
+    }
+
+    bool empty_null(const Extend *ext) const {
+        return Extend::EmptyNull(ext);
+    }
+
+    void ArrayBegin(const char *key, const Extend *ext) {
+        rapidjson::Value v(rapidjson::kArrayType);
+        _stack.push_back(&add(key, v, ext));
+    }
+    void ArrayEnd(const char *key, const Extend *ext) {
+        (void)key;
+        (void)ext;
+        _stack.pop_back();
+    }
+    void ObjectBegin(const char *key, const Extend *ext) {
+        rapidjson::Value v(rapidjson::kObjectType);
+        _stack.push_back(&add(key, v, ext));
+    }
+    void ObjectEnd(const char *key, const Extend *ext) {
+        (void)key;
+        (void)ext;
+        _stack.pop_back();
+    }
+
+    #define X_PACK_JSON_VALUE_ENCODE(cond, SET) \
+        if ((cond)){                     \
+            if (Extend::OmitEmpty(ext)) {\
+                return false;            \
+            } else if (Extend::EmptyNull(ext)) {\
+                return writeNull(key, ext); \
+            }                            \
+        }                                \
+        rapidjson::Value v;              \
+        v.SET;                           \
+        add(key, v, ext);                \
+        return true
+
+    bool writeNull(const char*key, const Extend *ext) {
+        if (Extend::OmitEmpty(ext)) {
+            return false;
+        }
+        rapidjson::Value v;
+        add(key, v, ext);
+        return true;
+    }
+    bool encode(const char*key, const std::string &val, const Extend *ext) {
+        if ((_doc_flag&X_PACK_DOC_FLAG_UTF8) && !Utf8::Valid(val.data(), val.length())) {
+            throw std::runtime_error(std::string("Invalid utf-8 string. key=")+(NULL!=key?key:""));
+        }
+        X_PACK_JSON_VALUE_ENCODE(val.empty(), SetString(val.data(), (rapidjson::SizeType)val.length(), _alloc));
+    }
+    bool encode(const char*key, const bool &val, const Extend *ext) {
+        X_PACK_JSON_VALUE_ENCODE(!val, SetBool(val));
+    }
+    bool encode(const char*key, const char &val, const Extend *ext) {
+        return this->encode(key, (const int&)val, ext);
+    }
+    bool encode(const char*key, const signed char &val, const Extend *ext) {
+        return this->encode(key, (const int&)val, ext);
+    }
+    bool encode(const char*key, const unsigned char &val, const Extend *ext) {
+        return this->encode(key, (const unsigned int&)val, ext);
+    }
+    bool encode(const char*key, const short & val, const Extend *ext) {
+        return this->encode(key, (const int&)val, ext);
+    }
+    bool encode(const char*key, const unsigned short & val, const Extend *ext) {
+        return this->encode(key, (const unsigned int&)val, ext);
+    }
+    bool encode(const char*key, const int& val, const Extend *ext) {
+        X_PACK_JSON_VALUE_ENCODE(val==0, SetInt(val));
+    }
+    bool encode(const char*key, const unsigned int& val, const Extend *ext) {
+        X_PACK_JSON_VALUE_ENCODE(val==0, SetUint(val));
+    }
+    bool encode(const char*key, const long long& val, const Extend *ext) {
+        X_PACK_JSON_VALUE_ENCODE(val==0, SetInt64(val));
+    }
+    bool encode(const char*key, const unsigned long long & val, const Extend *ext) {
+        X_PACK_JSON_VALUE_ENCODE(val==0, SetUint64(val));
+    }
+    bool encode(const char*key, const long &val, const Extend *ext) {
+        return this->encode(key, (const long long&)val, ext);
+    }
+    bool encode(const char*key, const unsigned long &val, const Extend *ext) {
+        return this->encode(key, (const unsigned long long&)val, ext);
+    }
+    // the node is a double, it's set to the one with the shortest digits of the float(0.1f is 0.1)
+    bool encode(const char*key, const float & val, const Extend *ext) {
+        X_PACK_JSON_VALUE_ENCODE(val==0, SetDouble(rapidjson::internal::Double(val).IsNanOrInf()?val:ftod(val)));
+    }
+    bool encode(const char*key, const double & val, const Extend *ext) {
+        X_PACK_JSON_VALUE_ENCODE(val==0, SetDouble(val));
+    }
+    bool encode(const char*key, const long double & val, const Extend *ext) {
+        X_PACK_JSON_VALUE_ENCODE(val==0, SetDouble((double)val));
+    }
+    #undef X_PACK_JSON_VALUE_ENCODE
+
+    template <class T>
+    bool encode_columns(const char*key, const std::vector<T> &val, const Extend *ext) {
+        return JsonColumnRow<JsonValueEncoder>::Encode(*this, key, val, ext);
+    }
+
+    #ifdef X_PACK_SUPPORT_CXX0X
+    // X_PACK_DOC_FLAG_REF, {"$id":1,...members} the first time, {"$ref":1} after that, see JsonWriterEncoder
+    template <class T>
+    bool encode(const char*key, const std::shared_ptr<T>& val, const Extend *ext) {
+        if (0==(_doc_flag&X_PACK_DOC_FLAG_REF) || NULL==val.get()) {
+            return XEncoder<JsonValueEncoder>::encode(key, val, ext);
+        }
+
+        std::pair<const void*, const void*> id((const void*)val.get(), (const void*)&x_type_tag<T>::value);
+        typename std::map<std::pair<const void*, const void*>, int>::iterator iter = _shared.find(id);
+        ObjectBegin(key, ext);
+        if (iter != _shared.end()) {
+            this->encode("$ref", iter->second, NULL);
+        } else {
+            int n = (int)_shared.size()+1;
+            _shared[id] = n;
+            this->encode("$id", n, NULL);
+            Extend vext(Extend::Flag(ext), NULL);
+            shared_value(*val, &vext, 0);
+        }
+        ObjectEnd(key, ext);
+        return true;
+    }
+    #endif
+
+private:
+    #ifdef X_PACK_SUPPORT_CXX0X
+    template <class T>
+    XPACK_IS_XPACK(T) shared_value(const T &val, Extend *ext, int) {
+        ext->ctrl_flag |= X_PACK_CTRL_FLAG_INHERIT;
+        return this->encode(NULL, val, ext);
+    }
+    template <class T>
+    XPACK_IS_XOUT(T) shared_value(const T &val, Extend *ext, int) {
+        ext->ctrl_flag |= X_PACK_CTRL_FLAG_INHERIT;
+        return this->encode(NULL, val, ext);
+    }
+    template <class T>
+    bool shared_value(const T &val, Extend *ext, long) {
+        return this->encode("$value", val, ext);
+    }
+    #endif
+
+    // append v to the current array/object(or the output at the top level), return the added node.
+    // nodes in _stack stay valid because only the innermost container grows
+    rapidjson::Value& add(const char *key, rapidjson::Value &v, const Extend *ext) {
+        if (_stack.empty()) {
+            _out = v;
+            return _out;
+        }
+        rapidjson::Value &top = *_stack.back();
+        if (top.IsObject()) {
+            rapidjson::Value k;
+            if (NULL == key) {
+                k.SetString("", 0);
+            } else if (NULL != ext && ext->key == key) {
+                k.SetString(rapidjson::StringRef(key));
+            } else {
+                k.SetString(key, _alloc);
+            }
+            top.AddMember(k, v, _alloc);
+            return (top.MemberEnd()-1)->value;
+        }
+        top.PushBack(v, _alloc);
+        return top[top.Size()-1];
+    }
+
+    rapidjson::Value &_out;
+    allocator_type &_alloc;
+    std::vector<rapidjson::Value*> _stack;
+    int _doc_flag;
+
+    #ifdef X_PACK_SUPPORT_CXX0X
+    std::map<std::pair<const void*, const void*>, int> _shared; // (address, type) -> $id
+    #endif
+};
+
+}
+
+#endif
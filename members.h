@@ -0,0 +1,116 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_MEMBERS_H
+#define __X_PACK_MEMBERS_H
+
+#include <string>
+#include <vector>
+
+#include "extend.h"
+#include "traits.h"
+
+namespace xpack {
+
+/*
+  Walk the members declared in XPACK/XPACK_OUT of a struct, in declare order. It works as a decoder
+  that calls visitor.member(key, val, ext) for every member instead of decoding it. key is the name
+  for visitor.Type()(alias resolved), members of parent class(I) are walked in place.
+*/
+template <class VISITOR>
+class MemberWalker:private noncopyable {
+public:
+    // return false if val is not a struct
+    template <class T>
+    static bool Walk(VISITOR &visitor, T &val) {
+        MemberWalker w(visitor);
+        return w.inherit(val, NULL, 0);
+    }
+
+    const char *Type() const {
+        return _visitor.Type();
+    }
+
+    template <class T>
+    bool decode(const char *key, T &val, const Extend *ext) {
+        if (NULL == key) { // inherit
+            inherit(val, ext, 0);
+        } else {
+            _visitor.member(key, val, ext);
+        }
+        return false;
+    }
+
+private:
+    MemberWalker(VISITOR &visitor):_visitor(visitor) {}
+
+    template <class T>
+    XPACK_IS_XPACK(T) inherit(T &val, const Extend *ext, int) {
+        val.__x_pack_decode(*this, val, ext);
+        return true;
+    }
+    template <class T>
+    XPACK_IS_XOUT(T) inherit(T &val, const Extend *ext, int) {
+        __x_pack_decode_out(*this, val, ext);
+        return true;
+    }
+    template <class T>
+    bool inherit(T &val, const Extend *ext, long) {
+        (void)val;
+        (void)ext;
+        return false;
+    }
+
+    VISITOR &_visitor;
+};
+
+/*
+  Collect the keys declared in XPACK/XPACK_OUT of a struct, in declare order.
+  Alias is resolved for the given type, members of parent class(I) are included.
+
+    std::vector<std::string> keys;
+    xpack::Members::Names<User>("json", keys);
+*/
+class Members:private noncopyable {
+public:
+    template <class T>
+    static void Names(const char *type, std::vector<std::string> &names) {
+        Members m(type, names);
+        T val;
+        MemberWalker<Members>::Walk(m, val);
+    }
+
+    const char *Type() const {
+        return _type;
+    }
+
+    template <class T>
+    void member(const char *key, T &val, const Extend *ext) {
+        (void)val;
+        (void)ext;
+        _names.push_back(key);
+    }
+
+private:
+    Members(const char *type, std::vector<std::string> &names):_type(type), _names(names) {}
+
+    const char *_type;
+    std::vector<std::string> &_names;
+};
+
+}
+
+#endif
@@ -0,0 +1,60 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_MSGPACK_H
+#define __X_PACK_MSGPACK_H
+
+#include "msgpack_decoder.h"
+#include "msgpack_encoder.h"
+#include "size_hint.h"
+#include "xpack.h"
+
+namespace xpack {
+
+/*
+  MessagePack, struct is a map of member name to value, alias type is "msgpack", e.g. A(id, "msgpack:_id").
+  the output of encode is binary data in std::string.
+*/
+class msgpack {
+public:
+    template <class T>
+    static void decode(const std::string &data, T &val, int docFlag=0) {
+        MsgPackDecoder doc(data.data(), data.length(), docFlag);
+        doc.decode(NULL, val, NULL);
+    }
+    // data is not copied
+    template <class T>
+    static void decode(const char *data, size_t len, T &val, int docFlag=0) {
+        MsgPackDecoder doc(data, len, docFlag);
+        doc.decode(NULL, val, NULL);
+    }
+
+    template <class T>
+    static std::string encode(const T &val, int flag=0, int docFlag=0) {
+        MsgPackEncoder doc;
+        Extend ext(flag, NULL);
+        doc.SetDocFlag(docFlag);
+        doc.Reserve(SizeHint<T, MsgPackEncoder>::Get());
+        doc.encode(NULL, val, &ext);
+        std::string out = doc.String();
+        SizeHint<T, MsgPackEncoder>::Update(out.length());
+        return out;
+    }
+};
+
+}
+
+#endif
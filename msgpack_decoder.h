@@ -0,0 +1,584 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_MSGPACK_DECODER_H
+#define __X_PACK_MSGPACK_DECODER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+
+#include "xdecoder.h"
+#include "utf8.h"
+#include "util.h"
+
+namespace xpack {
+
+/*
+  MessagePack decoder. The input is scanned once into a flat node list(no tree is built), each node
+  points into the input, so str/bin are not copied until they are assigned to the member.
+  The input must be kept until decoding is done. Members of a map are searched from the one after
+  the last found, members of struct are in the same order as encoded, so normally it's found at once.
+  ext type is skipped, decoding it is an error.
+*/
+class MsgPackDecoder:public XDecoder<MsgPackDecoder>, private noncopyable {
+public:
+    enum NodeType {
+        kNil, kBool, kInt, kUint, kFloat, kStr, kBin, kArray, kMap, kExt
+    };
+    struct Node {
+        unsigned char type; // NodeType
+        uint32_t size;      // length of str/bin/ext, elements of array, pairs of map
+        size_t next;        // index of the node after this value(children included)
+        union {
+            const char *data; // str/bin/ext
+            int64_t i;      // kInt
+            uint64_t u;     // kUint, kBool
+            double d;       // kFloat
+        };
+    };
+
+private:
+    class MemberIterator {
+        friend class MsgPackDecoder;
+    public:
+        MemberIterator(size_t key, MsgPackDecoder* parent):_key(key),_parent(parent){}
+        bool operator != (const MemberIterator &that) const {
+            return _key != that._key;
+        }
+        MemberIterator& operator ++ () {
+            _key = _parent->_nodes[_parent->_nodes[_key].next].next;
+            return *this;
+        }
+        std::string Key() const {
+            return _parent->key_string(_parent->_nodes[_key]);
+        }
+        MsgPackDecoder& Val() const {
+            return _parent->member(*this, *(_parent->alloc()));
+        }
+    private:
+        size_t _key;
+        MsgPackDecoder* _parent;
+    };
+public:
+    friend class XDecoder<MsgPackDecoder>;
+    using xdoc_type::decode;
+    typedef MemberIterator Iterator;
+
+    MsgPackDecoder(const char *data, size_t len, int docFlag=0):xdoc_type(NULL, ""),_nodes(NULL),_node(0),_cursor(0),_cursor_i(0) {
+        Parse(data, len, docFlag, _tape);
+        _nodes = &_tape[0];
+    }
+
+    inline const char * Type() const {
+        return "msgpack";
+    }
+
+    // scan data into nodes, throw std::runtime_error if it's not a valid msgpack value
+    static void Parse(const char *data, size_t len, int docFlag, std::vector<Node> &nodes) {
+        const unsigned char *p = (const unsigned char*)data;
+        const unsigned char *end = p+len;
+        std::vector<std::pair<size_t, uint64_t> > stack; // container node, children left
+        nodes.clear();
+        nodes.reserve(len/4);
+        for (;;) {
+            size_t n = nodes.size();
+            nodes.push_back(Node());
+            Node &nd = nodes.back();
+            parse_node(p, end, (const unsigned char*)data, docFlag, nd);
+
+            uint64_t children = (nd.type==kArray)?nd.size:((nd.type==kMap)?(uint64_t)nd.size*2:0);
+            if (children > (uint64_t)(end-p)) { // every value takes 1 byte at least
+                parse_error("truncated", (const unsigned char*)data, p);
+            }
+            if (children > 0) {
+                stack.push_back(std::make_pair(n, children));
+                continue;
+            }
+            nd.next = n+1;
+            while (!stack.empty() && 0==--stack.back().second) {
+                nodes[stack.back().first].next = nodes.size();
+                stack.pop_back();
+            }
+            if (stack.empty()) {
+                break;
+            }
+        }
+        if (p != end) {
+            parse_error("extra data after the value", (const unsigned char*)data, p);
+        }
+    }
+
+    bool decode(const char*key, std::string &val, const Extend *ext) {
+        bool isNull;
+        const Node *v = get_node(key, isNull);
+        if (NULL != v) {
+            if (v->type!=kStr && v->type!=kBin) {
+                decode_exception("type unmatch", key);
+            }
+            val.assign(v->data, v->size);
+            return true;
+        } else if (isNull) {
+            return true;
+        } else if (NULL!=key && Extend::Mandatory(ext)) {
+            decode_exception("mandatory key not found", key);
+        }
+        return false;
+    }
+    bool decode(const char*key, bool &val, const Extend *ext) {
+        bool isNull;
+        const Node *v = get_node(key, isNull);
+        if (isNull) {
+            val = false;
+            return true;
+        } else if (NULL == v) {
+            if (NULL!=key && Extend::Mandatory(ext)) {
+                decode_exception("mandatory key not found", key);
+            }
+            return false;
+        } else if (v->type == kBool || v->type == kUint) {
+            val = (0 != v->u);
+            return true;
+        } else if (v->type == kInt) {
+            val = (0 != v->i);
+            return true;
+        } else {
+            decode_exception("wish bool, but not bool or int", key);
+            return false;
+        }
+    }
+    bool decode(const char*key, char &val, const Extend *ext) {
+        return decode_number(key, val, ext);
+    }
+    bool decode(const char*key, signed char &val, const Extend *ext) {
+        return decode_number(key, val, ext);
+    }
+    bool decode(const char*key, unsigned char &val, const Extend *ext) {
+        return decode_number(key, val, ext);
+    }
+    bool decode(const char*key, short &val, const Extend *ext) {
+        return decode_number(key, val, ext);
+    }
+    bool decode(const char*key, unsigned short &val, const Extend *ext) {
+        return decode_number(key, val, ext);
+    }
+    bool decode(const char*key, int &val, const Extend *ext) {
+        return decode_number(key, val, ext);
+    }
+    bool decode(const char*key, unsigned int &val, const Extend *ext) {
+        return decode_number(key, val, ext);
+    }
+    bool decode(const char*key, long &val, const Extend *ext) {
+        return decode_number(key, val, ext);
+    }
+    bool decode(const char*key, unsigned long &val, const Extend *ext) {
+        return decode_number(key, val, ext);
+    }
+    bool decode(const char*key, long long &val, const Extend *ext) {
+        return decode_number(key, val, ext);
+    }
+    bool decode(const char*key, unsigned long long &val, const Extend *ext) {
+        return decode_number(key, val, ext);
+    }
+    bool decode(const char*key, float &val, const Extend *ext) {
+        return decode_number(key, val, ext);
+    }
+    bool decode(const char*key, double &val, const Extend *ext) {
+        return decode_number(key, val, ext);
+    }
+    bool decode(const char*key, long double &val, const Extend *ext) {
+        return decode_number(key, val, ext);
+    }
+
+    // vector of numbers, from array without creating decoder for the elements, or from bin of F(B64)
+    template <class T>
+    typename x_enable_if<numeric<T>::value, bool>::type decode(const char*key, std::vector<T> &val, const Extend *ext) {
+        bool isNull;
+        const Node *v = get_node(key, isNull);
+        if (NULL == v) {
+            return xdoc_type::decode(key, val, ext);
+        } else if (v->type == kBin) {
+            if (v->size%sizeof(T) != 0) {
+                decode_exception("invalid bin size", key);
+            }
+            val.resize(v->size/sizeof(T));
+            if (v->size > 0) {
+                memcpy(&val[0], v->data, v->size);
+                if (sizeof(T)>1 && !Base64::LittleEndian()) {
+                    Base64::SwapBytes(&val[0], sizeof(T), val.size());
+                }
+            }
+            return true;
+        } else if (v->type == kArray) {
+            val.resize(v->size);
+            const Node *e = v+1;
+            for (size_t i=0; i<val.size(); ++i) {
+                to_number(*e, val[i], key);
+                e = _nodes+e->next;
+            }
+            return true;
+        }
+        return xdoc_type::decode(key, val, ext);
+    }
+    template <class T>
+    typename x_enable_if<!numeric<T>::value, bool>::type decode(const char*key, std::vector<T> &val, const Extend *ext) {
+        return xdoc_type::decode(key, val, ext);
+    }
+
+    // map<int, T>, key is string(same as json) or integer
+    template <class K, class T>
+    typename x_enable_if<numeric<K>::is_integer, bool>::type decode(const char*key, std::map<K,T>& val, const Extend *ext) {
+        return decode_map<std::map<K,T>, K, T>(key, val, ext, Util::atoi);
+    }
+
+    #ifdef X_PACK_SUPPORT_CXX0X
+    template <class K, class T>
+    typename x_enable_if<std::is_enum<K>::value, bool>::type decode(const char*key, std::map<K,T>& val, const Extend *ext) {
+        return decode_map<std::map<K,T>, K, T>(key, val, ext, Util::atoi);
+    }
+    #endif
+
+    // array
+    size_t Size() {
+        if (NULL!=_nodes && _nodes[_node].type==kArray) {
+            return (size_t)_nodes[_node].size;
+        } else {
+            return 0;
+        }
+    }
+
+    // iter
+    Iterator Begin() {
+        return Iterator((_nodes[_node].type==kMap)?_node+1:_nodes[_node].next, this);
+    }
+    Iterator End() {
+        return Iterator(_nodes[_node].next, this);
+    }
+    operator bool() const {
+        return NULL != _nodes;
+    }
+
+private:
+    MsgPackDecoder():xdoc_type(NULL, ""),_nodes(NULL),_node(0),_cursor(0),_cursor_i(0) {
+    }
+
+    static void parse_error(const char *what, const unsigned char *data, const unsigned char *p) {
+        throw std::runtime_error(std::string("Parse msgpack fail. err=")+what+". offset="+Util::itoa((size_t)(p-data)));
+    }
+    static uint64_t be(const unsigned char *p, size_t n) {
+        uint64_t v = 0;
+        for (size_t i=0; i<n; ++i) {
+            v = (v<<8)|p[i];
+        }
+        return v;
+    }
+
+    // parse the value at p(children of array/map are not included), p is moved to the end of it
+    static void parse_node(const unsigned char *&p, const unsigned char *end, const unsigned char *data, int docFlag, Node &nd) {
+        nd.size = 0;
+        nd.next = 0;
+        nd.u = 0;
+        if (p >= end) {
+            parse_error("truncated", data, p);
+        }
+        const unsigned char *start = p;
+        unsigned char c = *p++;
+        size_t lenBytes = 0; // bytes of the length of str/bin/ext, 0 if not these types or it's fixed
+        size_t extra = 0;    // ext type byte
+        if (c <= 0x7f) {
+            nd.type = kUint;
+            nd.u = c;
+            return;
+        } else if (c >= 0xe0) {
+            nd.type = kInt;
+            nd.i = (signed char)c;
+            return;
+        } else if (c <= 0x8f) {
+            nd.type = kMap;
+            nd.size = c&0x0f;
+            return;
+        } else if (c <= 0x9f) {
+            nd.type = kArray;
+            nd.size = c&0x0f;
+            return;
+        } else if (c <= 0xbf) {
+            nd.type = kStr;
+            nd.size = c&0x1f;
+        } else {
+            // fixed size values
+            static const unsigned char num_bytes[] = {1, 2, 4, 8};
+            switch (c) {
+            case 0xc0:
+                nd.type = kNil;
+                return;
+            case 0xc2:
+            case 0xc3:
+                nd.type = kBool;
+                nd.u = c-0xc2;
+                return;
+            case 0xc4: case 0xc5: case 0xc6:
+                nd.type = kBin;
+                lenBytes = (size_t)1<<(c-0xc4);
+                break;
+            case 0xc7: case 0xc8: case 0xc9:
+                nd.type = kExt;
+                lenBytes = (size_t)1<<(c-0xc7);
+                extra = 1;
+                break;
+            case 0xca: case 0xcb: {
+                    size_t n = (c==0xca)?4:8;
+                    if ((size_t)(end-p) < n) {
+                        parse_error("truncated", data, start);
+                    }
+                    nd.type = kFloat;
+                    if (n == 4) {
+                        uint32_t bits = (uint32_t)be(p, 4);
+                        float f;
+                        memcpy(&f, &bits, sizeof(f));
+                        nd.d = f;
+                    } else {
+                        uint64_t bits = be(p, 8);
+                        memcpy(&nd.d, &bits, sizeof(bits));
+                    }
+                    p += n;
+                    return;
+                }
+            case 0xcc: case 0xcd: case 0xce: case 0xcf:
+            case 0xd0: case 0xd1: case 0xd2: case 0xd3: {
+                    size_t n = num_bytes[(c-0xcc)&3];
+                    if ((size_t)(end-p) < n) {
+                        parse_error("truncated", data, start);
+                    }
+                    uint64_t v = be(p, n);
+                    p += n;
+                    if (c <= 0xcf) {
+                        nd.type = kUint;
+                        nd.u = v;
+                    } else {
+                        nd.type = kInt;
+                        if (n < 8 && (v>>(n*8-1))) { // sign extend
+                            v |= ~(uint64_t)0<<(n*8);
+                        }
+                        nd.i = (int64_t)v;
+                    }
+                    return;
+                }
+            case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8:
+                nd.type = kExt;
+                nd.size = 1u<<(c-0xd4);
+                extra = 1;
+                break;
+            case 0xd9: case 0xda: case 0xdb:
+                nd.type = kStr;
+                lenBytes = (size_t)1<<(c-0xd9);
+                break;
+            case 0xdc: case 0xdd:
+            case 0xde: case 0xdf: {
+                    size_t n = (c&1)?4:2;
+                    if ((size_t)(end-p) < n) {
+                        parse_error("truncated", data, start);
+                    }
+                    nd.type = (c<=0xdd)?kArray:kMap;
+                    nd.size = (uint32_t)be(p, n);
+                    p += n;
+                    return;
+                }
+            default:
+                parse_error("invalid type", data, start);
+            }
+        }
+
+        // str/bin/ext
+        if ((size_t)(end-p) < lenBytes+extra) {
+            parse_error("truncated", data, start);
+        }
+        if (lenBytes > 0) {
+            nd.size = (uint32_t)be(p, lenBytes);
+            p += lenBytes;
+        }
+        p += extra;
+        if ((size_t)(end-p) < nd.size) {
+            parse_error("truncated", data, start);
+        }
+        nd.data = (const char*)p;
+        p += nd.size;
+        if (nd.type==kStr && (docFlag&X_PACK_DOC_FLAG_UTF8) && !Utf8::Valid(nd.data, nd.size)) {
+            parse_error("Invalid encoding in string", data, (const unsigned char*)nd.data);
+        }
+    }
+
+    template <class T>
+    void to_number(const Node &v, T &val, const char *key) const {
+        switch (v.type) {
+        case kInt:
+            val = (T)v.i;
+            break;
+        case kUint:
+        case kBool:
+            val = (T)v.u;
+            break;
+        case kFloat:
+            val = (T)v.d;
+            break;
+        default:
+            decode_exception("type unmatch", key);
+        }
+    }
+
+    template <class T>
+    bool decode_number(const char*key, T &val, const Extend *ext) {
+        bool isNull;
+        const Node *v = get_node(key, isNull);
+        if (NULL != v) {
+            to_number(*v, val, key);
+            return true;
+        } else if (isNull) {
+            val = 0;
+            return 0==(Extend::CtrlFlag(ext)&X_PACK_CTRL_FLAG_IGNORE_NULL);
+        } else if (NULL!=key && Extend::Mandatory(ext)) {
+            decode_exception("mandatory key not found", key);
+        }
+        return false;
+    }
+
+    std::string key_string(const Node &k) const {
+        if (k.type == kStr || k.type == kBin) {
+            return std::string(k.data, k.size);
+        } else if (k.type == kInt) {
+            return Util::itoa(k.i);
+        } else if (k.type == kUint) {
+            return Util::itoa(k.u);
+        }
+        return std::string();
+    }
+
+    // value of key in the map, NULL if not found
+    const Node* find_member(const char *key) const {
+        const Node &m = _nodes[_node];
+        if (m.type != kMap || m.size == 0) {
+            return NULL;
+        }
+        if (0 == _cursor) {
+            _cursor = _node+1;
+            _cursor_i = 0;
+        }
+        size_t len = strlen(key);
+        size_t k = _cursor;
+        uint32_t i = _cursor_i;
+        for (uint32_t c=0; c<m.size; ++c) {
+            const Node &kn = _nodes[k];
+            size_t v = kn.next;
+            size_t nk;
+            if (++i == m.size) {
+                i = 0;
+                nk = _node+1;
+            } else {
+                nk = _nodes[v].next;
+            }
+            if (kn.type==kStr && kn.size==len && 0==memcmp(kn.data, key, len)) {
+                _cursor = nk;
+                _cursor_i = i;
+                return &_nodes[v];
+            }
+            k = nk;
+        }
+        return NULL;
+    }
+
+    const Node* get_node(const char *key, bool &isNull) const {
+        isNull = false;
+        if (NULL == _nodes) {
+            return NULL;
+        }
+        const Node *v = (NULL==key)?&_nodes[_node]:find_member(key);
+        if (NULL != v && v->type == kNil) {
+            isNull = true;
+            return NULL;
+        }
+        return v;
+    }
+
+    MsgPackDecoder& member(size_t index, MsgPackDecoder&d, const Extend *ext) const {
+        (void)ext;
+        if (NULL != _nodes && _nodes[_node].type==kArray) {
+            if (index < (size_t)_nodes[_node].size) {
+                // elements are visited in order normally
+                if (0==_cursor || index<_cursor_i) {
+                    _cursor = _node+1;
+                    _cursor_i = 0;
+                }
+                for (; _cursor_i<index; ++_cursor_i) {
+                    _cursor = _nodes[_cursor].next;
+                }
+                d.init_base(this, index);
+                d.set(_nodes, _cursor);
+            } else {
+                decode_exception("Out of index", NULL);
+            }
+        } else {
+            decode_exception("not array", NULL);
+        }
+
+        return d;
+    }
+
+    MsgPackDecoder& member(const char*key, MsgPackDecoder&d, const Extend *ext) const {
+        (void)ext;
+        if (NULL != _nodes && _nodes[_node].type==kMap) {
+            const Node *v = find_member(key);
+            if (NULL!=v && v->type!=kNil) {
+                d.init_base(this, key);
+                d.set(_nodes, (size_t)(v-_nodes));
+            }
+        } else {
+            decode_exception("not map", key);
+        }
+
+        return d;
+    }
+
+    MsgPackDecoder& member(const Iterator &iter, MsgPackDecoder&d) const {
+        const Node &k = _nodes[iter._key];
+        d._name = key_string(k);
+        d.init_base(iter._parent, d._name.c_str());
+        d.set(_nodes, k.next);
+        return d;
+    }
+
+    void set(const Node *nodes, size_t node) {
+        _nodes = nodes;
+        _node = node;
+        _cursor = 0;
+        _cursor_i = 0;
+    }
+
+    std::vector<Node> _tape;    // all nodes, only the top level decoder has it
+    const Node *_nodes;
+    size_t _node;               // index of this value
+
+    // map: next key to search, array: node of element _cursor_i. 0 if not used
+    mutable size_t _cursor;
+    mutable uint32_t _cursor_i;
+
+    std::string _name;          // key of map iterated by Iterator
+};
+
+}
+
+#endif
@@ -0,0 +1,401 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_MSGPACK_ENCODER_H
+#define __X_PACK_MSGPACK_ENCODER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+
+#include "xencoder.h"
+#include "utf8.h"
+#include "util.h"
+
+namespace xpack {
+
+/*
+  MessagePack(https://msgpack.org) encoder. struct is written as map, numbers use the smallest format
+  that holds the value, float is written as float32.
+  The size of a map/array is unknown when it begins, so 5 bytes are reserved for the header and the
+  output is compacted once in String(), every header becomes the shortest one.
+  vector of numbers is written without the reserved header, F(B64) writes it as bin of little-endian bytes.
+*/
+class MsgPackEncoder:public XEncoder<MsgPackEncoder>, private noncopyable {
+public:
+    friend class XEncoder<MsgPackEncoder>;
+    using xdoc_type::encode;
+
+    MsgPackEncoder():_doc_flag(0) {
+        memset(_keys, 0, sizeof(_keys));
+    }
+
+    inline const char *Type() const {
+        return "msgpack";
+    }
+    inline const char *IndexKey(size_t index) {
+        (void)index;
+        return NULL;
+    }
+
+    bool empty_null(const Extend *ext) const {
+        return Extend::EmptyNull(ext);
+    }
+
+    // X_PACK_DOC_FLAG_xxx
+    void SetDocFlag(int docFlag) {
+        _doc_flag = docFlag;
+    }
+
+    void Reserve(size_t size) {
+        _buf.reserve(size);
+    }
+
+    std::string String() const {
+        if (_headers.empty()) {
+            return _buf;
+        }
+        std::string out;
+        out.reserve(_buf.size());
+        size_t last = 0;
+        for (size_t i=0; i<_headers.size(); ++i) {
+            const Header &h = _headers[i];
+            out.append(_buf, last, h.pos-last);
+            char tmp[5];
+            out.append(tmp, h.map?map_header(tmp, h.count):array_header(tmp, h.count));
+            last = h.pos+RESERVED;
+        }
+        out.append(_buf, last, std::string::npos);
+        return out;
+    }
+
+    void ArrayBegin(const char *key, const Extend *ext) {
+        begin(key, ext, false);
+    }
+    void ArrayEnd(const char *key, const Extend *ext) {
+        (void)key;
+        (void)ext;
+        _stack.pop_back();
+    }
+    void ObjectBegin(const char *key, const Extend *ext) {
+        begin(key, ext, true);
+    }
+    void ObjectEnd(const char *key, const Extend *ext) {
+        (void)key;
+        (void)ext;
+        _stack.pop_back();
+    }
+
+    bool writeNull(const char*key, const Extend *ext) {
+        set_key(key, ext);
+        _buf.push_back('\xc0');
+        return true;
+    }
+
+    #define X_PACK_MSGPACK_ENCODE(cond, val)    \
+        if ((cond)) {                           \
+            if (Extend::OmitEmpty(ext)) {       \
+                return false;                   \
+            } else if (Extend::EmptyNull(ext)) {\
+                return writeNull(key, ext);     \
+            }                                   \
+        }                                       \
+        set_key(key, ext);                           \
+        put(val);                               \
+        return true
+
+    bool encode(const char*key, const std::string &val, const Extend *ext) {
+        if ((_doc_flag&X_PACK_DOC_FLAG_UTF8) && !Utf8::Valid(val.data(), val.length())) {
+            throw std::runtime_error(std::string("Invalid utf-8 string. key=")+(NULL!=key?key:""));
+        }
+        if (val.empty()) {
+            if (Extend::OmitEmpty(ext)) {
+                return false;
+            } else if (Extend::EmptyNull(ext)) {
+                return writeNull(key, ext);
+            }
+        }
+        set_key(key, ext);
+        put_str(val.data(), val.length());
+        return true;
+    }
+    bool encode(const char*key, const bool &val, const Extend *ext) {
+        if (!val) {
+            if (Extend::OmitEmpty(ext)) {
+                return false;
+            } else if (Extend::EmptyNull(ext)) {
+                return writeNull(key, ext);
+            }
+        }
+        set_key(key, ext);
+        _buf.push_back(val?'\xc3':'\xc2');
+        return true;
+    }
+    bool encode(const char*key, const char &val, const Extend *ext) {
+        X_PACK_MSGPACK_ENCODE(val==0, val);
+    }
+    bool encode(const char*key, const signed char &val, const Extend *ext) {
+        X_PACK_MSGPACK_ENCODE(val==0, val);
+    }
+    bool encode(const char*key, const unsigned char &val, const Extend *ext) {
+        X_PACK_MSGPACK_ENCODE(val==0, val);
+    }
+    bool encode(const char*key, const short & val, const Extend *ext) {
+        X_PACK_MSGPACK_ENCODE(val==0, val);
+    }
+    bool encode(const char*key, const unsigned short & val, const Extend *ext) {
+        X_PACK_MSGPACK_ENCODE(val==0, val);
+    }
+    bool encode(const char*key, const int& val, const Extend *ext) {
+        X_PACK_MSGPACK_ENCODE(val==0, val);
+    }
+    bool encode(const char*key, const unsigned int& val, const Extend *ext) {
+        X_PACK_MSGPACK_ENCODE(val==0, val);
+    }
+    bool encode(const char*key, const long &val, const Extend *ext) {
+        X_PACK_MSGPACK_ENCODE(val==0, val);
+    }
+    bool encode(const char*key, const unsigned long &val, const Extend *ext) {
+        X_PACK_MSGPACK_ENCODE(val==0, val);
+    }
+    bool encode(const char*key, const long long& val, const Extend *ext) {
+        X_PACK_MSGPACK_ENCODE(val==0, val);
+    }
+    bool encode(const char*key, const unsigned long long & val, const Extend *ext) {
+        X_PACK_MSGPACK_ENCODE(val==0, val);
+    }
+    bool encode(const char*key, const float & val, const Extend *ext) {
+        X_PACK_MSGPACK_ENCODE(val==0, val);
+    }
+    bool encode(const char*key, const double & val, const Extend *ext) {
+        X_PACK_MSGPACK_ENCODE(val==0, val);
+    }
+    bool encode(const char*key, const long double & val, const Extend *ext) {
+        X_PACK_MSGPACK_ENCODE(val==0, val);
+    }
+    #undef X_PACK_MSGPACK_ENCODE
+
+    // vector of numbers, the size is known, so the elements are written directly
+    template <class T>
+    typename x_enable_if<numeric<T>::value, bool>::type encode(const char*key, const std::vector<T> &val, const Extend *ext) {
+        if (val.empty() || Extend::Blob(ext)) {
+            return xdoc_type::encode(key, val, ext);
+        }
+        set_key(key, ext);
+        char tmp[5];
+        _buf.append(tmp, array_header(tmp, val.size()));
+        for (size_t i=0; i<val.size(); ++i) {
+            put(val[i]);
+        }
+        return true;
+    }
+    template <class T>
+    typename x_enable_if<!numeric<T>::value, bool>::type encode(const char*key, const std::vector<T> &val, const Extend *ext) {
+        return xdoc_type::encode(key, val, ext);
+    }
+
+    // F(B64), raw bytes as bin
+    bool encode_blob(const char*key, const void *data, size_t len, const Extend *ext) {
+        set_key(key, ext);
+        char tmp[5];
+        if (len <= 0xff) {
+            tmp[0] = '\xc4';
+            tmp[1] = (char)len;
+            _buf.append(tmp, 2);
+        } else if (len <= 0xffff) {
+            _buf.append(tmp, be(tmp, '\xc5', len, 2));
+        } else {
+            _buf.append(tmp, be(tmp, '\xc6', len, 4));
+        }
+        _buf.append((const char*)data, len);
+        return true;
+    }
+
+    // map<int, T>, key is written as string, same as json
+    template <class K, class T>
+    typename x_enable_if<numeric<K>::is_integer, bool>::type encode(const char*key, const std::map<K,T>& val, const Extend *ext) {
+        return this->template encode_map<const std::map<K,T>, K>(key, val, ext, Util::itoa);
+    }
+
+    #ifdef X_PACK_SUPPORT_CXX0X
+    template <class K, class T>
+    typename x_enable_if<std::is_enum<K>::value, bool>::type encode(const char*key, const std::map<K,T>& val, const Extend *ext) {
+        return this->template encode_map<const std::map<K,T>, K>(key, val, ext, Util::itoa);
+    }
+    #endif
+
+private:
+    static const size_t RESERVED = 5; // map32/array32 header
+    static const size_t KEY_SLOTS = 64;
+
+    // length of a static key by its pointer, see JsonKeyCache
+    struct KeySlot {
+        const char *key;
+        size_t len;
+    };
+
+    struct Header {
+        size_t pos;     // offset of the reserved bytes in _buf
+        size_t count;   // elements of array, pairs of map
+        bool map;
+        Header(size_t _pos, bool _map):pos(_pos), count(0), map(_map) {}
+    };
+
+    void begin(const char *key, const Extend *ext, bool map) {
+        set_key(key, ext);
+        _stack.push_back(_headers.size());
+        _headers.push_back(Header(_buf.size(), map));
+        _buf.append(RESERVED, '\0');
+    }
+
+    // every value calls it before written, count the value in the current container, and write the key in map
+    void set_key(const char *key, const Extend *ext) {
+        if (_stack.empty()) {
+            return;
+        }
+        Header &h = _headers[_stack.back()];
+        ++h.count;
+        if (h.map) {
+            if (NULL == key) {
+                put_str("", 0);
+            } else if (NULL != ext && ext->key == key) { // static key of XPACK, the length is computed once
+                KeySlot &k = _keys[((size_t)key>>3)%KEY_SLOTS];
+                if (k.key != key) {
+                    k.key = key;
+                    k.len = strlen(key);
+                }
+                put_str(key, k.len);
+            } else {
+                put_str(key, strlen(key));
+            }
+        }
+    }
+
+    // write type and the big-endian value of n bytes to out, return the length
+    static size_t be(char *out, char type, uint64_t val, size_t n) {
+        out[0] = type;
+        for (size_t i=n; i>0; --i) {
+            out[i] = (char)(val&0xff);
+            val >>= 8;
+        }
+        return n+1;
+    }
+    static size_t array_header(char *out, size_t n) {
+        if (n <= 15) {
+            out[0] = (char)(0x90|n);
+            return 1;
+        } else if (n <= 0xffff) {
+            return be(out, '\xdc', n, 2);
+        }
+        return be(out, '\xdd', n, 4);
+    }
+    static size_t map_header(char *out, size_t n) {
+        if (n <= 15) {
+            out[0] = (char)(0x80|n);
+            return 1;
+        } else if (n <= 0xffff) {
+            return be(out, '\xde', n, 2);
+        }
+        return be(out, '\xdf', n, 4);
+    }
+
+    void put_str(const char *data, size_t len) {
+        char tmp[5];
+        if (len <= 31) {
+            _buf.push_back((char)(0xa0|len));
+        } else if (len <= 0xff) {
+            tmp[0] = '\xd9';
+            tmp[1] = (char)len;
+            _buf.append(tmp, 2);
+        } else if (len <= 0xffff) {
+            _buf.append(tmp, be(tmp, '\xda', len, 2));
+        } else {
+            _buf.append(tmp, be(tmp, '\xdb', len, 4));
+        }
+        _buf.append(data, len);
+    }
+
+    void put_uint(uint64_t val) {
+        char tmp[9];
+        if (val <= 0x7f) {
+            _buf.push_back((char)val);
+        } else if (val <= 0xff) {
+            _buf.append(tmp, be(tmp, '\xcc', val, 1));
+        } else if (val <= 0xffff) {
+            _buf.append(tmp, be(tmp, '\xcd', val, 2));
+        } else if (val <= 0xffffffffULL) {
+            _buf.append(tmp, be(tmp, '\xce', val, 4));
+        } else {
+            _buf.append(tmp, be(tmp, '\xcf', val, 8));
+        }
+    }
+    void put_int(int64_t val) {
+        char tmp[9];
+        if (val >= 0) {
+            put_uint((uint64_t)val);
+        } else if (val >= -32) {
+            _buf.push_back((char)val);
+        } else if (val >= -128) {
+            _buf.append(tmp, be(tmp, '\xd0', (uint64_t)val, 1));
+        } else if (val >= -32768) {
+            _buf.append(tmp, be(tmp, '\xd1', (uint64_t)val, 2));
+        } else if (val >= -2147483647LL-1) {
+            _buf.append(tmp, be(tmp, '\xd2', (uint64_t)val, 4));
+        } else {
+            _buf.append(tmp, be(tmp, '\xd3', (uint64_t)val, 8));
+        }
+    }
+
+    void put(char val) { put_int(val); }
+    void put(signed char val) { put_int(val); }
+    void put(unsigned char val) { put_uint(val); }
+    void put(short val) { put_int(val); }
+    void put(unsigned short val) { put_uint(val); }
+    void put(int val) { put_int(val); }
+    void put(unsigned int val) { put_uint(val); }
+    void put(long val) { put_int(val); }
+    void put(unsigned long val) { put_uint(val); }
+    void put(long long val) { put_int(val); }
+    void put(unsigned long long val) { put_uint(val); }
+    void put(float val) {
+        uint32_t bits;
+        memcpy(&bits, &val, sizeof(bits));
+        char tmp[5];
+        _buf.append(tmp, be(tmp, '\xca', bits, 4));
+    }
+    void put(double val) {
+        uint64_t bits;
+        memcpy(&bits, &val, sizeof(bits));
+        char tmp[9];
+        _buf.append(tmp, be(tmp, '\xcb', bits, 8));
+    }
+    void put(long double val) {
+        put((double)val);
+    }
+
+    std::string _buf;
+    std::vector<Header> _headers;   // in the order of position
+    std::vector<size_t> _stack;     // index in _headers of the open containers
+    KeySlot _keys[KEY_SLOTS];
+    int _doc_flag;
+};
+
+}
+
+#endif
@@ -0,0 +1,170 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_SINK_H
+#define __X_PACK_SINK_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <stdexcept>
+
+#include <cstdio>
+#include <errno.h>
+#ifdef _MSC_VER
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "traits.h"
+
+namespace xpack {
+
+/*
+  Output destination of encoders. The encoder writes into a small staging buffer
+  and hands it to the sink when it's full, so the whole output is never materialized.
+  Implement Write to support other destinations.
+*/
+class Sink {
+public:
+    virtual ~Sink() {}
+    virtual void Write(const char *data, size_t len) = 0;
+};
+
+// append to std::string
+class StringSink:public Sink {
+public:
+    StringSink(std::string &out):_out(out) {}
+    void Write(const char *data, size_t len) {
+        _out.append(data, len);
+    }
+private:
+    std::string &_out;
+};
+
+// append to std::vector<char>
+class VectorSink:public Sink {
+public:
+    VectorSink(std::vector<char> &out):_out(out) {}
+    void Write(const char *data, size_t len) {
+        _out.insert(_out.end(), data, data+len);
+    }
+private:
+    std::vector<char> &_out;
+};
+
+// write to std::ostream
+class OStreamSink:public Sink {
+public:
+    OStreamSink(std::ostream &out):_out(out) {}
+    void Write(const char *data, size_t len) {
+        _out.write(data, (std::streamsize)len);
+        if (!_out) {
+            throw std::runtime_error("write ostream fail");
+        }
+    }
+private:
+    std::ostream &_out;
+};
+
+// write to file descriptor, the fd is not closed
+class FdSink:public Sink {
+public:
+    FdSink(int fd):_fd(fd) {}
+    void Write(const char *data, size_t len) {
+        while (len > 0) {
+            #ifdef _MSC_VER
+            int n = _write(_fd, data, (unsigned int)len);
+            #else
+            ssize_t n = write(_fd, data, len);
+            #endif
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("write fd fail");
+            }
+            data += n;
+            len -= (size_t)n;
+        }
+    }
+private:
+    int _fd;
+};
+
+// write to file, created or truncated. Close to check the error of the last write
+class FileSink:public Sink, private noncopyable {
+public:
+    FileSink(const std::string &file_name):_name(file_name) {
+        _fp = fopen(file_name.c_str(), "wb");
+        if (NULL == _fp) {
+            throw std::runtime_error("open file fail. file="+file_name);
+        }
+    }
+    ~FileSink() {
+        if (NULL != _fp) {
+            fclose(_fp);
+            _fp = NULL;
+        }
+    }
+    void Write(const char *data, size_t len) {
+        if (fwrite(data, 1, len, _fp) != len) {
+            throw std::runtime_error("write file fail. file="+_name);
+        }
+    }
+    void Close() {
+        FILE *fp = _fp;
+        _fp = NULL;
+        if (NULL != fp && 0 != fclose(fp)) {
+            throw std::runtime_error("close file fail. file="+_name);
+        }
+    }
+private:
+    std::string _name;
+    FILE *_fp;
+};
+
+// drop the data, only count the bytes
+class SizeSink:public Sink {
+public:
+    SizeSink():_size(0) {}
+    void Write(const char *data, size_t len) {
+        (void)data;
+        _size += len;
+    }
+    size_t Size() const {
+        return _size;
+    }
+private:
+    size_t _size;
+};
+
+// call f(data, len) for every block
+template <class F>
+class CallbackSink:public Sink {
+public:
+    CallbackSink(F f):_f(f) {}
+    void Write(const char *data, size_t len) {
+        _f(data, len);
+    }
+private:
+    F _f;
+};
+
+}
+
+#endif
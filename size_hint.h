@@ -0,0 +1,95 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_SIZE_HINT_H
+#define __X_PACK_SIZE_HINT_H
+
+#include <cstddef>
+
+#include "traits.h"
+
+#ifdef X_PACK_SUPPORT_CXX0X
+#include <atomic>
+#endif
+
+namespace xpack {
+
+// the largest buffer reserved by a hint, outputs bigger than it grow the buffer as usual
+#ifndef XPACK_SIZE_HINT_MAX
+#define XPACK_SIZE_HINT_MAX (1<<20)
+#endif
+
+/*
+  Encoded size statistics of type T written by ENCODER(e.g. JsonCompactEncoder and JsonPrettyEncoder
+  are counted apart), used to reserve the output buffer up front.
+  It's an exponential moving average(1/4 weight of the new sample), so it decays toward the recent
+  sizes, and the hint is the average plus 1/4. Samples and hint are capped by XPACK_SIZE_HINT_MAX,
+  so a rare huge output neither reserves huge buffers later nor takes long to decay.
+  Shared by all threads, in c++03 the race is benign(a lost update just makes the average lag).
+*/
+template <class T, class ENCODER>
+class SizeHint {
+public:
+    static size_t Get() {
+        size_t avg = load();
+        size_t hint = avg + avg/4;
+        return hint<(size_t)XPACK_SIZE_HINT_MAX?hint:(size_t)XPACK_SIZE_HINT_MAX;
+    }
+
+    static void Update(size_t size) {
+        if (size > (size_t)XPACK_SIZE_HINT_MAX) {
+            size = XPACK_SIZE_HINT_MAX;
+        }
+        size_t avg = load();
+        if (avg == 0) {
+            avg = size;
+        } else if (size > avg) {
+            avg += (size-avg+3)/4;
+        } else {
+            avg -= (avg-size+3)/4;
+        }
+        store(avg);
+    }
+
+private:
+    #ifdef X_PACK_SUPPORT_CXX0X
+    static std::atomic<size_t>& avg() {
+        static std::atomic<size_t> a(0);
+        return a;
+    }
+    static size_t load() {
+        return avg().load(std::memory_order_relaxed);
+    }
+    static void store(size_t v) {
+        avg().store(v, std::memory_order_relaxed);
+    }
+    #else
+    static size_t& avg() {
+        static size_t a = 0;
+        return a;
+    }
+    static size_t load() {
+        return avg();
+    }
+    static void store(size_t v) {
+        avg() = v;
+    }
+    #endif
+};
+
+}
+
+#endif
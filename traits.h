@@ -37,6 +37,12 @@ struct is_xpack_out{static bool const value = false;};
 template <class T>
 struct is_xpack_xtype {static bool const value = false;};
 
+// an address unique to each type, a type id without rtti
+template <class T>
+struct x_type_tag {static char const value;};
+template <class T>
+char const x_type_tag<T>::value = 0;
+
 
 // for bitfield, declare raw type. thx https://stackoverflow.com/a/12199635/5845104
 template<int N> struct x_size { char value[N]; };
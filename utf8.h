@@ -0,0 +1,298 @@
+/*
+* Copyright (C) 2021 Duowan Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __X_PACK_UTF8_H
+#define __X_PACK_UTF8_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+/*
+  UTF-8 validation(RFC 3629: no overlong, no surrogate, no code point above U+10FFFF).
+  The SIMD version validates 16(SSSE3) or 32(AVX2) bytes per step, multibyte characters included,
+  with the lookup algorithm of simdjson(Keiser & Lemire, "Validating UTF-8 In Less Than One
+  Instruction Per Byte"): the error class of each pair of adjacent bytes is looked up by nibbles
+  with pshufb, and 3/4 byte characters are checked by the bytes 2 and 3 positions back.
+  Pure ASCII blocks take one test. If the SIMD version finds an error, the scalar checker runs
+  again to locate it. The version is selected at runtime by cpuid, so the binary still runs on
+  cpu without AVX2/SSSE3. Define XPACK_UTF8_NO_SIMD to always use the scalar version.
+*/
+#if !defined(XPACK_UTF8_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define X_PACK_UTF8_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace xpack {
+
+class Utf8 {
+public:
+    // return true if [data, data+len) is valid UTF-8. if invalid and offset is not NULL, offset is set to the first invalid byte
+    static bool Valid(const char *data, size_t len, size_t *offset = NULL) {
+        const unsigned char *p = (const unsigned char*)data;
+        if (simd()(p, len)) {
+            return true;
+        }
+        size_t i = 0;
+        while (i < len) {
+            while (i < len && p[i] < 0x80) {
+                ++i;
+            }
+            if (i < len && !scalar(p, len, i)) {
+                if (NULL != offset) {
+                    *offset = i;
+                }
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool Valid(const std::string &str, size_t *offset = NULL) {
+        return Valid(str.data(), str.length(), offset);
+    }
+
+    // the name of the implementation selected at runtime, for debug
+    static const char *Impl() {
+        valid_func f = simd();
+        #ifdef X_PACK_UTF8_SIMD
+        if (f == valid_avx2) {
+            return "avx2";
+        } else if (f == valid_ssse3) {
+            return "ssse3";
+        }
+        #endif
+        (void)f;
+        return "scalar";
+    }
+
+private:
+    // return true if valid. false means invalid, or there's no simd version(the scalar checker decides)
+    typedef bool (*valid_func)(const unsigned char*, size_t);
+
+    // the selected function is cached in a static, the race in c++03 is benign(always the same value)
+    static valid_func simd() {
+        static valid_func f = select();
+        return f;
+    }
+
+    static valid_func select() {
+        #ifdef X_PACK_UTF8_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return valid_avx2;
+        } else if (__builtin_cpu_supports("ssse3")) {
+            return valid_ssse3;
+        }
+        #endif
+        return valid_none;
+    }
+
+    static bool valid_none(const unsigned char *p, size_t len) {
+        (void)p;
+        (void)len;
+        return false;
+    }
+
+    #ifdef X_PACK_UTF8_SIMD
+    // error classes of two adjacent bytes
+    enum {
+        TOO_SHORT = 1<<0,       // 11______ 0_______ or 11______ 11______
+        TOO_LONG = 1<<1,        // 0_______ 10______
+        OVERLONG_3 = 1<<2,      // 11100000 100_____
+        TOO_LARGE = 1<<3,       // 11110100 1001____, 11110100 101_____, 11110101+ 10______
+        SURROGATE = 1<<4,       // 11101101 101_____
+        OVERLONG_2 = 1<<5,      // 1100000_ 10______
+        TOO_LARGE_1000 = 1<<6,  // 11110101+ 1000____
+        OVERLONG_4 = 1<<6,      // 11110000 1000____
+        TWO_CONTS = 1<<7,       // 10______ 10______
+        CARRY = TOO_SHORT|TOO_LONG|TWO_CONTS
+    };
+
+    #define X_PACK_UTF8_BYTE_1_HIGH \
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, \
+        TOO_SHORT|OVERLONG_2, TOO_SHORT, TOO_SHORT|OVERLONG_3|SURROGATE, \
+        TOO_SHORT|TOO_LARGE|TOO_LARGE_1000|OVERLONG_4
+    #define X_PACK_UTF8_BYTE_1_LOW \
+        CARRY|OVERLONG_3|OVERLONG_2|OVERLONG_4, CARRY|OVERLONG_2, CARRY, CARRY, \
+        CARRY|TOO_LARGE, CARRY|TOO_LARGE|TOO_LARGE_1000, CARRY|TOO_LARGE|TOO_LARGE_1000, CARRY|TOO_LARGE|TOO_LARGE_1000, \
+        CARRY|TOO_LARGE|TOO_LARGE_1000, CARRY|TOO_LARGE|TOO_LARGE_1000, CARRY|TOO_LARGE|TOO_LARGE_1000, CARRY|TOO_LARGE|TOO_LARGE_1000, \
+        CARRY|TOO_LARGE|TOO_LARGE_1000, CARRY|TOO_LARGE|TOO_LARGE_1000|SURROGATE, CARRY|TOO_LARGE|TOO_LARGE_1000, CARRY|TOO_LARGE|TOO_LARGE_1000
+    #define X_PACK_UTF8_BYTE_2_HIGH \
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+        TOO_LONG|OVERLONG_2|TWO_CONTS|OVERLONG_3|TOO_LARGE_1000|OVERLONG_4, \
+        TOO_LONG|OVERLONG_2|TWO_CONTS|OVERLONG_3|TOO_LARGE, \
+        TOO_LONG|OVERLONG_2|TWO_CONTS|SURROGATE|TOO_LARGE, TOO_LONG|OVERLONG_2|TWO_CONTS|SURROGATE|TOO_LARGE, \
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+    // a lead byte of 2/3/4 bytes character in the last 1/2/3 bytes needs more bytes in the next block
+    #define X_PACK_UTF8_INCOMPLETE \
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char)(0xf0-1), (char)(0xe0-1), (char)(0xc0-1)
+
+    __attribute__((target("ssse3")))
+    static __m128i check_ssse3(__m128i in, __m128i prev_in) {
+        const __m128i b1h = _mm_setr_epi8(X_PACK_UTF8_BYTE_1_HIGH);
+        const __m128i b1l = _mm_setr_epi8(X_PACK_UTF8_BYTE_1_LOW);
+        const __m128i b2h = _mm_setr_epi8(X_PACK_UTF8_BYTE_2_HIGH);
+        const __m128i nibble = _mm_set1_epi8(0x0f);
+
+        __m128i prev1 = _mm_alignr_epi8(in, prev_in, 15);
+        __m128i sc = _mm_and_si128(_mm_and_si128(
+                _mm_shuffle_epi8(b1h, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                _mm_shuffle_epi8(b1l, _mm_and_si128(prev1, nibble))),
+                _mm_shuffle_epi8(b2h, _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+
+        __m128i prev2 = _mm_alignr_epi8(in, prev_in, 14);
+        __m128i prev3 = _mm_alignr_epi8(in, prev_in, 13);
+        __m128i must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xe0-0x80))),
+                                      _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xf0-0x80))));
+        return _mm_xor_si128(_mm_and_si128(must23, _mm_set1_epi8((char)0x80)), sc);
+    }
+
+    __attribute__((target("ssse3")))
+    static bool valid_ssse3(const unsigned char *p, size_t len) {
+        const __m128i incomplete = _mm_setr_epi8(X_PACK_UTF8_INCOMPLETE);
+        __m128i err = _mm_setzero_si128();
+        __m128i prev_in = _mm_setzero_si128();
+        __m128i prev_incomplete = _mm_setzero_si128();
+        unsigned char tail[16];
+        for (size_t i=0; i<len; i+=16) {
+            __m128i in;
+            if (i+16 <= len) {
+                in = _mm_loadu_si128((const __m128i*)(p+i));
+            } else { // padded by ascii
+                memset(tail, 0, sizeof(tail));
+                memcpy(tail, p+i, len-i);
+                in = _mm_loadu_si128((const __m128i*)tail);
+            }
+            if (0 == _mm_movemask_epi8(in)) {
+                err = _mm_or_si128(err, prev_incomplete);
+            } else {
+                err = _mm_or_si128(err, check_ssse3(in, prev_in));
+                prev_incomplete = _mm_subs_epu8(in, incomplete);
+            }
+            prev_in = in;
+        }
+        err = _mm_or_si128(err, prev_incomplete);
+        return 0xffff == _mm_movemask_epi8(_mm_cmpeq_epi8(err, _mm_setzero_si128()));
+    }
+
+    __attribute__((target("avx2")))
+    static __m256i check_avx2(__m256i in, __m256i prev_in) {
+        const __m256i b1h = _mm256_setr_epi8(X_PACK_UTF8_BYTE_1_HIGH, X_PACK_UTF8_BYTE_1_HIGH);
+        const __m256i b1l = _mm256_setr_epi8(X_PACK_UTF8_BYTE_1_LOW, X_PACK_UTF8_BYTE_1_LOW);
+        const __m256i b2h = _mm256_setr_epi8(X_PACK_UTF8_BYTE_2_HIGH, X_PACK_UTF8_BYTE_2_HIGH);
+        const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+        // the high 128 bits of prev_in and the low 128 bits of in, so alignr works across the lanes
+        __m256i cross = _mm256_permute2x128_si256(prev_in, in, 0x21);
+        __m256i prev1 = _mm256_alignr_epi8(in, cross, 15);
+        __m256i sc = _mm256_and_si256(_mm256_and_si256(
+                _mm256_shuffle_epi8(b1h, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                _mm256_shuffle_epi8(b1l, _mm256_and_si256(prev1, nibble))),
+                _mm256_shuffle_epi8(b2h, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble)));
+
+        __m256i prev2 = _mm256_alignr_epi8(in, cross, 14);
+        __m256i prev3 = _mm256_alignr_epi8(in, cross, 13);
+        __m256i must23 = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xe0-0x80))),
+                                         _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xf0-0x80))));
+        return _mm256_xor_si256(_mm256_and_si256(must23, _mm256_set1_epi8((char)0x80)), sc);
+    }
+
+    __attribute__((target("avx2")))
+    static bool valid_avx2(const unsigned char *p, size_t len) {
+        const __m256i incomplete = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, X_PACK_UTF8_INCOMPLETE);
+        __m256i err = _mm256_setzero_si256();
+        __m256i prev_in = _mm256_setzero_si256();
+        __m256i prev_incomplete = _mm256_setzero_si256();
+        unsigned char tail[32];
+        for (size_t i=0; i<len; i+=32) {
+            __m256i in;
+            if (i+32 <= len) {
+                in = _mm256_loadu_si256((const __m256i*)(p+i));
+            } else { // padded by ascii
+                memset(tail, 0, sizeof(tail));
+                memcpy(tail, p+i, len-i);
+                in = _mm256_loadu_si256((const __m256i*)tail);
+            }
+            if (0 == _mm256_movemask_epi8(in)) {
+                err = _mm256_or_si256(err, prev_incomplete);
+            } else {
+                err = _mm256_or_si256(err, check_avx2(in, prev_in));
+                prev_incomplete = _mm256_subs_epu8(in, incomplete);
+            }
+            prev_in = in;
+        }
+        err = _mm256_or_si256(err, prev_incomplete);
+        return _mm256_testz_si256(err, err);
+    }
+    #undef X_PACK_UTF8_BYTE_1_HIGH
+    #undef X_PACK_UTF8_BYTE_1_LOW
+    #undef X_PACK_UTF8_BYTE_2_HIGH
+    #undef X_PACK_UTF8_INCOMPLETE
+    #endif
+
+    // check multibyte characters start from i, stop at the next ascii byte
+    static bool scalar(const unsigned char *p, size_t len, size_t &i) {
+        while (i < len) {
+            unsigned char c = p[i];
+            if (c < 0x80) {
+                return true;
+            }
+
+            size_t n;
+            unsigned char lo = 0x80;
+            unsigned char hi = 0xBF;
+            if (c >= 0xC2 && c <= 0xDF) {
+                n = 1;
+            } else if (c >= 0xE0 && c <= 0xEF) {
+                n = 2;
+                if (c == 0xE0) {
+                    lo = 0xA0;      // overlong
+                } else if (c == 0xED) {
+                    hi = 0x9F;      // surrogate
+                }
+            } else if (c >= 0xF0 && c <= 0xF4) {
+                n = 3;
+                if (c == 0xF0) {
+                    lo = 0x90;      // overlong
+                } else if (c == 0xF4) {
+                    hi = 0x8F;      // > U+10FFFF
+                }
+            } else {
+                return false;
+            }
+
+            if (i+n >= len) {
+                return false;       // truncated
+            }
+            if (p[i+1]<lo || p[i+1]>hi) {
+                return false;
+            }
+            for (size_t k=2; k<=n; ++k) {
+                if (p[i+k]<0x80 || p[i+k]>0xBF) {
+                    return false;
+                }
+            }
+            i += n+1;
+        }
+        return true;
+    }
+};
+
+}
+
+#endif
@@ -22,6 +22,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "traits.h"
 #include "numeric.h"
@@ -177,6 +178,41 @@ public:
         std::string _t(s);
         return atoi(_t, val);
     }
+
+    // fast non-cryptographic hash(MurmurHash64A), 8 bytes per round
+    static uint64_t hash(const void *data, size_t len, uint64_t seed = 0) {
+        const uint64_t m = 0xc6a4a7935bd1e995ULL;
+        const int r = 47;
+        uint64_t h = seed ^ (len * m);
+
+        const unsigned char *p = (const unsigned char*)data;
+        const unsigned char *end = p + (len & ~(size_t)7);
+        for (; p != end; p += 8) {
+            uint64_t k;
+            memcpy(&k, p, sizeof(k));
+            k *= m;
+            k ^= k >> r;
+            k *= m;
+            h ^= k;
+            h *= m;
+        }
+
+        switch (len & 7) {
+          case 7: h ^= uint64_t(p[6]) << 48; // fall through
+          case 6: h ^= uint64_t(p[5]) << 40; // fall through
+          case 5: h ^= uint64_t(p[4]) << 32; // fall through
+          case 4: h ^= uint64_t(p[3]) << 24; // fall through
+          case 3: h ^= uint64_t(p[2]) << 16; // fall through
+          case 2: h ^= uint64_t(p[1]) << 8;  // fall through
+          case 1: h ^= uint64_t(p[0]);
+                  h *= m;
+        }
+
+        h ^= h >> r;
+        h *= m;
+        h ^= h >> r;
+        return h;
+    }
 };
 
 }
@@ -26,6 +26,8 @@
 
 #include "extend.h"
 #include "traits.h"
+#include "numeric.h"
+#include "base64.h"
 
 #include "string.h"
 
@@ -119,9 +121,27 @@ public:
     // vector
     template <class T>
     inline bool decode(const char*key, std::vector<T> &val, const Extend *ext) {
+        if (Extend::Blob(ext)) {
+            return this->decode_blob(key, val, ext);
+        }
+        return ((doc_type*)this)->decode_columns(key, val, ext);
+    }
+    // json also accepts the layout of F(COL) for vector of struct
+    template <class T>
+    inline bool decode_columns(const char*key, std::vector<T> &val, const Extend *ext) {
         return this->decode_vector(key, val, ext);
     }
 
+    // F(B64), base64 text of the value. the default reads it into tmp, json points to the document
+    bool decode_blob(const char*key, std::string &tmp, const char *&data, size_t &len, const Extend *ext) {
+        if (!((doc_type*)this)->decode(key, tmp, ext)) {
+            return false;
+        }
+        data = tmp.data();
+        len = tmp.length();
+        return true;
+    }
+
     // list
     template <class T>
     inline bool decode(const char*key, std::list<T> &val, const Extend *ext) {
@@ -302,6 +322,35 @@ public:
     }
 
 protected:
+    // decoded into the storage of vector directly
+    template <class T>
+    typename x_enable_if<numeric<T>::value, bool>::type decode_blob(const char*key, std::vector<T> &val, const Extend *ext) {
+        std::string tmp;
+        const char *data = NULL;
+        size_t len = 0;
+        if (!((doc_type*)this)->decode_blob(key, tmp, data, len, ext)) {
+            return false;
+        }
+        size_t n = Base64::DecodedLength(data, len);
+        if (n==(size_t)-1 || n%sizeof(T)!=0) {
+            decode_exception("invalid base64 blob", key);
+        }
+        val.resize(n/sizeof(T));
+        if (n > 0) {
+            if (!Base64::Decode(data, len, &val[0])) {
+                decode_exception("invalid base64 blob", key);
+            }
+            if (sizeof(T)>1 && !Base64::LittleEndian()) {
+                Base64::SwapBytes(&val[0], sizeof(T), val.size());
+            }
+        }
+        return true;
+    }
+    template <class T>
+    typename x_enable_if<!numeric<T>::value, bool>::type decode_blob(const char*key, std::vector<T> &val, const Extend *ext) {
+        return this->decode_vector(key, val, ext); // only for numbers
+    }
+
     // vector
     template <class Vector>
     bool decode_vector(const char*key, Vector &val, const Extend *ext) {
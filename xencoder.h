@@ -26,6 +26,7 @@
 #include "extend.h"
 #include "traits.h"
 #include "numeric.h"
+#include "base64.h"
 
 #ifdef XPACK_SUPPORT_QT
 #include <QString>
@@ -70,7 +71,7 @@ public:
     // for array
     template <class T, size_t N>
     inline bool encode(const char*key, const T (&val)[N], const Extend *ext) {
-        return this->encode(key, val, N, ext);
+        return ((doc_type*)this)->encode(key, val, N, ext);
     }
 
     template <class T>
@@ -94,9 +95,25 @@ public:
     // vector
     template <class T>
     inline bool encode(const char*key, const std::vector<T> &val, const Extend *ext) {
+        if (Extend::Blob(ext)) {
+            return encode_blob(key, val, ext);
+        } else if (Extend::Columns(ext)) {
+            return ((doc_type*)this)->encode_columns(key, val, ext);
+        }
+        return encode_list<std::vector<T> >(key, val, ext);
+    }
+    // F(COL), only json supports it
+    template <class T>
+    inline bool encode_columns(const char*key, const std::vector<T> &val, const Extend *ext) {
         return encode_list<std::vector<T> >(key, val, ext);
     }
 
+    // F(B64), the bytes are written as a base64 string. json writes it into the buffer directly
+    bool encode_blob(const char*key, const void *data, size_t len, const Extend *ext) {
+        std::string str = Base64::Encode(data, len);
+        return ((doc_type*)this)->encode(key, str, ext);
+    }
+
     // list
     template <class T>
     inline bool encode(const char*key, const std::list<T> &val, const Extend *ext) {
@@ -116,7 +133,7 @@ public:
     // map
     template <class T>
     inline bool encode(const char*key, const std::map<std::string, T> &val, const Extend *ext) {
-        return encode_map<const std::map<std::string,T>, std::string>(key, val, ext, strToStr);
+        return encode_str_map<const std::map<std::string,T> >(key, val, ext);
     }
 
     // class/struct that defined XPACK
@@ -141,7 +158,7 @@ public:
     // unordered_map
     template <class T>
     inline bool encode(const char*key, const std::unordered_map<std::string, T> &val, const Extend *ext) {
-        return encode_map<const std::unordered_map<std::string,T>, std::string>(key, val, ext, strToStr);
+        return encode_str_map<const std::unordered_map<std::string,T> >(key, val, ext);
     }
 
     // shared_ptr
@@ -255,6 +272,26 @@ public:
         return true;
     }
 
+    template <class T>
+    typename x_enable_if<numeric<T>::value, bool>::type encode_blob(const char*key, const std::vector<T> &val, const Extend *ext) {
+        size_t s = val.size();
+        XPACK_WRITE_EMPTY((s==0))
+
+        doc_type *dt = (doc_type*)this;
+        if (s == 0) {
+            return dt->encode_blob(key, NULL, 0, ext);
+        } else if (sizeof(T)==1 || Base64::LittleEndian()) {
+            return dt->encode_blob(key, &val[0], s*sizeof(T), ext);
+        }
+        std::vector<T> le(val);
+        Base64::SwapBytes(&le[0], sizeof(T), s);
+        return dt->encode_blob(key, &le[0], s*sizeof(T), ext);
+    }
+    template <class T>
+    typename x_enable_if<!numeric<T>::value, bool>::type encode_blob(const char*key, const std::vector<T> &val, const Extend *ext) {
+        return encode_list<std::vector<T> >(key, val, ext); // only for numbers
+    }
+
     // map
     template <class Map, class Key>
     bool encode_map(const char*key, Map &val, const Extend *ext, std::string (*convert)(const Key&)) {
@@ -270,6 +307,21 @@ public:
         return true;
     }
 
+    // map with std::string key, the key is used in place without copy
+    template <class Map>
+    bool encode_str_map(const char*key, Map &val, const Extend *ext) {
+        size_t s = val.size();
+        XPACK_WRITE_EMPTY((s==0))
+
+        doc_type *dt = (doc_type*)this;
+        dt->ObjectBegin(key, ext);
+        for (typename Map::const_iterator it=val.begin(); it!=val.end(); ++it) {
+            dt->encode(it->first.c_str(), it->second, NULL);
+        }
+        dt->ObjectEnd(key, ext);
+        return true;
+    }
+
     // qmap
     template <class Map, class Key>
     bool encode_qmap(const char*key, Map &val, const Extend *ext, std::string (*convert)(const Key&)) {
@@ -51,13 +51,13 @@ xpack::xml::decode(str, u);
 class xml {
 public:
     template <class T>
-    static void decode(const std::string &data, T &val) {
-        XmlDecoder doc(data);
+    static void decode(const std::string &data, T &val, int docFlag=0) {
+        XmlDecoder doc(data, false, docFlag);
         doc.decode(NULL, val, NULL);
     }
     template <class T>
-    static void decode_file(const std::string &file_name, T &val) {
-        XmlDecoder doc(file_name, true);
+    static void decode_file(const std::string &file_name, T &val, int docFlag=0) {
+        XmlDecoder doc(file_name, true, docFlag);
         doc.decode(NULL, val, NULL);
     }
     template <class T>
@@ -68,13 +68,51 @@ public:
     }
 
     template <class T>
-    static std::string encode(const T &val, const std::string&root, int flag, int indentCount, char indentChar) {
+    static std::string encode(const T &val, const std::string&root, int flag, int indentCount, char indentChar, int docFlag=0) {
         XmlEncoder doc(indentCount, indentChar);
         Extend ext(flag, NULL);
 
+        doc.SetDocFlag(docFlag);
         doc.encode(root.c_str(), val, &ext);
         return doc.String();
     }
+
+    // write to sink by blocks(see sink.h) instead of building the whole string
+    template <class T>
+    static void encode(const T &val, const std::string&root, Sink &sink, int flag=0, int indentCount=-1, char indentChar=' ', int docFlag=0) {
+        XmlEncoder doc(indentCount, indentChar);
+        Extend ext(flag, NULL);
+
+        doc.SetDocFlag(docFlag);
+        doc.encode(root.c_str(), val, &ext);
+        doc.Write(sink);
+    }
+
+    // exact length of the output of encode with the same arguments, the tree is rendered to a SizeSink
+    template <class T>
+    static size_t encoded_size(const T &val, const std::string&root, int flag=0, int indentCount=-1, char indentChar=' ', int docFlag=0) {
+        SizeSink sink;
+        encode(val, root, sink, flag, indentCount, indentChar, docFlag);
+        return sink.Size();
+    }
+
+    // stream mode(see XmlEncoder), memory is bounded whatever the output size.
+    // attribute must be declared before the child elements of the same struct
+    template <class T>
+    static void encode_stream(const T &val, const std::string&root, Sink &sink, int flag=0, int indentCount=-1, char indentChar=' ', int docFlag=0) {
+        XmlEncoder doc(indentCount, indentChar, &sink);
+        Extend ext(flag, NULL);
+
+        doc.SetDocFlag(docFlag);
+        doc.encode(root.c_str(), val, &ext);
+        doc.Flush();
+    }
+    template <class T>
+    static void encode_file(const T &val, const std::string&root, const std::string &file_name, int flag=0, int indentCount=-1, char indentChar=' ', int docFlag=0) {
+        FileSink sink(file_name);
+        encode_stream(val, root, sink, flag, indentCount, indentChar, docFlag);
+        sink.Close();
+    }
 };
 
 }
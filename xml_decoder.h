@@ -27,6 +27,7 @@
 #include "xrapidxml/rapidxml.hpp"
 
 #include "xdecoder.h"
+#include "utf8.h"
 
 namespace xpack {
 
@@ -63,7 +64,7 @@ public:
     using xdoc_type::decode;
     typedef MemberIterator Iterator;
 
-    XmlDecoder(const std::string& str, bool isfile=false):xdoc_type(NULL, ""),_doc(new XML_READER_DOCUMENT),_node(NULL) {
+    XmlDecoder(const std::string& str, bool isfile=false, int docFlag=0):xdoc_type(NULL, ""),_doc(new XML_READER_DOCUMENT),_node(NULL) {
         std::string err;
         _xml_data = NULL;
 
@@ -84,6 +85,11 @@ public:
                     memcpy(_xml_data, str.data(), str.length());
                     _xml_data[str.length()] = '\0';
                 }
+                size_t offset;
+                if ((docFlag&X_PACK_DOC_FLAG_UTF8) && !Utf8::Valid(_xml_data, strlen(_xml_data), &offset)) {
+                    err = "parse xml fail. err=invalid utf-8. offset="+Util::itoa(offset);
+                    break;
+                }
                 _doc->parse<0>(_xml_data);
             } catch (const rapidxml::parse_error&e) {
                 err = std::string("parse xml fail. err=")+e.what()+". "+std::string(e.where<char>()).substr(0, 32);
@@ -20,6 +20,9 @@
 #include <list>
 #include <sstream>
 #include "xencoder.h"
+#include "sink.h"
+#include "utf8.h"
+#include "ftoa.h"
 
 
 namespace xpack {
@@ -32,7 +35,7 @@ private:
         Attr(const char*_key, const std::string&_val):key(_key), val(_val){}
     };
     struct Node {
-        Node(const char*_key=NULL, const Extend *ext=NULL) {
+        Node(const char*_key=NULL, const Extend *ext=NULL):depth(0), open(false), attr_pos(std::string::npos) {
             (void)ext;
             if (_key != NULL) {
                 key = _key;
@@ -51,13 +54,24 @@ private:
         std::list<Node*> childs;// child nodes
 
         std::string vec_key;    // key for vector
+
+        int  depth;             // stream mode: indent depth of the children, key!=""? depth of this node+1
+        bool open;              // stream mode: start tag is written without '>'
+        size_t attr_pos;        // stream mode: offset in _output to insert attribute, npos if already flushed
     };
 
 public:
     friend class XEncoder<XmlEncoder>;
     using xdoc_type::encode;
 
-    XmlEncoder(int indentCount=-1, char indentChar=' '):_indentCount(indentCount),_indentChar(indentChar),_decimalPlaces(324) {
+    /*
+      if stream is not NULL, it works in stream mode: xml is written to stream as it's encoded,
+      through a small buffer, the node tree is not built, so memory is bounded whatever the output size.
+      Attribute(X_PACK_FLAG_ATTR) may be declared after child elements, the content of a node is
+      kept in memory until the node ends or it's bigger than 64KB, after that attribute of the node
+      is an error. Call Flush at the end.
+    */
+    XmlEncoder(int indentCount=-1, char indentChar=' ', Sink *stream=NULL):_indentCount(indentCount),_indentChar(indentChar),_decimalPlaces(324),_doc_flag(0),_sink(NULL),_stream(stream) {
         if (_indentCount > 0) {
             if (_indentChar!=' ' && _indentChar!='\t') {
                 throw std::runtime_error("indentChar must be space or tab");
@@ -66,6 +80,15 @@ public:
         _cur = &_root;
     }
     ~XmlEncoder() {
+        std::list<Node*>::iterator it;
+        for (it=_stack.begin(); NULL!=_stream && it!=_stack.end(); ++it) { // stream mode, interrupted by exception
+            if (*it != &_root) {
+                delete *it;
+            }
+        }
+        if (NULL!=_stream && _cur!=&_root) {
+            delete _cur;
+        }
     }
 
     std::string String() {
@@ -73,6 +96,26 @@ public:
         return _output;
     }
 
+    // stream mode, write the buffered output to stream
+    void Flush() {
+        if (NULL != _stream && !_output.empty()) {
+            _stream->Write(_output.data(), _output.length());
+            _output.clear();
+        }
+    }
+
+    // render to sink, _output is flushed every few KB so only one block is in memory
+    void Write(Sink &sink) {
+        if (_root.childs.size() == 0) {
+            return;
+        }
+        _sink = &sink;
+        _output.clear();
+        appendNode(_root.childs.front(), 0);
+        flush(0);
+        _sink = NULL;
+    }
+
     void SetMaxDecimalPlaces(int maxDecimalPlaces) {
         if (maxDecimalPlaces >= 1) {
             _decimalPlaces = maxDecimalPlaces;
@@ -80,6 +123,11 @@ public:
             _decimalPlaces = 1;
         }
     }
+
+    // X_PACK_DOC_FLAG_xxx
+    void SetDocFlag(int docFlag) {
+        _doc_flag = docFlag;
+    }
 public:
     inline const char *Type() const {
         return "xml";
@@ -105,29 +153,21 @@ public:
             n->vec_key = n->key;
         }
 
-        _cur->childs.push_back(n);
-
-        _stack.push_back(_cur);
-        _cur = n;
+        begin(n);
     }
     void ArrayEnd(const char *key, const Extend *ext) {
         (void)key;
         (void)ext;
-        _cur = _stack.back();
-        _stack.pop_back();
+        end();
     }
     void ObjectBegin(const char *key, const Extend *ext) {
         Node *n = new Node(key, ext);
-        _cur->childs.push_back(n);
-
-        _stack.push_back(_cur);
-        _cur = n;
+        begin(n);
     }
     void ObjectEnd(const char *key, const Extend *ext) {
         (void)key;
         (void)ext;
-        _cur = _stack.back();
-        _stack.pop_back();
+        end();
     }
     bool writeNull(const char*key, const Extend *ext) {
         static std::string empty;
@@ -135,18 +175,17 @@ public:
     }
     // string
     bool encode(const char*key, const std::string &val, const Extend *ext) {
+        if ((_doc_flag&X_PACK_DOC_FLAG_UTF8) && !Utf8::Valid(val)) {
+            throw std::runtime_error(std::string("Invalid utf-8 string. key=")+(NULL!=key?key:""));
+        }
         if (val.empty() && Extend::OmitEmpty(ext)) {
             return false;
         } else if (Extend::Attribute(ext)) {
-            _cur->attrs.push_back(Attr(key, StringQuote(val)));
+            attr(key, StringQuote(val));
         } else if (!Extend::AliasFlag(ext, "xml", "cdata")) {
-            Node *n = new Node(key);
-            n->val = StringQuote(val);
-            _cur->childs.push_back(n);
+            leaf(key, StringQuote(val));
         } else {
-            Node *n = new Node(key);
-            n->val = "<![CDATA[" + val + "]]>";
-            _cur->childs.push_back(n);
+            leaf(key, "<![CDATA[" + val + "]]>");
         }
         return true;
     }
@@ -164,11 +203,9 @@ public:
             }
 
             if (Extend::Attribute(ext)) {
-                _cur->attrs.push_back(Attr(key, bval));
+                attr(key, bval);
             } else {
-                Node *n = new Node(key);
-                n->val = bval;
-                _cur->childs.push_back(n);
+                leaf(key, bval);
             }
         }
         return true;
@@ -249,16 +286,34 @@ private:
         if (val==0 && Extend::OmitEmpty(ext)) {
             return false;
         } else if (Extend::Attribute(ext)) {
-            _cur->attrs.push_back(Attr(key, Util::itoa(val)));
+            attr(key, Util::itoa(val));
         } else {
-            Node *n = new Node(key);
-            n->val = Util::itoa(val);
-            _cur->childs.push_back(n);
+            leaf(key, Util::itoa(val));
         }
         return true;
     }
 
     // float
+    // shortest digits that read back as the same float, unless max decimal places is set
+    bool encode_float(const char*key, const float &val, const Extend *ext) {
+        if (_decimalPlaces!=324 || rapidjson::internal::Double(val).IsNanOrInf()) {
+            return encode_float<float>(key, val, ext);
+        } else if (val==0 && Extend::OmitEmpty(ext)) {
+            return false;
+        }
+        char buffer[32];
+        char *end = ftoa(val, buffer);
+        if (end-buffer>2 && end[-2]=='.' && end[-1]=='0') { // 1.0 -> 1, same as ostream
+            end -= 2;
+        }
+        std::string fval(buffer, end);
+        if (Extend::Attribute(ext)) {
+            attr(key, fval);
+        } else {
+            leaf(key, fval);
+        }
+        return true;
+    }
     template <class T>
     typename x_enable_if<numeric<T>::is_float, bool>::type encode_float(const char*key, const T &val, const Extend *ext) {
         if (val==0 && Extend::OmitEmpty(ext)) {
@@ -270,15 +325,142 @@ private:
             std::string fval = os.str();
 
             if (Extend::Attribute(ext)) {
-                _cur->attrs.push_back(Attr(key, fval));
+                attr(key, fval);
             } else {
-                Node *n = new Node(key);
-                n->val = fval;
-                _cur->childs.push_back(n);
+                leaf(key, fval);
             }
         }
         return true;
     }
+    void begin(Node *n) {
+        if (NULL == _stream) {
+            _cur->childs.push_back(n);
+        } else {
+            int depth = child_begin();
+            if (!n->key.empty()) {
+                indent(depth);
+                _output.push_back('<');
+                _output += n->key;
+                n->open = true;
+                n->attr_pos = _output.length();
+                n->depth = depth+1;
+            } else {
+                n->depth = depth>0?depth:1; // same as appendNode
+            }
+        }
+        _stack.push_back(_cur);
+        _cur = n;
+    }
+    void end() {
+        Node *n = _cur;
+        _cur = _stack.back();
+        _stack.pop_back();
+        if (NULL != _stream) {
+            if (!n->key.empty()) {
+                if (n->open) {
+                    _output += "/>";
+                } else {
+                    indent(n->depth-1);
+                    _output += "</";
+                    _output += n->key;
+                    _output.push_back('>');
+                }
+            }
+            delete n;
+            stream_flush();
+        }
+    }
+    void leaf(const char *key, const std::string &val) {
+        if (NULL == _stream) {
+            Node *n = new Node(key);
+            n->val = val;
+            _cur->childs.push_back(n);
+            return;
+        }
+
+        int depth = child_begin();
+        if (NULL == key || key[0] == '\0') {
+            _output += val;
+            return;
+        }
+        indent(depth);
+        _output.push_back('<');
+        _output += key;
+        if (val.empty()) {
+            _output += "/>";
+        } else {
+            _output.push_back('>');
+            _output += val;
+            _output += "</";
+            _output += key;
+            _output.push_back('>');
+        }
+        stream_flush();
+    }
+    void attr(const char *key, const std::string &val) {
+        if (NULL == _stream) {
+            _cur->attrs.push_back(Attr(key, val));
+        } else if (_cur->attr_pos != std::string::npos) {
+            std::string a(" ");
+            a += key;
+            a += "=\"";
+            a += val;
+            a.push_back('"');
+            _output.insert(_cur->attr_pos, a);
+            _cur->attr_pos += a.length();
+        } else {
+            throw std::runtime_error(std::string("xml stream encode: attribute after more than 64KB child elements. key=")+(NULL!=key?key:""));
+        }
+    }
+    // stream mode, write _output before the first node that may still get attribute
+    void stream_flush() {
+        if (_output.length() < 4096) {
+            return;
+        }
+        Node *first = NULL;
+        std::list<Node*>::iterator it;
+        for (it=_stack.begin(); NULL==first && it!=_stack.end(); ++it) {
+            if ((*it)->attr_pos != std::string::npos) {
+                first = *it;
+            }
+        }
+        if (NULL==first && _cur->attr_pos!=std::string::npos) {
+            first = _cur;
+        }
+
+        if (NULL == first) {
+            Flush();
+            return;
+        } else if (_output.length()-first->attr_pos > 65536) { // too big to wait, no more attribute for it
+            first->attr_pos = std::string::npos;
+            stream_flush();
+            return;
+        }
+
+        size_t limit = first->attr_pos;
+        if (limit < 4096) {
+            return;
+        }
+        _stream->Write(_output.data(), limit);
+        _output.erase(0, limit);
+        for (it=_stack.begin(); it!=_stack.end(); ++it) {
+            if ((*it)->attr_pos != std::string::npos) {
+                (*it)->attr_pos -= limit;
+            }
+        }
+        if (_cur->attr_pos != std::string::npos) {
+            _cur->attr_pos -= limit;
+        }
+    }
+    // stream mode, a child is going to be written to _cur, return its indent depth
+    int child_begin() {
+        if (_cur->open) {
+            _output.push_back('>');
+            _cur->open = false;
+        }
+        return _cur->depth;
+    }
+
     void appendNode(const Node *nd, int depth) {
         bool indentEnd = true;
 
@@ -316,6 +498,7 @@ private:
             std::list<Node*>::const_iterator it;
             for (it=nd->childs.begin(); it!=nd->childs.end(); ++it) {
                 appendNode(*it, depth+1);
+                flush(4096);
             }
         }
 
@@ -336,6 +519,13 @@ private:
         appendNode(_root.childs.front(), 0);
     }
 
+    void flush(size_t threshold) {
+        if (NULL != _sink && _output.length() >= threshold && !_output.empty()) {
+            _sink->Write(_output.data(), _output.length());
+            _output.clear();
+        }
+    }
+
     void indent(int depth) {
         if (_indentCount < 0) {
             return;
@@ -359,6 +549,11 @@ private:
     char _indentChar;
 
     int _decimalPlaces;
+
+    int _doc_flag;
+
+    Sink *_sink;   // Write
+    Sink *_stream; // stream mode
 };
 
 }
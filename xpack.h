@@ -120,22 +120,26 @@
         }
 
 // bitfield, not support alias
-#define X_PACK_DECODE_ACT_B(ARG, B)                           \
-    {                                                         \
-        x_pack_decltype(__x_pack_self.B) __x_pack_tmp = 0;    \
-        __x_pack_obj.decode(#B, __x_pack_tmp, &__x_pack_ext); \
-        __x_pack_self.B = __x_pack_tmp;\
+#define X_PACK_DECODE_ACT_B(ARG, B)                                 \
+    {                                                               \
+        x_pack_decltype(__x_pack_self.B) __x_pack_tmp = 0;          \
+        if (__x_pack_obj.decode(#B, __x_pack_tmp, &__x_pack_ext)) { \
+            __x_pack_self.B = __x_pack_tmp;                         \
+        }                                                           \
     }
 
 // ~~~~~~~~~~~~~~~~~~~~~~~ encode act ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ext.key is set to the key literal, encoder can know the key is static(see JsonKeyCache)
+// ext.member is set to the address of the member, encoder can know the value is not a copy(see X_PACK_FLAG_REF)
 #define X_PACK_ENCODE_ACT_O(ARG, M)                        \
-        __x_pack_obj.encode(#M, __x_pack_self.M, &__x_pack_ext);
+        __x_pack_ext.member = &__x_pack_self.M;            \
+        __x_pack_obj.encode(__x_pack_ext.key=#M, __x_pack_self.M, &__x_pack_ext);
 #define X_PACK_ENCODE_ACT_C(CUSTOM, M)                        \
-        CUSTOM##_encode(__x_pack_obj, __x_pack_self, #M, __x_pack_self.M, &__x_pack_ext);
+        CUSTOM##_encode(__x_pack_obj, __x_pack_self, __x_pack_ext.key=#M, __x_pack_self.M, &__x_pack_ext);
 
 #ifndef X_PACK_SUPPORT_CXX0X
 #define X_PACK_ENCODE_ACT_E(ARG, M)                        \
-        __x_pack_obj.encode(#M, (const int&)__x_pack_self.M, &__x_pack_ext);
+        __x_pack_obj.encode(__x_pack_ext.key=#M, (const int&)__x_pack_self.M, &__x_pack_ext);
 #else
 #define X_PACK_ENCODE_ACT_E X_PACK_ENCODE_ACT_O
 #endif
@@ -145,11 +149,13 @@
         static xpack::Alias __x_pack_alias(#M, NAME);                     \
         xpack::Extend __x_pack_ext(__x_pack_flag, &__x_pack_alias);       \
         const char *__new_name = __x_pack_alias.Name(__x_pack_obj.Type());\
+        __x_pack_ext.key = __new_name;                                    \
+        __x_pack_ext.member = &__x_pack_self.M;                           \
         __x_pack_obj.encode(__new_name, __x_pack_self.M, &__x_pack_ext);  \
     }
 
 #define X_PACK_ENCODE_ACT_B(ARG, M)      \
-        __x_pack_obj.encode(#M, __x_pack_self.M, &__x_pack_ext);
+        __x_pack_obj.encode(__x_pack_ext.key=#M, __x_pack_self.M, &__x_pack_ext);
 
 #define X_PACK_ENCODE_ACT_I(ARG, P)                                                                        \
         {                                                                                                  \
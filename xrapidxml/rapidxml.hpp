@@ -572,7 +572,7 @@ namespace xpack::rapidxml
         
         char *align(char *ptr)
         {
-            std::size_t alignment = ((RAPIDXML_ALIGNMENT - (std::size_t(ptr) & (RAPIDXML_ALIGNMENT - 1))) & (RAPIDXML_ALIGNMENT - 1));
+            std::size_t alignment = ((XPACK_RAPIDXML_ALIGNMENT - (std::size_t(ptr) & (XPACK_RAPIDXML_ALIGNMENT - 1))) & (XPACK_RAPIDXML_ALIGNMENT - 1));
             return ptr + alignment;
         }
         
@@ -590,7 +590,7 @@ namespace xpack::rapidxml
                 memory = new char[size];
 #ifdef XPACK_RAPIDXML_NO_EXCEPTIONS
                 if (!memory)            // If exceptions are disabled, verify memory allocation, because new will not be able to throw bad_alloc
-                    RAPIDXML_PARSE_ERROR("out of memory", 0);
+                    XPACK_RAPIDXML_PARSE_ERROR("out of memory", 0);
 #endif
             }
             return static_cast<char *>(memory);
@@ -605,12 +605,12 @@ namespace xpack::rapidxml
             if (result + size > m_end)
             {
                 // Calculate required pool size (may be bigger than RAPIDXML_DYNAMIC_POOL_SIZE)
-                std::size_t pool_size = RAPIDXML_DYNAMIC_POOL_SIZE;
+                std::size_t pool_size = XPACK_RAPIDXML_DYNAMIC_POOL_SIZE;
                 if (pool_size < size)
                     pool_size = size;
                 
                 // Allocate
-                std::size_t alloc_size = sizeof(header) + (2 * RAPIDXML_ALIGNMENT - 2) + pool_size;     // 2 alignments required in worst case: one for header, one for actual allocation
+                std::size_t alloc_size = sizeof(header) + (2 * XPACK_RAPIDXML_ALIGNMENT - 2) + pool_size;     // 2 alignments required in worst case: one for header, one for actual allocation
                 char *raw_memory = allocate_raw(alloc_size);
                     
                 // Setup new pool in allocated memory
@@ -633,7 +633,7 @@ namespace xpack::rapidxml
         char *m_begin;                                      // Start of raw memory making up current pool
         char *m_ptr;                                        // First free byte in current pool
         char *m_end;                                        // One past last available byte in current pool
-        char m_static_memory[RAPIDXML_STATIC_POOL_SIZE];    // Static raw memory
+        char m_static_memory[XPACK_RAPIDXML_STATIC_POOL_SIZE];    // Static raw memory
         alloc_func *m_alloc_func;                           // Allocator function, or 0 if default is to be used
         free_func *m_free_func;                             // Free function, or 0 if default is to be used
     };
@@ -1405,7 +1405,7 @@ namespace xpack::rapidxml
                         this->append_node(node);
                 }
                 else
-                    RAPIDXML_PARSE_ERROR("expected <", text);
+                    XPACK_RAPIDXML_PARSE_ERROR("expected <", text);
             }
 
         }
@@ -1548,7 +1548,7 @@ namespace xpack::rapidxml
                 }
                 else    // Invalid, only codes up to 0x10FFFF are allowed in Unicode
                 {
-                    RAPIDXML_PARSE_ERROR("invalid numeric character entity", text);
+                    XPACK_RAPIDXML_PARSE_ERROR("invalid numeric character entity", text);
                 }
             }
         }
@@ -1679,7 +1679,7 @@ namespace xpack::rapidxml
                             if (*src == Ch(';'))
                                 ++src;
                             else
-                                RAPIDXML_PARSE_ERROR("expected ;", src);
+                                XPACK_RAPIDXML_PARSE_ERROR("expected ;", src);
                             continue;
 
                         // Something else
@@ -1744,7 +1744,7 @@ namespace xpack::rapidxml
                 while (text[0] != Ch('?') || text[1] != Ch('>'))
                 {
                     if (!text[0])
-                        RAPIDXML_PARSE_ERROR("unexpected end of data", text);
+                        XPACK_RAPIDXML_PARSE_ERROR("unexpected end of data", text);
                     ++text;
                 }
                 text += 2;    // Skip '?>'
@@ -1762,7 +1762,7 @@ namespace xpack::rapidxml
             
             // Skip ?>
             if (text[0] != Ch('?') || text[1] != Ch('>'))
-                RAPIDXML_PARSE_ERROR("expected ?>", text);
+                XPACK_RAPIDXML_PARSE_ERROR("expected ?>", text);
             text += 2;
             
             return declaration;
@@ -1779,7 +1779,7 @@ namespace xpack::rapidxml
                 while (text[0] != Ch('-') || text[1] != Ch('-') || text[2] != Ch('>'))
                 {
                     if (!text[0])
-                        RAPIDXML_PARSE_ERROR("unexpected end of data", text);
+                        XPACK_RAPIDXML_PARSE_ERROR("unexpected end of data", text);
                     ++text;
                 }
                 text += 3;     // Skip '-->'
@@ -1793,7 +1793,7 @@ namespace xpack::rapidxml
             while (text[0] != Ch('-') || text[1] != Ch('-') || text[2] != Ch('>'))
             {
                 if (!text[0])
-                    RAPIDXML_PARSE_ERROR("unexpected end of data", text);
+                    XPACK_RAPIDXML_PARSE_ERROR("unexpected end of data", text);
                 ++text;
             }
 
@@ -1835,7 +1835,7 @@ namespace xpack::rapidxml
                         {
                             case Ch('['): ++depth; break;
                             case Ch(']'): --depth; break;
-                            case 0: RAPIDXML_PARSE_ERROR("unexpected end of data", text);
+                            case 0: XPACK_RAPIDXML_PARSE_ERROR("unexpected end of data", text);
                         }
                         ++text;
                     }
@@ -1844,7 +1844,7 @@ namespace xpack::rapidxml
                 
                 // Error on end of text
                 case Ch('\0'):
-                    RAPIDXML_PARSE_ERROR("unexpected end of data", text);
+                    XPACK_RAPIDXML_PARSE_ERROR("unexpected end of data", text);
                 
                 // Other character, skip it
                 default:
@@ -1889,7 +1889,7 @@ namespace xpack::rapidxml
                 Ch *name = text;
                 skip<node_name_pred, Flags>(text);
                 if (text == name)
-                    RAPIDXML_PARSE_ERROR("expected PI target", text);
+                    XPACK_RAPIDXML_PARSE_ERROR("expected PI target", text);
                 pi->name(name, text - name);
                 
                 // Skip whitespace between pi target and pi
@@ -1902,7 +1902,7 @@ namespace xpack::rapidxml
                 while (text[0] != Ch('?') || text[1] != Ch('>'))
                 {
                     if (*text == Ch('\0'))
-                        RAPIDXML_PARSE_ERROR("unexpected end of data", text);
+                        XPACK_RAPIDXML_PARSE_ERROR("unexpected end of data", text);
                     ++text;
                 }
 
@@ -1925,7 +1925,7 @@ namespace xpack::rapidxml
                 while (text[0] != Ch('?') || text[1] != Ch('>'))
                 {
                     if (*text == Ch('\0'))
-                        RAPIDXML_PARSE_ERROR("unexpected end of data", text);
+                        XPACK_RAPIDXML_PARSE_ERROR("unexpected end of data", text);
                     ++text;
                 }
                 text += 2;    // Skip '?>'
@@ -2004,7 +2004,7 @@ namespace xpack::rapidxml
                 while (text[0] != Ch(']') || text[1] != Ch(']') || text[2] != Ch('>'))
                 {
                     if (!text[0])
-                        RAPIDXML_PARSE_ERROR("unexpected end of data", text);
+                        XPACK_RAPIDXML_PARSE_ERROR("unexpected end of data", text);
                     ++text;
                 }
                 text += 3;      // Skip ]]>
@@ -2016,7 +2016,7 @@ namespace xpack::rapidxml
             while (text[0] != Ch(']') || text[1] != Ch(']') || text[2] != Ch('>'))
             {
                 if (!text[0])
-                    RAPIDXML_PARSE_ERROR("unexpected end of data", text);
+                    XPACK_RAPIDXML_PARSE_ERROR("unexpected end of data", text);
                 ++text;
             }
 
@@ -2043,7 +2043,7 @@ namespace xpack::rapidxml
             Ch *name = text;
             skip<node_name_pred, Flags>(text);
             if (text == name)
-                RAPIDXML_PARSE_ERROR("expected element name", text);
+                XPACK_RAPIDXML_PARSE_ERROR("expected element name", text);
             element->name(name, text - name);
             
             // Skip whitespace between element name and attributes or >
@@ -2062,11 +2062,11 @@ namespace xpack::rapidxml
             {
                 ++text;
                 if (*text != Ch('>'))
-                    RAPIDXML_PARSE_ERROR("expected >", text);
+                    XPACK_RAPIDXML_PARSE_ERROR("expected >", text);
                 ++text;
             }
             else
-                RAPIDXML_PARSE_ERROR("expected >", text);
+                XPACK_RAPIDXML_PARSE_ERROR("expected >", text);
 
             // Place zero terminator after name
             if (!(Flags & parse_no_string_terminators))
@@ -2153,7 +2153,7 @@ namespace xpack::rapidxml
                 while (*text != Ch('>'))
                 {
                     if (*text == 0)
-                        RAPIDXML_PARSE_ERROR("unexpected end of data", text);
+                        XPACK_RAPIDXML_PARSE_ERROR("unexpected end of data", text);
                     ++text;
                 }
                 ++text;     // Skip '>'
@@ -2196,7 +2196,7 @@ namespace xpack::rapidxml
                             Ch *closing_name = text;
                             skip<node_name_pred, Flags>(text);
                             if (!internal::compare(node->name(), node->name_size(), closing_name, text - closing_name, true))
-                                RAPIDXML_PARSE_ERROR("invalid closing tag name", text);
+                                XPACK_RAPIDXML_PARSE_ERROR("invalid closing tag name", text);
                         }
                         else
                         {
@@ -2206,7 +2206,7 @@ namespace xpack::rapidxml
                         // Skip remaining whitespace after node name
                         skip<whitespace_pred, Flags>(text);
                         if (*text != Ch('>'))
-                            RAPIDXML_PARSE_ERROR("expected >", text);
+                            XPACK_RAPIDXML_PARSE_ERROR("expected >", text);
                         ++text;     // Skip '>'
                         return;     // Node closed, finished parsing contents
                     }
@@ -2221,7 +2221,7 @@ namespace xpack::rapidxml
 
                 // End of data - error
                 case Ch('\0'):
-                    RAPIDXML_PARSE_ERROR("unexpected end of data", text);
+                    XPACK_RAPIDXML_PARSE_ERROR("unexpected end of data", text);
 
                 // Data node
                 default:
@@ -2244,7 +2244,7 @@ namespace xpack::rapidxml
                 ++text;     // Skip first character of attribute name
                 skip<attribute_name_pred, Flags>(text);
                 if (text == name)
-                    RAPIDXML_PARSE_ERROR("expected attribute name", name);
+                    XPACK_RAPIDXML_PARSE_ERROR("expected attribute name", name);
 
                 // Create new attribute
                 xml_attribute<Ch> *attribute = this->allocate_attribute();
@@ -2256,7 +2256,7 @@ namespace xpack::rapidxml
 
                 // Skip =
                 if (*text != Ch('='))
-                    RAPIDXML_PARSE_ERROR("expected =", text);
+                    XPACK_RAPIDXML_PARSE_ERROR("expected =", text);
                 ++text;
 
                 // Add terminating zero after name
@@ -2269,7 +2269,7 @@ namespace xpack::rapidxml
                 // Skip quote and remember if it was ' or "
                 Ch quote = *text;
                 if (quote != Ch('\'') && quote != Ch('"'))
-                    RAPIDXML_PARSE_ERROR("expected ' or \"", text);
+                    XPACK_RAPIDXML_PARSE_ERROR("expected ' or \"", text);
                 ++text;
 
                 // Extract attribute value and expand char refs in it
@@ -2285,7 +2285,7 @@ namespace xpack::rapidxml
                 
                 // Make sure that end quote is present
                 if (*text != quote)
-                    RAPIDXML_PARSE_ERROR("expected ' or \"", text);
+                    XPACK_RAPIDXML_PARSE_ERROR("expected ' or \"", text);
                 ++text;     // Skip quote
 
                 // Add terminating zero after value
@@ -2586,7 +2586,7 @@ namespace xpack::rapidxml
 }
 
 // Undefine internal macros
-#undef RAPIDXML_PARSE_ERROR
+#undef XPACK_RAPIDXML_PARSE_ERROR
 
 // On MSVC, restore warnings state
 #ifdef _MSC_VER